@@ -0,0 +1,54 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Block compressed copies of atlases, so they upload as is and take 4 to 8 times less GPU memory
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class AtlasCompression {
+ public:
+  static constexpr uint32_t VERSION = 1;
+
+  enum class Format : uint32_t {
+    BC1 = 1, // RGB atlases, 8 bytes per 4x4 block
+    BC7 = 2, // RGB atlases, 16 bytes per 4x4 block
+    BC6H = 3, // HDR atlases, unsigned, 16 bytes per 4x4 block
+  };
+
+  // Identifies the atlas levels and format a compressed copy was built from
+  struct Key {
+    uint64_t atlasSize = 0;
+    int64_t atlasTime = 0;
+    uint64_t offset = 0;
+    uint32_t dim = 0;
+    uint32_t numLevels = 0;
+    Format format = Format::BC7;
+  };
+
+  // numLevels levels of a dim x dim atlas starting at offset in atlasFile, halving dim each
+  static Key MakeKey(
+      const std::string& atlasFile,
+      size_t offset,
+      int dim,
+      int numLevels,
+      Format format);
+
+  static const char* Name(Format format);
+
+  // Offset of the blocks in a compressed file
+  static size_t DataOffset();
+
+  // Bytes of all levels of a key's compressed copy, each a whole number of blocks
+  static size_t NumBytes(const Key& key);
+
+  // Whether compressedFile exists and was built from key
+  static bool IsCurrent(const std::string& compressedFile, const Key& key);
+
+  // Encodes the levels key names to compressedFile, atomically, on all cores. Texels are 3 8-bit
+  // channels for BC1 and BC7 and 3 16-bit floats for BC6H. Blocks ignore the atlas tiles, so
+  // their edges must fall on multiples of 4 texels on every level. Returns false on failure.
+  static bool Build(
+      const std::string& atlasFile,
+      const std::string& compressedFile,
+      const Key& key);
+};
@@ -0,0 +1,40 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Mip chains of atlases that downsample within each tile, so faces never bleed into each other
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class AtlasMipmaps {
+ public:
+  static constexpr uint32_t VERSION = 1;
+
+  // Identifies the atlas and tile size a mip chain was built from
+  struct Key {
+    uint64_t atlasSize = 0;
+    int64_t atlasTime = 0;
+    uint32_t tileSize = 0;
+  };
+
+  static Key MakeKey(const std::string& atlasFile, int tileSize);
+
+  // Levels down to one texel per tile, 0 if tiles of tileSize cannot be halved that far
+  static int NumLevels(int dim, int tileSize);
+
+  // Offset of level in a mip file of a dim x dim atlas, whose levels follow a header finest first
+  static size_t LevelOffset(int dim, size_t texelBytes, int level);
+
+  // Whether mipFile exists and was built from key
+  static bool IsCurrent(const std::string& mipFile, const Key& key);
+
+  // Writes every level of the dim x dim atlas in atlasFile to mipFile, atomically. Texels are
+  // texelBytes of 8-bit channels, or of 16-bit floats if halfFloat is set. Returns false on
+  // failure.
+  static bool Build(
+      const std::string& atlasFile,
+      const std::string& mipFile,
+      const Key& key,
+      const int dim,
+      const size_t texelBytes,
+      const bool halfFloat);
+};
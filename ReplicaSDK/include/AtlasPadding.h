@@ -0,0 +1,50 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Atlases whose tiles carry a border of texels from the adjacent faces, so shaders can filter them
+// in hardware instead of walking the adjacency
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "MeshCache.h"
+#include "Span.h"
+
+class AtlasPadding {
+ public:
+  static constexpr uint32_t VERSION = 1;
+
+  // Texels added on each side of a tile, enough for bilinear taps just outside it
+  static constexpr int BORDER = 1;
+
+  // Identifies the atlas, mesh and tile size a padded atlas was built from
+  struct Key {
+    uint64_t atlasSize = 0;
+    int64_t atlasTime = 0;
+    MeshCache::Key meshKey;
+    uint32_t tileSize = 0;
+  };
+
+  static Key MakeKey(const std::string& atlasFile, const MeshCache::Key& meshKey, int tileSize);
+
+  // Size of the padded copy of a dim x dim atlas
+  static int PaddedDim(int dim, int tileSize) {
+    return dim / tileSize * (tileSize + 2 * BORDER);
+  }
+
+  // Offset of the texels in padded atlas files, which start with a header
+  static size_t DataOffset();
+
+  // Whether paddedFile exists and was built from key
+  static bool IsCurrent(const std::string& paddedFile, const Key& key);
+
+  // Pads the dim x dim atlas in atlasFile, of texelBytes per texel, with the texels the shaders
+  // would fetch from the faces adjacent to each tile. adjFaces holds the packed adjacent face and
+  // rotation of every face edge. paddedFile is written atomically, returns false on failure.
+  static bool Build(
+      const std::string& atlasFile,
+      const std::string& paddedFile,
+      const Key& key,
+      const int dim,
+      const size_t texelBytes,
+      const Span<const uint32_t>& adjFaces);
+};
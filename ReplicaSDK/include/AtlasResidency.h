@@ -0,0 +1,126 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Keeps sub-mesh texture atlases on the GPU within a byte budget, streaming them in on demand
+#pragma once
+
+#include <pangolin/gl/gl.h>
+
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+
+class AtlasResidency {
+ public:
+  // Atlas file and how to upload it
+  struct AtlasFile {
+    std::string filename;
+    size_t offset = 0; // of the texels in the file
+    size_t numBytes = 0; // texel bytes in the file
+    size_t gpuBytes = 0; // size of the texture once uploaded
+    GLsizei dim = 0; // atlases are square
+    int numLevels = 1; // mip levels following each other in the file, halving dim
+    GLint internalFormat = GL_RGBA8;
+    GLenum format = GL_RGBA;
+    GLenum type = GL_UNSIGNED_BYTE;
+    bool compressed = false;
+    bool samplingLinear = false;
+  };
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t uploads = 0;
+    size_t uploadedBytes = 0;
+    size_t peakResidentBytes = 0;
+  };
+
+  // budgetBytes of 0 keeps every atlas that was ever loaded resident. queueDepth is the number of
+  // atlases read from disk at the same time.
+  AtlasResidency(std::vector<AtlasFile> atlasFiles, const size_t budgetBytes, const int queueDepth);
+  ~AtlasResidency();
+  AtlasResidency(const AtlasResidency&) = delete;
+  AtlasResidency& operator=(const AtlasResidency&) = delete;
+
+  size_t NumAtlases() const {
+    return atlases.size();
+  }
+
+  // Size of atlas i, whether it is resident or not
+  GLsizei Dim(size_t i) const {
+    return atlases[i].file.dim;
+  }
+
+  const Stats& GetStats() const {
+    return stats;
+  }
+
+  // Uploads all atlases, reading ahead while the GPU transfers
+  void LoadAll();
+
+  // Texture to draw atlas i with. A non resident atlas is uploaded on demand, evicting the least
+  // recently used ones to stay within budget, and until it arrives a placeholder is returned
+  // unless wait is set.
+  const pangolin::GlTexture& Acquire(size_t i, const bool wait);
+
+  // Bindless handle of the texture Acquire returns, resident until the atlas is evicted. Needs
+  // GL_ARB_bindless_texture.
+  GLuint64 AcquireHandle(size_t i, const bool wait);
+
+  // Starts a new frame and reads the given atlases in the background, most urgent first, as far
+  // as they fit the budget. Only atlases that are neither in this list nor used since the
+  // previous call make room for them.
+  void Prefetch(const std::vector<size_t>& upcoming);
+
+  // Uploads the atlases whose reads have completed and keeps the prefetch queue going
+  void Update();
+
+ private:
+  enum class State { Evicted, Loading, Resident };
+
+  struct Atlas {
+    AtlasFile file;
+    pangolin::GlTexture texture;
+    GLuint64 handle = 0;
+    State state = State::Evicted;
+    uint64_t lastUsed = 0;
+    uint64_t lastUsedFrame = 0;
+    bool upcoming = false;
+  };
+
+  // Pixel unpack buffer a reader thread fills while it is mapped
+  struct Slot {
+    pangolin::GlBufferData pbo;
+    std::future<bool> read;
+    size_t atlas = 0;
+  };
+
+  bool MakeRoom(const size_t numBytes, const bool prefetch);
+  void Evict(size_t i);
+  void StartLoad(size_t i);
+  void FinishOldestLoad();
+  void FinishCompletedLoads();
+
+  // Uploads every level of an atlas from the bound PBO
+  static void UploadLevels(pangolin::GlTexture& texture, const AtlasFile& file);
+
+  std::vector<Atlas> atlases;
+  pangolin::GlTexture placeholder;
+  GLuint64 placeholderHandle = 0;
+
+  const size_t budgetBytes;
+  size_t residentBytes = 0;
+  size_t loadingBytes = 0;
+
+  // in flight loads, oldest first, occupy slots [firstSlot, firstSlot + numLoading) of the ring
+  std::vector<Slot> slots;
+  size_t firstSlot = 0;
+  size_t numLoading = 0;
+
+  std::deque<size_t> prefetchQueue;
+  uint64_t tick = 0;
+  uint64_t frame = 0;
+
+  Stats stats;
+};
@@ -0,0 +1,40 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Bounding volume hierarchy over the sub-meshes' boxes, for culling them against a frustum
+#pragma once
+
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+
+class BoundsTree {
+ public:
+  // Builds the tree over boxes, box i standing for item i
+  void Build(const std::vector<Eigen::AlignedBox3f>& boxes);
+
+  // Appends the items whose boxes intersect frustum, in increasing order. Returns the number of
+  // boxes tested.
+  size_t Query(const Frustum& frustum, std::vector<size_t>& items) const;
+
+ private:
+  // Leaves list items [first, first + count) of the item order, inner nodes have count 0 and
+  // their children at the next node and at first
+  struct Node {
+    Eigen::AlignedBox3f bounds;
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  static constexpr size_t MAX_LEAF_ITEMS = 4;
+
+  uint32_t BuildNode(
+      const std::vector<Eigen::AlignedBox3f>& boxes,
+      const size_t begin,
+      const size_t end);
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> order;
+  std::vector<Eigen::AlignedBox3f> itemBounds; // in item order
+};
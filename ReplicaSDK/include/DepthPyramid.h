@@ -0,0 +1,37 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Hierarchical depth buffer, each texel holding the farthest depth of the pixels it covers
+#pragma once
+
+#include <pangolin/gl/gl.h>
+
+class DepthPyramid {
+ public:
+  DepthPyramid() {}
+  ~DepthPyramid();
+  DepthPyramid(const DepthPyramid&) = delete;
+  DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+  // Copies the depth attachment of the bound draw framebuffer and reduces it with reduceProgram
+  // (depth-pyramid.comp). Fails, leaving the pyramid as it was, when the framebuffer has no
+  // single-sampled depth attachment to copy, e.g. for the default framebuffer.
+  bool Capture(GLuint reduceProgram);
+
+  // R32F texture, level 0 at the depth buffer's resolution
+  GLuint Texture() const {
+    return pyramid;
+  }
+
+  GLint NumLevels() const {
+    return numLevels;
+  }
+
+ private:
+  void Resize(const GLsizei width, const GLsizei height, const GLenum depthFormat);
+
+  GLuint depthCopy = 0;
+  GLuint pyramid = 0;
+  GLsizei width = 0;
+  GLsizei height = 0;
+  GLenum depthFormat = 0;
+  GLint numLevels = 0;
+};
@@ -12,8 +12,16 @@ class FileMemMap
 public:
 	FileMemMap() {}
 
-	// map file to memory
-	char *mapfile(const std::string &filename);
+	// map file to memory, reading it all in up front if populate is set
+	char *mapfile(const std::string &filename, bool populate = true);
+
+	// hint that the mapping will be read front to back, so pages are read ahead and dropped soon
+	void adviseSequential();
+
+	// drop the resident pages of the mapping, or of the pages overlapping [begin, end) in it. They
+	// are read from the file again when touched.
+	void dropPages();
+	void dropPages(const void *begin, const void *end);
 
 	// release file and mapped resource
 	void release();
@@ -0,0 +1,92 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+// Convex volume bounded by up to MAX_PLANES planes, keeping points p with n.p + d >= 0. Usually
+// the view frustum planes extracted from a combined projection * modelview matrix.
+class Frustum {
+ public:
+  static constexpr int MAX_PLANES = 8;
+
+  // How a box relates to the planes being tested
+  enum class Overlap { Outside, Intersects, Inside };
+
+  // Unbounded, add planes to restrict it
+  Frustum() {}
+
+  explicit Frustum(const Eigen::Matrix4d& mvp) {
+    const Eigen::Matrix4f m = mvp.cast<float>();
+
+    // left, right, bottom, top, near, far
+    AddPlane((m.row(3) + m.row(0)).transpose());
+    AddPlane((m.row(3) - m.row(0)).transpose());
+    AddPlane((m.row(3) + m.row(1)).transpose());
+    AddPlane((m.row(3) - m.row(1)).transpose());
+    AddPlane((m.row(3) + m.row(2)).transpose());
+    AddPlane((m.row(3) - m.row(2)).transpose());
+  }
+
+  // An all zero plane, the renderers' way of saying no clip plane, is ignored. Planes are
+  // normalized so they measure distances, as the sphere test needs.
+  void AddPlane(const Eigen::Vector4f& plane) {
+    if (plane.isZero() || numPlanes == MAX_PLANES)
+      return;
+
+    const float length = plane.head<3>().norm();
+    planes[numPlanes++] = length > 0.0f ? Eigen::Vector4f(plane / length) : plane;
+  }
+
+  // Bit set of all planes, for Classify
+  unsigned AllPlanes() const {
+    return (1u << numPlanes) - 1;
+  }
+
+  // Conservative test, may report boxes just outside a frustum corner as intersecting
+  bool Intersects(const Eigen::AlignedBox3f& box) const {
+    unsigned mask = AllPlanes();
+    return Classify(box, mask) != Overlap::Outside;
+  }
+
+  // Conservative test of a bounding sphere
+  bool Intersects(const Eigen::Vector3f& center, const float radius) const {
+    for (int i = 0; i < numPlanes; i++) {
+      if (planes[i].head<3>().dot(center) + planes[i](3) < -radius)
+        return false;
+    }
+
+    return true;
+  }
+
+  // Tests box against the planes in mask, clearing the bits of the planes it is fully inside.
+  // Boxes within a box that is inside a plane are too, so hierarchies pass the mask down.
+  Overlap Classify(const Eigen::AlignedBox3f& box, unsigned& mask) const {
+    if (box.isEmpty())
+      return Overlap::Outside;
+
+    for (int i = 0; i < numPlanes; i++) {
+      if (!(mask & (1u << i)))
+        continue;
+
+      // corners furthest along and against the plane normal
+      Eigen::Vector3f outer, inner;
+      for (int j = 0; j < 3; j++) {
+        outer(j) = planes[i](j) >= 0.0f ? box.max()(j) : box.min()(j);
+        inner(j) = planes[i](j) >= 0.0f ? box.min()(j) : box.max()(j);
+      }
+
+      if (planes[i].head<3>().dot(outer) + planes[i](3) < 0.0f)
+        return Overlap::Outside;
+
+      if (planes[i].head<3>().dot(inner) + planes[i](3) >= 0.0f)
+        mask &= ~(1u << i);
+    }
+
+    return mask == 0 ? Overlap::Inside : Overlap::Intersects;
+  }
+
+ private:
+  Eigen::Vector4f planes[MAX_PLANES];
+  int numPlanes = 0;
+};
@@ -0,0 +1,20 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#pragma once
+
+#include <pangolin/gl/gl.h>
+
+#include <string>
+
+// Whether the current context supports the named OpenGL extension
+inline bool HasGlExtension(const std::string& extension) {
+  GLint numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+  for (GLint i = 0; i < numExtensions; i++) {
+    const GLubyte* str = glGetStringi(GL_EXTENSIONS, i);
+    if (str && extension == (const char*)str)
+      return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,177 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Introsort reproducing the exact output order of libstdc++'s std::sort, including how equal
+// elements end up ordered, on every platform and compiler. Independent partitions are sorted
+// in parallel with OpenMP tasks, which does not change the result.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// OpenMP tasks need OpenMP 3.0, older implementations (e.g. MSVC) sort serially
+#if defined(_OPENMP) && _OPENMP >= 200805
+  #define INTROSORT_TASKS 1
+#else
+  #define INTROSORT_TASKS 0
+#endif
+
+namespace introsort_detail {
+
+// ranges up to this size are left for the final insertion sort
+constexpr ptrdiff_t THRESHOLD = 16;
+
+// ranges below this size are not worth spawning a task for
+constexpr ptrdiff_t TASK_THRESHOLD = 1 << 15;
+
+inline int Log2(uint64_t n) {
+  int lg = 0;
+  while (n >>= 1)
+    lg++;
+  return lg;
+}
+
+template <typename T, typename Compare>
+void PushHeap(T* first, ptrdiff_t holeIndex, ptrdiff_t topIndex, T value, Compare& comp) {
+  ptrdiff_t parent = (holeIndex - 1) / 2;
+  while (holeIndex > topIndex && comp(first[parent], value)) {
+    first[holeIndex] = std::move(first[parent]);
+    holeIndex = parent;
+    parent = (holeIndex - 1) / 2;
+  }
+  first[holeIndex] = std::move(value);
+}
+
+template <typename T, typename Compare>
+void AdjustHeap(T* first, ptrdiff_t holeIndex, ptrdiff_t len, T value, Compare& comp) {
+  const ptrdiff_t topIndex = holeIndex;
+  ptrdiff_t secondChild = holeIndex;
+  while (secondChild < (len - 1) / 2) {
+    secondChild = 2 * (secondChild + 1);
+    if (comp(first[secondChild], first[secondChild - 1]))
+      secondChild--;
+    first[holeIndex] = std::move(first[secondChild]);
+    holeIndex = secondChild;
+  }
+  if ((len & 1) == 0 && secondChild == (len - 2) / 2) {
+    secondChild = 2 * (secondChild + 1);
+    first[holeIndex] = std::move(first[secondChild - 1]);
+    holeIndex = secondChild - 1;
+  }
+  PushHeap(first, holeIndex, topIndex, std::move(value), comp);
+}
+
+// equivalent of std::partial_sort(first, last, last)
+template <typename T, typename Compare>
+void HeapSort(T* first, T* last, Compare& comp) {
+  const ptrdiff_t len = last - first;
+  if (len < 2)
+    return;
+
+  for (ptrdiff_t parent = (len - 2) / 2;; parent--) {
+    T value = std::move(first[parent]);
+    AdjustHeap(first, parent, len, std::move(value), comp);
+    if (parent == 0)
+      break;
+  }
+
+  while (last - first > 1) {
+    --last;
+    T value = std::move(*last);
+    *last = std::move(*first);
+    AdjustHeap(first, ptrdiff_t(0), last - first, std::move(value), comp);
+  }
+}
+
+// Partitions cannot move elements past each other, so insertion sorting each leaf range on its
+// own gives the same result as libstdc++'s final insertion sort over the whole array.
+template <typename T, typename Compare>
+void InsertionSort(T* first, T* last, Compare& comp) {
+  if (first == last)
+    return;
+
+  for (T* i = first + 1; i != last; ++i) {
+    T value = std::move(*i);
+    T* hole = i;
+    while (hole != first && comp(value, *(hole - 1))) {
+      *hole = std::move(*(hole - 1));
+      --hole;
+    }
+    *hole = std::move(value);
+  }
+}
+
+template <typename T, typename Compare>
+void MoveMedianToFirst(T* result, T* a, T* b, T* c, Compare& comp) {
+  if (comp(*a, *b)) {
+    if (comp(*b, *c))
+      std::swap(*result, *b);
+    else if (comp(*a, *c))
+      std::swap(*result, *c);
+    else
+      std::swap(*result, *a);
+  } else if (comp(*a, *c))
+    std::swap(*result, *a);
+  else if (comp(*b, *c))
+    std::swap(*result, *c);
+  else
+    std::swap(*result, *b);
+}
+
+template <typename T, typename Compare>
+T* UnguardedPartition(T* first, T* last, T* pivot, Compare& comp) {
+  while (true) {
+    while (comp(*first, *pivot))
+      ++first;
+    --last;
+    while (comp(*pivot, *last))
+      --last;
+    if (!(first < last))
+      return first;
+    std::swap(*first, *last);
+    ++first;
+  }
+}
+
+template <typename T, typename Compare>
+void IntroSortLoop(T* first, T* last, int depthLimit, Compare& comp) {
+  while (last - first > THRESHOLD) {
+    if (depthLimit == 0) {
+      HeapSort(first, last, comp);
+      return;
+    }
+    --depthLimit;
+
+    T* mid = first + (last - first) / 2;
+    MoveMedianToFirst(first, first + 1, mid, last - 1, comp);
+    T* cut = UnguardedPartition(first + 1, last, first, comp);
+
+    if (last - cut > TASK_THRESHOLD) {
+#if INTROSORT_TASKS
+#pragma omp task firstprivate(cut, last, depthLimit) shared(comp)
+#endif
+      IntroSortLoop(cut, last, depthLimit, comp);
+    } else {
+      IntroSortLoop(cut, last, depthLimit, comp);
+    }
+    last = cut;
+  }
+
+  InsertionSort(first, last, comp);
+}
+
+} // namespace introsort_detail
+
+// Sorts [first, last) into exactly the order std::sort from libstdc++ would produce
+template <typename T, typename Compare>
+void IntroSort(T* first, T* last, Compare comp) {
+  if (last - first < 2)
+    return;
+
+  const int depthLimit = introsort_detail::Log2(last - first) * 2;
+
+#if INTROSORT_TASKS
+#pragma omp parallel if (last - first > introsort_detail::TASK_THRESHOLD)
+#pragma omp single
+#endif
+  introsort_detail::IntroSortLoop(first, last, depthLimit, comp);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// All sub-meshes packed into shared GPU buffers, so a whole pass can be drawn with one call
+#pragma once
+
+#include <pangolin/gl/gl.h>
+
+#include <cstdint>
+
+class MeshBuffers {
+ public:
+  // Where a sub-mesh lives in the shared buffers, in elements of each buffer
+  struct Range {
+    GLint baseVertex = 0;
+    size_t numVertices = 0;
+    size_t firstIndex = 0;
+    size_t numIndices = 0;
+    size_t firstAdjacency = 0;
+    size_t numAdjacency = 0;
+  };
+
+  MeshBuffers() {}
+  MeshBuffers(const MeshBuffers&) = delete;
+  MeshBuffers& operator=(const MeshBuffers&) = delete;
+
+  // Appends a sub-mesh, growing the buffers as needed. All sub-meshes must share one vertex
+  // format. Indices are widened to 32 bits for every sub-mesh once one of them needs it.
+  Range Append(
+      const void* vertices,
+      const size_t numVertices,
+      const GLenum vertexType,
+      const GLint vertexComponents,
+      const void* indices,
+      const size_t numIndices,
+      const GLenum indexType,
+      const uint32_t* adjacency,
+      const size_t numAdjacency);
+
+  // Trims the slack left by growing, once every sub-mesh is appended
+  void Finish();
+
+  const pangolin::GlBufferData& Vertices() const {
+    return vertices.buffer;
+  }
+
+  const pangolin::GlBufferData& Indices() const {
+    return indices.buffer;
+  }
+
+  const pangolin::GlBufferData& Adjacency() const {
+    return adjacency.buffer;
+  }
+
+  GLenum VertexType() const {
+    return vertexType;
+  }
+
+  GLint VertexComponents() const {
+    return vertexComponents;
+  }
+
+  GLenum IndexType() const {
+    return indexType;
+  }
+
+  size_t IndexSize() const {
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+  }
+
+  size_t NumBytes() const {
+    return vertices.size + indices.size + adjacency.size;
+  }
+
+ private:
+  // Buffer filled from the front, with room to grow
+  struct Pool {
+    pangolin::GlBufferData buffer;
+    size_t size = 0;
+  };
+
+  static void Append(
+      Pool& pool,
+      const pangolin::GlBufferType type,
+      const void* data,
+      const size_t numBytes);
+  static void Resize(Pool& pool, const pangolin::GlBufferType type, const size_t capacity);
+
+  void WidenIndices();
+
+  Pool vertices;
+  Pool indices;
+  Pool adjacency;
+
+  GLenum vertexType = 0;
+  GLint vertexComponents = 0;
+  size_t vertexSize = 0;
+  GLenum indexType = GL_UNSIGNED_SHORT;
+};
@@ -0,0 +1,99 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Versioned on-disk cache of split, GPU-ready sub-meshes and their adjacency
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "FileMemMap.h"
+
+class MeshCache {
+  // sub-mesh table entry in the cache file
+  struct Entry;
+
+ public:
+  static constexpr uint32_t VERSION = 3;
+
+  // Read-only view of one cached sub-mesh, pointing into the mapped cache file
+  struct SubMesh {
+    const float* vbo; // 3 floats per vertex
+    size_t numVertices;
+    const uint32_t* ibo; // 4 indices per quad
+    size_t numIndices;
+    const uint32_t* abo; // packed adjacent face and rotation per quad edge
+    size_t numAdjacency;
+    const uint8_t* faceOrder; // per quad drawn, its atlas face within its meshlet, if reordered
+    size_t numFaceOrder;
+  };
+
+  // Identifies the mesh file and split parameters the cache was built from
+  struct Key {
+    uint64_t meshSize = 0;
+    int64_t meshTime = 0;
+    uint64_t meshHash = 0;
+    float splitSize = 0.0f;
+    bool vertexCacheOrder = false; // faces reordered within their meshlets
+  };
+
+  class Writer {
+   public:
+    Writer(const std::string& cacheFile, const Key& key);
+    ~Writer();
+
+    bool IsOpen() const;
+
+    void Append(
+        const float* vbo,
+        size_t numVertices,
+        const uint32_t* ibo,
+        size_t numIndices,
+        const uint32_t* abo,
+        size_t numAdjacency,
+        const uint8_t* faceOrder,
+        size_t numFaceOrder);
+
+    // Writes the sub-mesh table and atomically moves the file into place
+    bool Finish();
+
+   private:
+    void WriteAligned(const void* data, size_t numBytes, uint64_t& offset);
+
+    const std::string cacheFile;
+    const std::string tmpFile;
+    const Key key;
+    std::ofstream file;
+    std::vector<Entry> entries;
+    bool finished = false;
+  };
+
+  MeshCache() {}
+  ~MeshCache();
+  MeshCache(const MeshCache&) = delete;
+  MeshCache& operator=(const MeshCache&) = delete;
+
+  // Cache file used for meshFile inside cacheDir
+  static std::string CachePath(const std::string& cacheDir, const std::string& meshFile);
+
+  // Cheap fingerprint of the mesh file: size, modification time and a hash of the
+  // PLY header plus sampled blocks of the body
+  static Key MakeKey(const std::string& meshFile, const float splitSize);
+
+  // Maps the cache, returns false if it is missing, from another version or stale
+  bool Open(const std::string& cacheFile, const Key& key);
+  void Close();
+
+  size_t NumSubMeshes() const {
+    return subMeshes.size();
+  }
+
+  const SubMesh& GetSubMesh(size_t i) const {
+    return subMeshes[i];
+  }
+
+ private:
+  FileMemMap fileMap;
+  const char* data = nullptr;
+  std::vector<SubMesh> subMeshes;
+};
@@ -1,43 +1,204 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #pragma once
 
-#include <pangolin/image/managed_image.h>
 #include <Eigen/Core>
 
-struct MeshData {
-  MeshData(size_t polygonStride = 3) : polygonStride(polygonStride) {}
+#include <cstdint>
+#include <memory>
+#include <vector>
 
-  MeshData(const MeshData& other) {
-    if (other.vbo.IsValid())
-      vbo.CopyFrom(other.vbo);
+#include "Assert.h"
+#include "Span.h"
 
-    if (other.ibo.IsValid())
-      ibo.CopyFrom(other.ibo);
+// Vertex attributes a mesh can hold besides its positions
+enum MeshAttributes : unsigned {
+  MESH_POSITIONS = 0,
+  MESH_NORMALS = 1 << 0,
+  MESH_COLORS = 1 << 1,
+};
 
-    if (other.nbo.IsValid())
-      nbo.CopyFrom(other.nbo);
+using MeshColor = Eigen::Matrix<uint8_t, 4, 1>;
 
-    if (other.cbo.IsValid())
-      cbo.CopyFrom(other.cbo);
+// Read-only view of a mesh or one of its sub-meshes. Attributes the mesh does not hold are empty.
+struct MeshView {
+  size_t NumVertices() const {
+    return positions.size();
+  }
 
-    polygonStride = other.polygonStride;
+  size_t NumIndices() const {
+    return indices.size();
   }
 
+  Span<const Eigen::Vector3f> positions;
+  Span<const Eigen::Vector3f> normals;
+  Span<const MeshColor> colors;
+  Span<const uint32_t> indices;
+  size_t polygonStride = 3;
+};
+
+// Mesh stored as one tightly packed array per attribute, all carved from a single allocation.
+// Attributes that were not asked for take no space. Several sub-meshes can be stored back to
+// back, each spanning its own range of vertices and indices, with indices relative to the first
+// vertex of their sub-mesh.
+class MeshData {
+ public:
+  struct Range {
+    size_t vertexOffset = 0;
+    size_t numVertices = 0;
+    size_t indexOffset = 0;
+    size_t numIndices = 0;
+  };
+
+  explicit MeshData(size_t polygonStride = 3) : polygonStride(polygonStride) {}
+
   MeshData(MeshData&& other) {
     *this = std::move(other);
   }
 
-  void operator=(MeshData&& other) {
-    vbo = (std::move(other.vbo));
-    ibo = (std::move(other.ibo));
-    nbo = (std::move(other.nbo));
-    cbo = (std::move(other.cbo));
+  MeshData& operator=(MeshData&& other) {
+    arena = std::move(other.arena);
+    positions = other.positions;
+    normals = other.normals;
+    colors = other.colors;
+    indices = other.indices;
     polygonStride = other.polygonStride;
+    ranges = std::move(other.ranges);
+
+    other.positions = {};
+    other.normals = {};
+    other.colors = {};
+    other.indices = {};
+    other.ranges.clear();
+    return *this;
+  }
+
+  // Meshes are large, copies have to be made explicitly
+  MeshData(const MeshData&) = delete;
+  MeshData& operator=(const MeshData&) = delete;
+
+  // Allocates arrays for up to maxVertices vertices, with the given attributes, and numIndices
+  // indices, dropping the previous contents. Nothing is initialised, so on systems that commit
+  // memory on first use vertices beyond those kept by SetNumVertices cost address space only.
+  // A single sub-mesh covers the whole mesh.
+  void Reinitialise(
+      const size_t maxVertices,
+      const size_t numIndices,
+      const unsigned attributes,
+      const size_t polygonStride) {
+    const size_t positionBytes = AlignUp(maxVertices * sizeof(Eigen::Vector3f));
+    const size_t normalBytes =
+        attributes & MESH_NORMALS ? AlignUp(maxVertices * sizeof(Eigen::Vector3f)) : 0;
+    const size_t colorBytes =
+        attributes & MESH_COLORS ? AlignUp(maxVertices * sizeof(MeshColor)) : 0;
+    const size_t indexBytes = AlignUp(numIndices * sizeof(uint32_t));
+
+    arena.reset(new uint8_t[positionBytes + normalBytes + colorBytes + indexBytes + ALIGNMENT]);
+
+    uint8_t* ptr = arena.get() + (ALIGNMENT - (uintptr_t)arena.get() % ALIGNMENT) % ALIGNMENT;
+
+    positions = Span<Eigen::Vector3f>((Eigen::Vector3f*)ptr, maxVertices);
+    ptr += positionBytes;
+
+    normals = normalBytes ? Span<Eigen::Vector3f>((Eigen::Vector3f*)ptr, maxVertices)
+                          : Span<Eigen::Vector3f>();
+    ptr += normalBytes;
+
+    colors = colorBytes ? Span<MeshColor>((MeshColor*)ptr, maxVertices) : Span<MeshColor>();
+    ptr += colorBytes;
+
+    indices = Span<uint32_t>((uint32_t*)ptr, numIndices);
+
+    this->polygonStride = polygonStride;
+
+    ranges.assign(1, Range());
+    ranges[0].numVertices = maxVertices;
+    ranges[0].numIndices = numIndices;
+  }
+
+  // Keeps the first numVertices vertices, without reallocating. Sub-mesh ranges are left as they
+  // are.
+  void SetNumVertices(const size_t numVertices) {
+    ASSERT(numVertices <= positions.size());
+
+    positions = positions.Subspan(0, numVertices);
+    if (!normals.empty())
+      normals = normals.Subspan(0, numVertices);
+    if (!colors.empty())
+      colors = colors.Subspan(0, numVertices);
+  }
+
+  size_t NumVertices() const {
+    return positions.size();
   }
 
-  pangolin::ManagedImage<Eigen::Vector4f> vbo;
-  pangolin::ManagedImage<uint32_t> ibo;
-  pangolin::ManagedImage<Eigen::Vector4f> nbo;
-  pangolin::ManagedImage<Eigen::Matrix<unsigned char, 4, 1>> cbo;
+  size_t NumIndices() const {
+    return indices.size();
+  }
+
+  size_t PolygonStride() const {
+    return polygonStride;
+  }
+
+  Span<Eigen::Vector3f> Positions() {
+    return positions;
+  }
+
+  Span<Eigen::Vector3f> Normals() {
+    return normals;
+  }
+
+  Span<MeshColor> Colors() {
+    return colors;
+  }
+
+  Span<uint32_t> Indices() {
+    return indices;
+  }
+
+  MeshView View() const {
+    MeshView view;
+    view.positions = positions;
+    view.normals = normals;
+    view.colors = colors;
+    view.indices = indices;
+    view.polygonStride = polygonStride;
+    return view;
+  }
+
+  size_t NumSubMeshes() const {
+    return ranges.size();
+  }
+
+  MeshView SubMesh(size_t i) const {
+    const Range& range = ranges[i];
+
+    MeshView view;
+    view.positions = positions.Subspan(range.vertexOffset, range.numVertices);
+    if (!normals.empty())
+      view.normals = normals.Subspan(range.vertexOffset, range.numVertices);
+    if (!colors.empty())
+      view.colors = colors.Subspan(range.vertexOffset, range.numVertices);
+    view.indices = indices.Subspan(range.indexOffset, range.numIndices);
+    view.polygonStride = polygonStride;
+    return view;
+  }
+
+  // sub-mesh layout, a single range over everything after Reinitialise
+  std::vector<Range> ranges;
+
+ private:
+  // arrays start on their own cache line
+  static constexpr size_t ALIGNMENT = 64;
+
+  static size_t AlignUp(size_t numBytes) {
+    return (numBytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  std::unique_ptr<uint8_t[]> arena;
+
+  Span<Eigen::Vector3f> positions;
+  Span<Eigen::Vector3f> normals;
+  Span<MeshColor> colors;
+  Span<uint32_t> indices;
   size_t polygonStride;
 };
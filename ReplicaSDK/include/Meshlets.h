@@ -0,0 +1,74 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Small runs of consecutive quads with bounds and a normal cone, so whole runs can be skipped when
+// they are out of view or face the side the rasterizer culls
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+#include "Span.h"
+
+struct Meshlet {
+  // bounding sphere
+  Eigen::Vector3f center;
+  float radius;
+
+  // every triangle's normal, right handed in index order, is within the cone around coneAxis.
+  // coneCutoff is the sine of its half angle, 1 when it is too wide to ever cull.
+  Eigen::Vector3f coneAxis;
+  float coneCutoff;
+
+  // faces of the sub-mesh it covers
+  uint32_t firstFace;
+  uint32_t numFaces;
+};
+
+// Splits the quads of a sub-mesh into meshlets of up to maxFaces consecutive faces, appending them
+// to meshlets. Faces stay in order, as their atlas tiles are indexed by face, or only move within
+// the runs of maxFaces a meshlet covers. padding grows the spheres, e.g. by the error of compacted
+// positions.
+void BuildMeshlets(
+    const Span<const Eigen::Vector3f>& positions,
+    const Span<const uint32_t>& indices,
+    const size_t maxFaces,
+    const float padding,
+    std::vector<Meshlet>& meshlets);
+
+// Conservative visibility test of meshlets seen from a perspective eye
+class MeshletCuller {
+ public:
+  // cullFacingEye and cullFacingAway tell which way the triangles the rasterizer culls point
+  MeshletCuller(
+      const Frustum& frustum,
+      const Eigen::Vector3f& eye,
+      const bool cullFacingEye,
+      const bool cullFacingAway)
+      : frustum(frustum), eye(eye), cullFacingEye(cullFacingEye), cullFacingAway(cullFacingAway) {}
+
+  bool IsVisible(const Meshlet& meshlet) const {
+    if (!frustum.Intersects(meshlet.center, meshlet.radius))
+      return false;
+
+    // all triangles face away from any eye position within the cone on the far side
+    const Eigen::Vector3f view = meshlet.center - eye;
+    const float limit = meshlet.coneCutoff * view.norm() + meshlet.radius;
+    const float along = view.dot(meshlet.coneAxis);
+
+    if (cullFacingAway && along >= limit)
+      return false;
+
+    if (cullFacingEye && -along >= limit)
+      return false;
+
+    return true;
+  }
+
+ private:
+  Frustum frustum;
+  Eigen::Vector3f eye;
+  bool cullFacingEye;
+  bool cullFacingAway;
+};
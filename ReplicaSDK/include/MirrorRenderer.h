@@ -5,6 +5,7 @@
 #include <pangolin/gl/glsl.h>
 #include <Eigen/Core>
 #include "MirrorSurface.h"
+#include "ShaderProgramCache.h"
 
 class MirrorRenderer {
  public:
@@ -12,7 +13,8 @@ class MirrorRenderer {
       const std::vector<MirrorSurface>& mirrors,
       const int width,
       const int height,
-      const std::string shadir)
+      const std::string shadir,
+      const std::string& shaderCacheDir = ShaderProgramCache::DefaultDir())
       : surfaceOffset(0.0025f) {
     // create render target
     colorTex.Reinitialise(width, height, GL_RGBA8, true, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
@@ -28,9 +30,13 @@ class MirrorRenderer {
 
     // load shader
     ASSERT(pangolin::FileExists(shadir), "Shader directory not found!");
-    shader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mirror.vert", {}, {shadir});
-    shader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mirror.frag", {}, {shadir});
-    shader.Link();
+    ShaderProgramCache programCache(shaderCacheDir);
+    programCache.Add(
+        shader,
+        {{pangolin::GlSlVertexShader, shadir + "/mirror.vert"},
+         {pangolin::GlSlFragmentShader, shadir + "/mirror.frag"}},
+        {shadir});
+    programCache.Build();
 
     // create masks
     maskTextures.resize(mirrors.size());
@@ -209,7 +215,7 @@ class MirrorRenderer {
 
   const float surfaceOffset;
 
-  pangolin::GlSlProgram shader;
+  ShaderProgramCache::Program shader;
 
   pangolin::GlFramebuffer frameBuffer;
   pangolin::GlTexture depthTex;
@@ -0,0 +1,71 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Two phase hierarchical-Z occlusion culling of sub-meshes, reusing the visibility of similar
+// earlier views. Sub-meshes seen last time are drawn first, the depth they leave is reduced into
+// a pyramid, and the rest are only drawn if their bounds are not entirely behind it.
+#pragma once
+
+#include <pangolin/gl/gl.h>
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <vector>
+
+#include "DepthPyramid.h"
+#include "ShaderProgramCache.h"
+
+class OcclusionCuller {
+ public:
+  explicit OcclusionCuller(const std::vector<Eigen::AlignedBox3f>& boxes);
+  OcclusionCuller(const OcclusionCuller&) = delete;
+  OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+  // Queues the culling programs, must be built before the first pass
+  void AddPrograms(ShaderProgramCache& programCache, const std::string& shaderDir);
+
+  // Whether the current depth state lets depth drawn earlier hide later sub-meshes
+  static bool CanCull();
+
+  // Starts a pass drawing candidates from mvp. Returns those visible the last time a view close
+  // to mvp was culled, to be drawn first.
+  std::vector<size_t> Begin(const pangolin::OpenGlMatrix& mvp, const std::vector<size_t>& candidates);
+
+  // Ends the pass once the sub-meshes Begin returned are drawn into the bound framebuffer.
+  // Returns the remaining candidates that may still be visible, all of them if the depth buffer
+  // cannot be read.
+  std::vector<size_t> End();
+
+ private:
+  // Visibility left by an earlier view
+  struct View {
+    Eigen::Matrix4d mvp;
+    std::vector<uint8_t> visible;
+    uint64_t lastUsed = 0;
+  };
+
+  // views kept for the cubemap faces, mirror reflections and the like
+  static constexpr size_t MAX_VIEWS = 32;
+
+  // views further apart than this, comparing matrices, start out without visibility
+  static constexpr double MAX_VIEW_DISTANCE = 1.0;
+
+  View& FindView(const Eigen::Matrix4d& mvp);
+
+  size_t numSubMeshes;
+
+  ShaderProgramCache::Program reduceProgram;
+  ShaderProgramCache::Program cullProgram;
+  DepthPyramid depthPyramid;
+
+  pangolin::GlBufferData bounds;
+  pangolin::GlBufferData candidateBuffer;
+  pangolin::GlBufferData visibilityBuffer;
+
+  std::vector<View> views;
+  uint64_t tick = 0;
+
+  // pass in progress
+  View* view = nullptr;
+  Eigen::Matrix4d mvp;
+  std::vector<size_t> candidates;
+  std::vector<uint8_t> drawnFirst;
+};
@@ -1,8 +1,94 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #pragma once
 
+#include "FileMemMap.h"
 #include "MeshData.h"
+#include "StridedView.h"
 
+#include <cstdint>
 #include <string>
 
-void PLYParse(MeshData& meshData, const std::string& filename);
+// Memory mapped binary PLY file. The header is parsed on construction and the vertex and face
+// blocks are exposed in place, without copying.
+class PLYFile {
+ public:
+  // Bytes of a streamed file read before dropping their pages
+  static constexpr size_t STREAM_BLOCK_BYTES = 64 * 1024 * 1024;
+
+  // A streamed file is paged in as it is read, front to back, rather than all at once, so that
+  // DropPages can bound how much of it is resident
+  explicit PLYFile(const std::string& filename, const bool streamed = false);
+  ~PLYFile();
+  PLYFile(const PLYFile&) = delete;
+  PLYFile& operator=(const PLYFile&) = delete;
+
+  size_t NumVertices() const {
+    return numVertices;
+  }
+
+  size_t NumFaces() const {
+    return numFaces;
+  }
+
+  // Number of indices per face, 0 if the file holds no faces
+  size_t PolygonStride() const {
+    return polygonStride;
+  }
+
+  size_t PositionDimensions() const {
+    return positionDimensions;
+  }
+
+  size_t NormalDimensions() const {
+    return normalDimensions;
+  }
+
+  size_t ColorDimensions() const {
+    return colorDimensions;
+  }
+
+  // Vertex components, one packet per vertex
+  StridedView<float> Positions() const;
+  StridedView<float> Normals() const;
+  StridedView<uint8_t> Colors() const;
+
+  // Face indices, one packet of PolygonStride() indices per face. The on-disk count byte is
+  // skipped, all faces were checked to have the same count.
+  StridedView<uint32_t> Faces() const;
+
+  // Releases the pages of the file read so far, or of [begin, end) within it. The views stay
+  // valid and read them again.
+  void DropPages();
+  void DropPages(const void* begin, const void* end);
+
+ private:
+  FileMemMap fileMap;
+  const char* vertexBytes = nullptr;
+  const char* faceBytes = nullptr;
+
+  size_t numVertices = 0;
+  size_t numFaces = 0;
+  size_t polygonStride = 0;
+
+  size_t positionDimensions = 0;
+  size_t normalDimensions = 0;
+  size_t colorDimensions = 0;
+
+  size_t positionOffsetBytes = 0;
+  size_t normalOffsetBytes = 0;
+  size_t colorOffsetBytes = 0;
+  size_t vertexPacketSizeBytes = 0;
+};
+
+// Unpacks the vertex positions, and optionally the faces, of a PLY file into meshData. Normals
+// and colours are only unpacked when requested through attributes and present in the file.
+void PLYParse(
+    MeshData& meshData,
+    const PLYFile& file,
+    const bool parseFaces = true,
+    const unsigned attributes = MESH_POSITIONS);
+
+void PLYParse(
+    MeshData& meshData,
+    const std::string& filename,
+    const unsigned attributes = MESH_POSITIONS);
@@ -3,18 +3,193 @@
 #include <pangolin/display/opengl_render_state.h>
 #include <pangolin/gl/gl.h>
 #include <pangolin/gl/glsl.h>
+#include <Eigen/Geometry>
 #include <memory>
 #include <string>
 
 #include "Assert.h"
+#include "AtlasCompression.h"
+#include "AtlasMipmaps.h"
+#include "AtlasPadding.h"
+#include "AtlasResidency.h"
+#include "BoundsTree.h"
+#include "MeshCache.h"
+#include "MeshBuffers.h"
 #include "MeshData.h"
+#include "Meshlets.h"
+#include "OcclusionCuller.h"
+#include "PLYParser.h"
+#include "ShaderPermutations.h"
+#include "ShaderProgramCache.h"
+#include "StridedView.h"
+#include "VertexCache.h"
 
 #define XSTR(x) #x
 #define STR(x) XSTR(x)
 
+struct PTexMeshOptions {
+  // Keep a pre-processed copy of the split mesh and its adjacency on disk
+  bool meshCacheEnable = true;
+
+  // Folder holding the mesh cache, the atlas folder if empty
+  std::string meshCacheDir;
+
+  // Number of atlases read from disk ahead of the one being uploaded
+  int atlasQueueDepth = 4;
+
+  // GPU memory the atlases may use, 0 uploads them all up front and keeps them resident.
+  // Otherwise atlases are uploaded when first drawn or prefetched and evicted least recently
+  // used first.
+  size_t atlasBudgetBytes = 0;
+
+  // Whether drawing a sub-mesh waits for its atlas to arrive or uses a placeholder meanwhile
+  bool atlasWaitForUpload = true;
+
+  // Draw from copies of the atlases whose tiles carry a border of texels from the adjacent faces,
+  // built once and kept with the mesh cache, so shading filters in hardware instead of walking
+  // the adjacency. Needs uncompressed atlases, and the border grows them by (tileSize + 2)^2 /
+  // tileSize^2.
+  bool paddedTilesEnable = false;
+
+  // Bake tile-aware mip levels of uncompressed atlases once, kept with the mesh cache, and sample
+  // the level nearest to each pixel's footprint. Takes precedence over padded tiles.
+  bool atlasMipmapsEnable = false;
+
+  // With mipmaps, load only the levels an output atlasTargetWidth pixels across a field of view of
+  // atlasTargetFov radians needs to show faces atlasNearDistance metres away at full detail.
+  // Finer levels are neither read nor uploaded. 0 loads every level.
+  int atlasTargetWidth = 0;
+  float atlasTargetFov = 0.0f;
+  float atlasNearDistance = 0.5f;
+
+  // Transcode uncompressed atlases, after mipmapping them, to block compressed copies once, kept
+  // with the mesh cache: BC7 for RGB atlases and BC6H for HDR ones. They upload as is and take 4
+  // times less GPU memory than RGBA8 and 8 times less than RGBA16F, at some loss of quality.
+  // 4x4 blocks must not straddle tiles, so padded atlases stay uncompressed and mip levels with
+  // tiles under 4 texels are dropped.
+  bool atlasCompressionEnable = false;
+
+  // Compress RGB atlases to BC1 instead of BC7, half the size again at lower quality
+  bool atlasCompressionBc1 = false;
+
+  // Host memory building the split sub-meshes may use, 0 builds them all at once. Sorting the
+  // faces into sub-meshes still takes up to 12 bytes per face and 4 per vertex, as the atlases
+  // depend on one global face order.
+  size_t meshMemoryBudgetBytes = 0;
+
+  // Store sub-mesh positions as 16 bits per component within the sub-mesh bounds, and indices and
+  // adjacency in 16 bits where the sub-mesh is small enough. Roughly halves the GPU memory and
+  // vertex fetch bandwidth of the mesh.
+  bool compactMeshes = false;
+
+  // Draw all visible sub-meshes of a pass with one indirect multi-draw instead of one draw each.
+  // Textured passes need GL_ARB_bindless_texture and all atlases resident (no atlas budget) for
+  // this, otherwise they bind each sub-mesh's atlas and draw it on its own.
+  bool multiDrawEnable = true;
+
+  // Skip sub-meshes hidden behind the depth drawn by the ones visible from the most similar
+  // earlier view, in the passes that cull. Lossless, but reads results back once per pass.
+  bool occlusionCullingEnable = false;
+
+  // Skip runs of faces within the visible sub-meshes that are outside the view or all face the
+  // side culled by GL_CULL_FACE, in the passes that cull. Lossless.
+  bool meshletCullingEnable = true;
+
+  // Draw the perspective RGB, depth and motion vector passes as 6 vertices per quad, fetching
+  // positions in the vertex shader, instead of through geometry shaders and GL_QUADS. Same
+  // output, usually faster. The panoramic passes keep their geometry shaders, which split quads
+  // crossing the seam.
+  bool vertexPullingEnable = false;
+
+  // Reorder the quads within each meshlet and the vertices of each sub-mesh when it is built, so
+  // the post-transform vertex cache reuses more vertices and vertex fetches go front to back. The
+  // atlas tiles keep their order, textured passes look up each face's tile in a byte per face.
+  // Kept in the mesh cache. Only indexed draws, not pulled vertices, benefit.
+  bool vertexCacheOrderEnable = false;
+
+  // Draw the depth of the textured Render and RenderPano passes first, through the same vertex
+  // stages, then shade only the fragments left nearest with an equal depth test. Each pixel runs
+  // the atlas lookup once instead of once per surface drawn over it, for transforming the geometry
+  // twice.
+  bool depthPrepassEnable = false;
+
+  // Draw the visible sub-meshes of each pass nearest first, so the depth test rejects more of the
+  // fragments hidden behind them before they are shaded
+  bool frontToBackEnable = true;
+
+  // Count the samples of the textured passes (Render, RenderPano, RenderCube and the combined
+  // ones) that pass the depth test, see GetOverdrawStats. Waits for each pass to finish on the GPU.
+  bool overdrawStatsEnable = false;
+
+  // Time the draws of every pass on the GPU with a GL_TIME_ELAPSED query, see GetGpuTimeStats.
+  // Waits for each batch of draws to finish on the GPU, so leave it off when timing frames.
+  bool gpuTimeStatsEnable = false;
+
+  // Panoramic motion vectors of points crossing the panorama's seam wrap around it, instead of
+  // ignoring the projection and going the long way across the image
+  bool panoFlowWrapAround = false;
+
+  // Build the programs of the RenderCube passes, which draw all six faces of a cubemap at once
+  bool layeredCubemapEnable = false;
+
+  // Build the programs of the RenderCombined passes, which write RGB, depth and motion vectors
+  // from one rasterization of the scene. Also RenderCubeCombined, with layeredCubemapEnable.
+  bool combinedPassEnable = false;
+
+  // Let the perspective motion vector passes also write the motion back to the previous frame,
+  // from the same rasterization, see RenderMotionVectors
+  bool bidirectionalFlowEnable = false;
+
+  // Keep linked shader program binaries on disk, they are specific to the GPU and driver
+  bool shaderCacheEnable = true;
+  std::string shaderCacheDir = ShaderProgramCache::DefaultDir();
+};
+
 class PTexMesh {
  public:
-  PTexMesh(const std::string& meshFile, const std::string& atlasFolder, const bool panoramic_enable=false);
+  // Sub-meshes drawn and culled by the Render, RenderDepth and RenderMotionVector passes
+  struct CullStats {
+    size_t passes = 0;
+    size_t drawn = 0;
+    size_t culled = 0; // outside the view, or behind the clip plane
+    size_t occluded = 0; // hidden behind other sub-meshes
+    size_t boxesTested = 0; // bounding volume hierarchy nodes tested
+    size_t meshletsDrawn = 0; // of the sub-meshes drawn
+    size_t meshletsCulled = 0; // outside the view, or facing the culled side
+  };
+
+  // Samples of the textured passes passing the depth test when drawn, counted with
+  // overdrawStatsEnable. A lower bound of the fragments shaded: those failing the depth test are
+  // still shaded unless early fragment tests reject them, as after the depth prepass.
+  struct OverdrawStats {
+    size_t passes = 0;
+    size_t pixels = 0; // of the viewports drawn to
+    size_t samplesPassed = 0; // including those drawn over later
+  };
+
+  // GPU time of drawing the sub-meshes, measured with gpuTimeStatsEnable. Excludes culling them, so
+  // the difference vertexPullingEnable makes shows without the CPU's share of the frame.
+  struct GpuTimeStats {
+    size_t batches = 0; // the prepass, and each draw either side of the occlusion test, are one
+    size_t nanoseconds = 0;
+  };
+
+  // Faces of the cubemaps the RenderCube passes draw
+  static constexpr int CUBE_FACES = 6;
+
+  // Colour attachments the RenderCombined passes write, matches mesh-ptex.frag
+  enum CombinedOutput : int {
+    COMBINED_RGB = 0, // as Render
+    COMBINED_DEPTH = 1, // as RenderDepth
+    COMBINED_MOTION_VECTOR = 2, // as RenderMotionVector
+    COMBINED_MOTION_VECTOR_BACKWARD = 3, // to the previous frame, as RenderMotionVectors
+  };
+
+  PTexMesh(
+      const std::string& meshFile,
+      const std::string& atlasFolder,
+      const bool panoramic_enable = false,
+      const PTexMeshOptions& options = PTexMeshOptions());
 
   virtual ~PTexMesh();
 
@@ -89,6 +264,65 @@ class PTexMesh {
     const int image_height,
       const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f));
 
+  // Draw the faces of a cubemap in one pass, face i seen through cams[i] into layer i of the bound
+  // framebuffer's layered attachments, e.g. 2D array or cube map textures. All faces share the
+  // eye, each quad is only drawn into the faces it shows in. Needs layeredCubemapEnable. The
+  // sub-meshes are not occlusion culled.
+  void RenderCube(const std::vector<pangolin::OpenGlRenderState>& cams);
+
+  void RenderCubeDepth(
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const float depthScale = 1.0f);
+
+  void RenderCubeMotionVector(
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const std::vector<pangolin::OpenGlRenderState>& camsNext,
+      const int image_width,
+      const int image_height);
+
+  // RenderMotionVector from cam to cam_next into colour attachment 0 and, from the same view, to
+  // cam_prev into attachment 1. Along a trajectory these are the forward and backward motion
+  // vectors of the frame seen through cam, each view rasterized once for both. Needs
+  // bidirectionalFlowEnable.
+  void RenderMotionVectors(
+      const pangolin::OpenGlRenderState& cam_prev,
+      const pangolin::OpenGlRenderState& cam,
+      const pangolin::OpenGlRenderState& cam_next,
+      const int image_width,
+      const int image_height,
+      const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f));
+
+  // RenderMotionVectors into the layers of both attachments, as RenderCube
+  void RenderCubeMotionVectors(
+      const std::vector<pangolin::OpenGlRenderState>& camsPrev,
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const std::vector<pangolin::OpenGlRenderState>& camsNext,
+      const int image_width,
+      const int image_height);
+
+  // Render, RenderDepth and RenderMotionVector in one pass, into the colour attachments listed
+  // in CombinedOutput of the bound framebuffer. Outputs glDrawBuffers maps to GL_NONE are
+  // dropped. Needs combinedPassEnable. Given cam_prev, also writes the backward motion vectors
+  // of RenderMotionVectors, which needs bidirectionalFlowEnable.
+  void RenderCombined(
+      const pangolin::OpenGlRenderState& cam,
+      const pangolin::OpenGlRenderState& cam_next,
+      const int image_width,
+      const int image_height,
+      const float depthScale = 1.0f,
+      const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f),
+      const pangolin::OpenGlRenderState* cam_prev = nullptr);
+
+  // RenderCombined into the layers of each attachment, as RenderCube. Needs combinedPassEnable
+  // and layeredCubemapEnable.
+  void RenderCubeCombined(
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const std::vector<pangolin::OpenGlRenderState>& camsNext,
+      const int image_width,
+      const int image_height,
+      const float depthScale = 1.0f,
+      const std::vector<pangolin::OpenGlRenderState>* camsPrev = nullptr);
+
   float Exposure() const;
   void SetExposure(const float& val);
 
@@ -102,29 +336,348 @@ class PTexMesh {
     return meshes.size();
   }
 
+  // Streams in the atlases likely to be seen from the upcoming camera poses, nearest sub-meshes
+  // first. Only has an effect with an atlas budget, call once per frame.
+  void PrefetchAtlases(const std::vector<pangolin::OpenGlMatrix>& upcomingModelViews);
+
+  const AtlasResidency::Stats& GetAtlasStats() const {
+    return atlases->GetStats();
+  }
+
+  // Totals over all passes so far
+  const CullStats& GetCullStats() const {
+    return cullStats;
+  }
+
+  // The most recent culling pass alone
+  const CullStats& GetLastCullStats() const {
+    return lastCullStats;
+  }
+
+  // Totals over all passes so far, samples passed per pixel above 1 are overdraw
+  const OverdrawStats& GetOverdrawStats() const {
+    return overdrawStats;
+  }
+
+  // Totals over all passes so far
+  const GpuTimeStats& GetGpuTimeStats() const {
+    return gpuTimeStats;
+  }
+
  private:
   struct Mesh {
-    pangolin::GlTexture atlas;
-    pangolin::GlBuffer vbo;
-    pangolin::GlBuffer ibo;
-    pangolin::GlBuffer abo;
+    Eigen::AlignedBox3f bounds;
+    MeshBuffers::Range range;
+
+    // maps quantized positions back to world space
+    Eigen::Vector3f positionOffset = Eigen::Vector3f::Zero();
+    Eigen::Vector3f positionScale = Eigen::Vector3f::Ones();
+
+    // two 16-bit adjacency entries per int
+    bool compactAdjacency = false;
+
+    size_t firstMeshlet = 0;
+    size_t numMeshlets = 0;
+
+    // entry of the first face in faceOrders
+    size_t firstFace = 0;
+  };
+
+  // Per sub-mesh parameters, laid out like SubMesh in submesh.glsl (std430)
+  struct SubMeshData {
+    float positionOffset[4];
+    float positionScale[4];
+    int32_t widthInTiles;
+    uint32_t firstAdjacency;
+    uint32_t compactAdjacency;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t firstFace;
+    uint32_t padding[2];
+  };
+
+  // Constants shared by all draws of a pass, laid out like Frame in frame.glsl (std140)
+  struct FrameUniforms {
+    float MV[16];
+    float MVP[16];
+    float MVNext[16];
+    float MVPNext[16];
+    float MVPPrev[16];
+    float clipPlane[4];
+    float windowSize[2];
+    float exposure;
+    float gamma;
+    float saturation;
+    float depthScale;
+    int32_t tileSize;
+    int32_t padding;
+  };
+
+  static_assert(sizeof(SubMeshData) == 64, "SubMeshData must match submesh.glsl");
+  static_assert(sizeof(FrameUniforms) == 368, "FrameUniforms must match frame.glsl");
+
+  // Per face matrices of a RenderCube pass, laid out like Cube in cube.glsl (std140)
+  struct CubeUniforms {
+    float MV[CUBE_FACES][16];
+    float MVP[CUBE_FACES][16];
+    float MVNext[CUBE_FACES][16];
+    float MVPNext[CUBE_FACES][16];
+    float MVPPrev[CUBE_FACES][16];
+  };
+
+  // Layout of glMultiDrawElementsIndirect commands
+  struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  // Layout of glMultiDrawArraysIndirect commands
+  struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+  };
+
+  // Faces sorted into spatial chunks, each chunk becomes one sub-mesh
+  struct ChunkLayout {
+    size_t NumChunks() const {
+      return chunkStart.size() - 1;
+    }
+
+    size_t NumFaces(size_t chunk) const {
+      return chunkStart[chunk + 1] - chunkStart[chunk];
+    }
+
+    std::vector<uint32_t> faces; // original face indices in sorted order
+    std::vector<size_t> chunkStart; // start of each chunk in faces, plus the end
   };
 
-  static std::vector<MeshData> SplitMesh(const MeshData& mesh, const float splitSize);
-  static void CalculateAdjacency(const MeshData& mesh, std::vector<uint32_t>& adjFaces);
+  // Faces per meshlet, enough to keep the draws merged from runs of visible ones large
+  static constexpr size_t MESHLET_FACES = 64;
+
+  // Vertices the post-transform cache is assumed to hold, for ordering faces and measuring ACMR
+  static constexpr size_t VERTEX_CACHE_SIZE = 16;
+
+  // Upper bound of the memory building and uploading a sub-mesh takes per face: indices,
+  // adjacency and up to four unique vertices
+  static constexpr size_t BUILD_BYTES_PER_FACE = 4 * sizeof(uint32_t) + 4 * sizeof(uint32_t) +
+      4 * sizeof(Eigen::Vector3f);
+
+  // Orders the faces into chunks of splitSize. With streamedFile, which the views point into, each
+  // block of it read is dropped once done, so the file is never resident as a whole.
+  static ChunkLayout LayoutChunks(
+      const StridedView<float>& positions,
+      const StridedView<uint32_t>& quads,
+      const float splitSize,
+      PLYFile* streamedFile = nullptr);
+
+  // Builds the sub-meshes of chunks [firstChunk, lastChunk). Dense remap tables are fastest but
+  // take memory proportional to the whole mesh on each thread.
+  static MeshData BuildChunks(
+      const StridedView<float>& positions,
+      const StridedView<uint32_t>& quads,
+      const ChunkLayout& layout,
+      const size_t firstChunk,
+      const size_t lastChunk,
+      const bool denseRemap);
+
+  static void CalculateAdjacency(const MeshView& mesh, uint32_t* adjFaces);
+
+  void LoadMeshData(const std::string& meshFile, const std::string& cacheDir);
+  // Reorders subMeshes for the vertex cache if enabled
+  void UploadSubMeshes(
+      MeshData& subMeshes,
+      const size_t totalSubMeshes,
+      MeshCache::Writer* cacheWriter);
+  bool LoadMeshCache(const std::string& cacheFile, const MeshCache::Key& key);
+
+  // Appends one sub-mesh to the shared buffers, compacting it if enabled. faceOrder is empty
+  // unless the faces were ordered for the vertex cache.
+  void AddMesh(
+      const Span<const Eigen::Vector3f>& positions,
+      const Span<const uint32_t>& indices,
+      const Span<const uint32_t>& adjFaces,
+      const Span<const uint8_t>& faceOrder);
+
+  void LoadAtlasData(
+      const std::string& atlasFolder,
+      const std::string& meshFile,
+      const std::string& cacheDir);
+
+  // Replaces the atlas files with padded copies in cacheDir, building those that are missing or
+  // stale. Leaves them untouched if any atlas cannot be padded.
+  void PadAtlases(
+      std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+      const std::string& meshFile,
+      const std::string& cacheDir);
+
+  // Replaces the atlas files with mip chains in cacheDir, building those that are missing or
+  // stale, from the finest level the target output needs. Leaves them untouched if any atlas
+  // cannot be mipmapped.
+  void MipmapAtlases(
+      std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+      const std::string& cacheDir);
+
+  // Replaces the uncompressed atlas files with block compressed copies in cacheDir, encoding
+  // those that are missing or stale. Only the leading levels whose tiles are a multiple of 4
+  // texels wide are kept, none for padded tiles. Leaves them untouched if any atlas cannot be
+  // compressed.
+  void CompressAtlases(
+      std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+      const std::string& cacheDir);
+
+  // Adjacency of a sub-mesh as uploaded, unpacked to 32 bits per edge
+  std::vector<uint32_t> DownloadAdjacency(size_t subMesh) const;
+
+  // Uploads the per sub-mesh data once all meshes and atlases are known
+  void FinishMeshes();
+
+  // Sub-meshes whose bounds intersect frustum, updating the cull stats
+  std::vector<size_t> VisibleSubMeshes(const Frustum& frustum);
+
+  FrameUniforms MakeFrame(
+      const pangolin::OpenGlRenderState& cam,
+      const Eigen::Vector4f& clipPlane) const;
+
+  // Tests meshlets against frustum and the face culling state, seen from the eye of frame, for
+  // drawing them in mode. Null when meshlet culling is disabled.
+  std::unique_ptr<MeshletCuller> MakeMeshletCuller(
+      const FrameUniforms& frame,
+      const Frustum& frustum,
+      const GLenum mode) const;
+
+  // Matrices of the faces of a cubemap seen through cams, moving to camsNext and back to camsPrev
+  static CubeUniforms MakeCube(
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const std::vector<pangolin::OpenGlRenderState>& camsNext,
+      const std::vector<pangolin::OpenGlRenderState>& camsPrev);
+
+  // Draws the sub-meshes any face of cube sees, frustum bounding them all, into the faces' layers.
+  // Textured passes draw their depth with prepass first, if given.
+  void RenderCubeFaces(
+      ShaderProgramCache::Program& program,
+      const FrameUniforms& frame,
+      const CubeUniforms& cube,
+      const Frustum& frustum,
+      const bool textured,
+      ShaderProgramCache::Program* prepass = nullptr);
+
+  // Draws the sub-meshes in the view of mvp, culling them as enabled. Textured passes draw their
+  // depth with prepass first, if given.
+  void RenderVisibleSubMeshes(
+      ShaderProgramCache::Program& program,
+      const FrameUniforms& frame,
+      const pangolin::OpenGlMatrix& mvp,
+      const Eigen::Vector4f& clipPlane,
+      const GLenum mode,
+      const bool textured,
+      ShaderProgramCache::Program* prepass = nullptr);
+
+  // Orders the sub-meshes by distance from the eye of frame, nearest first, if enabled
+  void SortFrontToBack(const FrameUniforms& frame, std::vector<size_t>& subMeshes) const;
+
+  // Draws only the depth of the sub-meshes, with the DEPTH_ONLY variant of a textured program
+  void RenderPrepass(
+      ShaderProgramCache::Program& prepass,
+      const FrameUniforms& frame,
+      const std::vector<size_t>& subMeshes,
+      const GLenum mode,
+      const MeshletCuller* meshletCuller);
+
+  // Draws the sub-meshes with a textured program, shading only the fragments whose depth the
+  // prepass drew if afterPrepass is set, and counts the samples passing the depth test if enabled
+  void RenderTextured(
+      ShaderProgramCache::Program& program,
+      const FrameUniforms& frame,
+      const std::vector<size_t>& subMeshes,
+      const GLenum mode,
+      const MeshletCuller* meshletCuller,
+      const bool afterPrepass);
+
+  // Adds the viewport of a Render, RenderPano or RenderCube pass, drawn to that many layers, to the
+  // overdraw stats, if enabled
+  void CountOverdrawPass(const int layers = 1);
 
-  void LoadMeshData(const std::string& meshFile);
-  void LoadAtlasData(const std::string& atlasFolder);
+  // Draws the given sub-meshes with program, after uploading frame. Textured programs sample the
+  // sub-meshes' atlases. Only their meshlets passing meshletCuller are drawn, if given.
+  void RenderSubMeshes(
+      ShaderProgramCache::Program& program,
+      const FrameUniforms& frame,
+      const std::vector<size_t>& subMeshes,
+      const GLenum mode,
+      const bool textured,
+      const MeshletCuller* meshletCuller = nullptr);
+
+  // Mode the non-panoramic passes draw quads in, given the one their geometry shader or
+  // GL_QUADS path takes. GL_TRIANGLES when pulling vertices.
+  GLenum QuadMode(const GLenum mode) const {
+    return options.vertexPullingEnable ? GL_TRIANGLES : mode;
+  }
+
+  void BindGeometry(const GLenum mode);
+  void UnbindGeometry(const GLenum mode);
+
+  // Issues the draws of count sub-meshes with the bound program and geometry. GL_TRIANGLES draws
+  // them by vertex pulling, 6 vertices per quad.
+  void DrawSubMeshes(
+      const size_t* subMeshes,
+      const size_t count,
+      const GLenum mode,
+      const MeshletCuller* meshletCuller);
+
+  PTexMeshOptions options;
 
   float splitSize = 0.0f;
   uint32_t tileSize = 0;
 
-  pangolin::GlSlProgram shader;
-  pangolin::GlSlProgram shaderPano;
-  pangolin::GlSlProgram depthShader;
-  pangolin::GlSlProgram depthPanoShader;
-  pangolin::GlSlProgram motionVectorShader;
-  pangolin::GlSlProgram motionVectorPanoShader;
+  // texels of padding around each atlas tile
+  int tileBorder = 0;
+
+  // mip levels of the atlases that were loaded, tiles are tileSize >> atlasBaseLevel wide
+  int atlasBaseLevel = 0;
+  int atlasLevels = 1;
+
+  // for matching atlas levels to the output resolution
+  double totalEdgeLength = 0.0;
+  size_t totalFaces = 0;
+
+  // simulated vertex cache misses of the sub-meshes built this load, before and after ordering
+  size_t cacheMissesBefore = 0;
+  size_t cacheMissesAfter = 0;
+
+  // time spent in CalculateAdjacency building the sub-meshes this load
+  double adjacencySeconds = 0.0;
+
+  // Features the programs are specialised for, each program has switches for those it uses
+  enum Feature : unsigned {
+    CLIP_PLANE = 1 << 0, // GL_CLIP_DISTANCE0 is enabled, so the clip distance is written
+    TONE_MAPPING = 1 << 1, // exposure, saturation or gamma change the atlas colors
+    DEPTH_ONLY = 1 << 2, // the depth prepass of a textured program, with the same vertex stages
+    BACKWARD_MOTION = 1 << 3, // motion vectors to the previous frame as well as to the next
+  };
+
+  // Features of a pass drawn in the current state
+  unsigned Features() const;
+
+  ShaderPermutations shader;
+  ShaderPermutations shaderPano;
+  ShaderPermutations depthShader;
+  ShaderPermutations depthPanoShader;
+  ShaderPermutations motionVectorShader;
+  ShaderPermutations motionVectorPanoShader;
+
+  // with layeredCubemapEnable
+  ShaderPermutations cubeShader;
+  ShaderPermutations cubeDepthShader;
+  ShaderPermutations cubeMotionVectorShader;
+
+  // with combinedPassEnable, the textured programs also writing depth and motion vectors
+  ShaderPermutations combinedShader;
+  ShaderPermutations cubeCombinedShader;
 
   float exposure = 1.0f;
   float gamma = 1.0f;
@@ -134,5 +687,51 @@ class PTexMesh {
   static constexpr int ROTATION_SHIFT = 30;
   static constexpr int FACE_MASK = 0x3FFFFFFF;
 
+  // compact adjacency entries
+  static constexpr int COMPACT_ROTATION_SHIFT = 14;
+  static constexpr int COMPACT_FACE_MASK = 0x3FFF;
+
   std::vector<std::unique_ptr<Mesh>> meshes;
+  std::vector<Meshlet> meshlets;
+  std::vector<size_t> allSubMeshes;
+  std::unique_ptr<AtlasResidency> atlases;
+
+  // over the sub-meshes' bounds
+  BoundsTree boundsTree;
+  std::unique_ptr<OcclusionCuller> occlusionCuller;
+  CullStats cullStats;
+  CullStats lastCullStats;
+
+  // GL_SAMPLES_PASSED query of the textured passes, 0 unless counting overdraw
+  GLuint overdrawQuery = 0;
+  OverdrawStats overdrawStats;
+
+  // GL_TIME_ELAPSED query of RenderSubMeshes, 0 unless timing it
+  GLuint gpuTimeQuery = 0;
+  GpuTimeStats gpuTimeStats;
+
+  // every sub-mesh's geometry
+  MeshBuffers meshBuffers;
+
+  // SubMeshData of each sub-mesh
+  pangolin::GlBufferData subMeshData;
+
+  // atlas face within its meshlet of each face drawn, one byte each, while adding sub-meshes and
+  // then on the GPU
+  std::vector<uint8_t> faceOrders;
+  pangolin::GlBufferData faceOrderData;
+
+  // sub-mesh and first face of each meshlet, read as instanced attributes, so the base instance
+  // of a draw starting at a meshlet selects both
+  pangolin::GlBufferData meshletInstances;
+
+  // bindless handle of each sub-mesh's atlas
+  pangolin::GlBufferData atlasHandles;
+  bool bindlessAtlases = false;
+
+  pangolin::GlBufferData frameUniforms;
+  pangolin::GlBufferData cubeUniforms;
+  pangolin::GlBufferData indirectCommands;
+  std::vector<DrawElementsIndirectCommand> commands;
+  std::vector<DrawArraysIndirectCommand> arrayCommands;
 };
@@ -0,0 +1,85 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Stable LSD radix sort on unsigned integer keys, with per-thread histograms for large inputs
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+namespace radixsort_detail {
+
+constexpr int DIGIT_BITS = 8;
+constexpr size_t NUM_BUCKETS = size_t(1) << DIGIT_BITS;
+
+// inputs below this size are sorted on one thread
+constexpr size_t PARALLEL_THRESHOLD = 1 << 16;
+
+} // namespace radixsort_detail
+
+// Sorts data[0, n) by key(element), only looking at the lowest keyBits of the key. Elements with
+// equal keys keep their input order. tmp must hold n elements.
+template <typename T, typename KeyFunc>
+void RadixSort(T* data, T* tmp, const size_t n, KeyFunc key, const int keyBits = 64) {
+  using namespace radixsort_detail;
+
+  T* src = data;
+  T* dst = tmp;
+
+  int numThreads = 1;
+#ifdef _OPENMP
+  if (n >= PARALLEL_THRESHOLD && !omp_in_parallel())
+    numThreads = omp_get_max_threads();
+#endif
+
+  std::vector<size_t> offsets(numThreads * NUM_BUCKETS);
+
+  for (int shift = 0; shift < keyBits; shift += DIGIT_BITS) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+
+#pragma omp parallel num_threads(numThreads) if (numThreads > 1)
+    {
+      // the runtime may start fewer threads than asked for
+      int t = 0;
+      int teamSize = 1;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+      teamSize = omp_get_num_threads();
+#endif
+      // each thread owns one contiguous block, so blocks scatter in input order
+      const size_t begin = n * t / teamSize;
+      const size_t end = n * (t + 1) / teamSize;
+      size_t* count = &offsets[t * NUM_BUCKETS];
+
+      for (size_t i = begin; i < end; i++)
+        count[(key(src[i]) >> shift) & (NUM_BUCKETS - 1)]++;
+
+#pragma omp barrier
+#pragma omp single
+      {
+        // exclusive prefix sum, bucket major then thread, which keeps the sort stable
+        size_t sum = 0;
+        for (size_t b = 0; b < NUM_BUCKETS; b++) {
+          for (int i = 0; i < teamSize; i++) {
+            const size_t c = offsets[i * NUM_BUCKETS + b];
+            offsets[i * NUM_BUCKETS + b] = sum;
+            sum += c;
+          }
+        }
+      }
+
+      for (size_t i = begin; i < end; i++)
+        dst[count[(key(src[i]) >> shift) & (NUM_BUCKETS - 1)]++] = src[i];
+    }
+
+    std::swap(src, dst);
+  }
+
+  if (src != data)
+    std::copy(src, src + n, data);
+}
@@ -0,0 +1,50 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Programs specialised for every combination of a few #define switches, so draws pick the one
+// matching their state instead of branching on uniforms
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ShaderProgramCache.h"
+
+class ShaderPermutations {
+ public:
+  // Defined in the programs built for features that include feature. Those programs don't
+  // depend on the features in ignores, so no combination has both.
+  struct Switch {
+    unsigned feature;
+    std::string define;
+    unsigned ignores = 0;
+  };
+
+  // Queues a program for every combination of switches with programCache, except those another
+  // switch of the combination ignores. Each has defines and the switches of its combination
+  // #defined.
+  void Add(
+      ShaderProgramCache& programCache,
+      const std::vector<ShaderProgramCache::ShaderFile>& shaderFiles,
+      const std::vector<std::string>& searchPath,
+      const std::vector<std::string>& defines,
+      const std::vector<Switch>& switches = {});
+
+  // The program specialised for the set of features, ignoring those without a switch or ignored
+  // by another switch on
+  ShaderProgramCache::Program& Get(unsigned features);
+
+  size_t NumPrograms() const {
+    return numPrograms;
+  }
+
+ private:
+  // The combination of switches with those ignored by the others dropped
+  unsigned Reduce(unsigned combination) const;
+
+  std::vector<Switch> switches;
+  size_t numPrograms = 0;
+
+  // indexed by the bit set of switches defined, null for combinations Reduce changes. The cache
+  // keeps pointers until it is built.
+  std::vector<std::unique_ptr<ShaderProgramCache::Program>> programs;
+};
@@ -0,0 +1,59 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Builds GLSL programs, reusing the linked program binaries earlier runs stored on disk
+#pragma once
+
+#include <pangolin/gl/glsl.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ShaderProgramCache {
+ public:
+  // Program that can be created from a binary instead of its shaders
+  class Program : public pangolin::GlSlProgram {
+   public:
+    // Takes ownership of a linked program object
+    void Adopt(GLuint program) {
+      ClearShaders();
+      prog = program;
+      linked = true;
+    }
+  };
+
+  using ShaderFile = std::pair<pangolin::GlSlShaderType, std::string>;
+
+  // Per-user folder used when no other cache folder is given
+  static std::string DefaultDir();
+
+  // An empty cacheDir compiles every program without storing it
+  explicit ShaderProgramCache(const std::string& cacheDir);
+
+  // Queues a program made of the given shader files. #include directives are resolved against
+  // searchPath and the including file's folder, and each of defines is #defined in every shader.
+  void Add(
+      Program& program,
+      const std::vector<ShaderFile>& shaderFiles,
+      const std::vector<std::string>& searchPath,
+      const std::vector<std::string>& defines = {});
+
+  // Loads the queued programs from the cache. The missing ones have all their shaders compiled
+  // and linked before the first result is checked, so drivers can build them concurrently, and
+  // their binaries are stored for next time.
+  void Build();
+
+ private:
+  struct Entry {
+    Program* program;
+    std::vector<std::pair<GLenum, std::string>> sources; // preprocessed
+    uint64_t key;
+  };
+
+  bool Load(const Entry& entry);
+  void Store(const Entry& entry, GLuint program);
+  std::string CacheFile(uint64_t key) const;
+
+  const std::string cacheDir;
+  std::vector<Entry> entries;
+};
@@ -0,0 +1,53 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+// Non-owning view of a contiguous array of T
+template <typename T>
+class Span {
+ public:
+  Span() {}
+
+  Span(T* data, size_t count) : ptr(data), count(count) {}
+
+  // Span<T> converts to Span<const T>
+  template <
+      typename U,
+      typename = typename std::enable_if<std::is_convertible<U (*)[], T (*)[]>::value>::type>
+  Span(const Span<U>& other) : ptr(other.data()), count(other.size()) {}
+
+  T& operator[](size_t i) const {
+    return ptr[i];
+  }
+
+  T* data() const {
+    return ptr;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  T* begin() const {
+    return ptr;
+  }
+
+  T* end() const {
+    return ptr + count;
+  }
+
+  // count elements starting at offset
+  Span Subspan(size_t offset, size_t count) const {
+    return Span(ptr + offset, count);
+  }
+
+ private:
+  T* ptr = nullptr;
+  size_t count = 0;
+};
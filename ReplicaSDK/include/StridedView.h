@@ -0,0 +1,45 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+// Non-owning view of packets laid out at a fixed byte stride, each holding one or more T.
+// Packets in files are often not aligned for T, so elements are returned by value.
+template <typename T>
+class StridedView {
+ public:
+  StridedView() {}
+
+  StridedView(const void* data, size_t count, size_t stride = sizeof(T))
+      : data((const char*)data), count(count), stride(stride) {}
+
+  // j-th element of the i-th packet
+  T operator()(size_t i, size_t j = 0) const {
+    T value;
+    memcpy(&value, &data[i * stride + j * sizeof(T)], sizeof(T));
+    return value;
+  }
+
+  // i-th packet
+  const void* Packet(size_t i) const {
+    return &data[i * stride];
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  size_t Stride() const {
+    return stride;
+  }
+
+  bool IsValid() const {
+    return data != nullptr;
+  }
+
+ private:
+  const char* data = nullptr;
+  size_t count = 0;
+  size_t stride = sizeof(T);
+};
@@ -0,0 +1,30 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Orders the quads of a sub-mesh so the GPU's post-transform cache reuses more of the vertices
+// shared between them, and the vertices so they are fetched in order
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstdint>
+
+#include "Span.h"
+
+// Vertices transformed drawing the quads of indices in order through a FIFO cache of cacheSize
+// vertices. Divided by twice the number of quads this is the average cache miss ratio (ACMR).
+size_t CountCacheMisses(
+    const Span<const uint32_t>& indices,
+    const size_t numVertices,
+    const size_t cacheSize);
+
+// Reorders the quads within each run of up to windowFaces consecutive faces, greedily drawing
+// next the one whose vertices are most recently used in an LRU cache of cacheSize vertices (after
+// Forsyth), then renumbers the vertices in order of first use. The faces of a run stay in it, so
+// meshlets built from the same runs cover the same faces, and each keeps its corner order.
+// faceOrder receives one entry per face in the new order, the offset within its run it had
+// before, e.g. to look up its atlas tile. windowFaces can be at most 256.
+void OrderForVertexCache(
+    const Span<Eigen::Vector3f>& positions,
+    const Span<uint32_t>& indices,
+    const size_t windowFaces,
+    const size_t cacheSize,
+    const Span<uint8_t>& faceOrder);
@@ -0,0 +1,550 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "AtlasCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr char MAGIC[8] = {'P', 'T', 'E', 'X', 'B', 'C', 'N', '\0'};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint32_t dim;
+  uint32_t numLevels;
+  uint64_t offset;
+  uint64_t atlasSize;
+  int64_t atlasTime;
+};
+
+FileHeader MakeHeader(const AtlasCompression::Key& key) {
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = AtlasCompression::VERSION;
+  header.format = (uint32_t)key.format;
+  header.dim = key.dim;
+  header.numLevels = key.numLevels;
+  header.offset = key.offset;
+  header.atlasSize = key.atlasSize;
+  header.atlasTime = key.atlasTime;
+  return header;
+}
+
+size_t BlockBytes(AtlasCompression::Format format) {
+  return format == AtlasCompression::Format::BC1 ? 8 : 16;
+}
+
+int LevelDim(int dim, int level) {
+  return std::max(dim >> level, 1);
+}
+
+// Levels that aren't a multiple of 4 wide end in partial blocks
+size_t LevelBlocks(int dim) {
+  const size_t blocksWide = (dim + 3) / 4;
+  return blocksWide * blocksWide;
+}
+
+// 4-bit BC6H and BC7 interpolation weights, out of 64. Symmetric, so swapping the endpoints maps
+// index i to 15 - i.
+constexpr int WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Texels of a 4x4 block, a channel at a time so the loops over them vectorize
+struct Texels {
+  float c[3][16];
+};
+
+// Reads the block at (bx, by) of a dim x dim level, repeating the last row and column in partial
+// blocks. BC6H works on the bits of the halfs, which it interpolates as integers, and only
+// encodes finite positive ones.
+void LoadTexels(const uint8_t* level, int dim, int bx, int by, bool halfFloat, Texels& texels) {
+  for (int i = 0; i < 16; i++) {
+    const size_t x = std::min(bx * 4 + i % 4, dim - 1);
+    const size_t y = std::min(by * 4 + i / 4, dim - 1);
+
+    for (int c = 0; c < 3; c++) {
+      if (halfFloat) {
+        uint16_t bits;
+        memcpy(&bits, level + ((y * dim + x) * 3 + c) * sizeof(uint16_t), sizeof(bits));
+        texels.c[c][i] = (bits & 0x8000) ? 0.0f : (float)std::min<uint16_t>(bits, 0x7bff);
+      } else {
+        texels.c[c][i] = level[(y * dim + x) * 3 + c];
+      }
+    }
+  }
+}
+
+// Writes fields to a zeroed block, least significant bit first
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* block) : block(block) {}
+
+  void Write(uint32_t value, int numBits) {
+    for (int i = 0; i < numBits; i++, pos++) {
+      if ((value >> i) & 1)
+        block[pos / 8] |= 1 << (pos % 8);
+    }
+  }
+
+ private:
+  uint8_t* block;
+  int pos = 0;
+};
+
+// Endpoints at both ends of the texels' extent along their principal axis
+void FitEndpoints(const Texels& texels, float e0[3], float e1[3]) {
+  float mean[3];
+  for (int c = 0; c < 3; c++) {
+    float sum = 0.0f;
+    for (int i = 0; i < 16; i++)
+      sum += texels.c[c][i];
+    mean[c] = sum / 16.0f;
+  }
+
+  float cov[3][3] = {};
+  for (int a = 0; a < 3; a++) {
+    for (int b = a; b < 3; b++) {
+      float sum = 0.0f;
+      for (int i = 0; i < 16; i++)
+        sum += (texels.c[a][i] - mean[a]) * (texels.c[b][i] - mean[b]);
+      cov[a][b] = cov[b][a] = sum;
+    }
+  }
+
+  // power iteration, starting from the channel varying most
+  const int k = cov[0][0] >= cov[1][1] ? (cov[0][0] >= cov[2][2] ? 0 : 2)
+                                       : (cov[1][1] >= cov[2][2] ? 1 : 2);
+  float axis[3] = {cov[0][k], cov[1][k], cov[2][k]};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3];
+    for (int a = 0; a < 3; a++)
+      next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+
+    const float scale = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+    if (scale == 0.0f)
+      break;
+
+    for (int a = 0; a < 3; a++)
+      axis[a] = next[a] / scale;
+  }
+
+  const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (!(length > 0.0f)) {
+    for (int c = 0; c < 3; c++)
+      e0[c] = e1[c] = mean[c];
+    return;
+  }
+
+  for (int a = 0; a < 3; a++)
+    axis[a] /= length;
+
+  float tMin = std::numeric_limits<float>::max();
+  float tMax = -std::numeric_limits<float>::max();
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int c = 0; c < 3; c++)
+      t += (texels.c[c][i] - mean[c]) * axis[c];
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+
+  for (int c = 0; c < 3; c++) {
+    e0[c] = mean[c] + axis[c] * tMin;
+    e1[c] = mean[c] + axis[c] * tMax;
+  }
+}
+
+// Least squares endpoints for texels interpolated with weights w from e0 to e1. False if the
+// weights don't determine them.
+bool RefitEndpoints(const Texels& texels, const float w[16], float e0[3], float e1[3]) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    aa += (1.0f - w[i]) * (1.0f - w[i]);
+    ab += (1.0f - w[i]) * w[i];
+    bb += w[i] * w[i];
+  }
+
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f)
+    return false;
+
+  for (int c = 0; c < 3; c++) {
+    float ax = 0.0f, bx = 0.0f;
+    for (int i = 0; i < 16; i++) {
+      ax += (1.0f - w[i]) * texels.c[c][i];
+      bx += w[i] * texels.c[c][i];
+    }
+
+    e0[c] = (bb * ax - ab * bx) / det;
+    e1[c] = (aa * bx - ab * ax) / det;
+  }
+
+  return true;
+}
+
+// Nearest palette entry to each texel, returns the total squared error
+template <int N>
+float PickIndices(const Texels& texels, const float palette[N][3], uint8_t indices[16]) {
+  float total = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float best = std::numeric_limits<float>::max();
+    for (int j = 0; j < N; j++) {
+      float error = 0.0f;
+      for (int c = 0; c < 3; c++) {
+        const float d = texels.c[c][i] - palette[j][c];
+        error += d * d;
+      }
+
+      if (error < best) {
+        best = error;
+        indices[i] = j;
+      }
+    }
+    total += best;
+  }
+  return total;
+}
+
+// Opaque 4 color blocks of 5:6:5 endpoints
+struct Bc1Endpoints {
+  static constexpr int N = 4;
+
+  uint16_t q[2];
+
+  static float Weight(int index) {
+    constexpr float weights[N] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    return weights[index];
+  }
+
+  void Quantize(const float e0[3], const float e1[3]) {
+    const float* e[2] = {e0, e1};
+    for (int i = 0; i < 2; i++) {
+      const int r = std::clamp((int)std::lround(e[i][0] * 31.0f / 255.0f), 0, 31);
+      const int g = std::clamp((int)std::lround(e[i][1] * 63.0f / 255.0f), 0, 63);
+      const int b = std::clamp((int)std::lround(e[i][2] * 31.0f / 255.0f), 0, 31);
+      q[i] = (r << 11) | (g << 5) | b;
+    }
+  }
+
+  void Palette(float palette[N][3]) const {
+    for (int i = 0; i < 2; i++) {
+      const int r = q[i] >> 11, g = (q[i] >> 5) & 63, b = q[i] & 31;
+      palette[i][0] = (r << 3) | (r >> 2);
+      palette[i][1] = (g << 2) | (g >> 4);
+      palette[i][2] = (b << 3) | (b >> 2);
+    }
+
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+      palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+  }
+
+  // The first endpoint must be the larger for 4 colors, equal ones decode in 3 color mode
+  void Write(const uint8_t indices[16], uint8_t* block) const {
+    const bool swap = q[0] < q[1];
+    const uint16_t c0 = swap ? q[1] : q[0];
+    const uint16_t c1 = swap ? q[0] : q[1];
+
+    uint32_t bits = 0;
+    if (c0 != c1) {
+      for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)(swap ? indices[i] ^ 1 : indices[i]) << (2 * i);
+    }
+
+    BitWriter writer(block);
+    writer.Write(c0, 16);
+    writer.Write(c1, 16);
+    writer.Write(bits, 32);
+  }
+};
+
+// Mode 6, one subset of 7.7.7.7 endpoints with a shared low bit, set for opaque alpha
+struct Bc7Endpoints {
+  static constexpr int N = 16;
+
+  int q[2][3];
+
+  static float Weight(int index) {
+    return WEIGHTS4[index] / 64.0f;
+  }
+
+  void Quantize(const float e0[3], const float e1[3]) {
+    for (int c = 0; c < 3; c++) {
+      q[0][c] = std::clamp((int)std::lround((e0[c] - 1.0f) / 2.0f), 0, 127);
+      q[1][c] = std::clamp((int)std::lround((e1[c] - 1.0f) / 2.0f), 0, 127);
+    }
+  }
+
+  void Palette(float palette[N][3]) const {
+    for (int i = 0; i < N; i++) {
+      for (int c = 0; c < 3; c++) {
+        const int a = q[0][c] * 2 + 1, b = q[1][c] * 2 + 1;
+        palette[i][c] = ((64 - WEIGHTS4[i]) * a + WEIGHTS4[i] * b + 32) >> 6;
+      }
+    }
+  }
+
+  // The first texel's index has an implicit 0 high bit
+  void Write(const uint8_t indices[16], uint8_t* block) const {
+    const bool swap = indices[0] >= 8;
+    const int(&q0)[3] = swap ? q[1] : q[0];
+    const int(&q1)[3] = swap ? q[0] : q[1];
+
+    BitWriter writer(block);
+    writer.Write(1 << 6, 7);
+    for (int c = 0; c < 3; c++) {
+      writer.Write(q0[c], 7);
+      writer.Write(q1[c], 7);
+    }
+    writer.Write(127, 7);
+    writer.Write(127, 7);
+    writer.Write(1, 1);
+    writer.Write(1, 1);
+
+    for (int i = 0; i < 16; i++)
+      writer.Write(swap ? 15 - indices[i] : indices[i], i == 0 ? 3 : 4);
+  }
+};
+
+// Mode 11, one region of 10.10.10 endpoints without deltas, unsigned. Palettes interpolate the
+// endpoints' bits scaled to 16 and back to the largest finite half.
+struct Bc6hEndpoints {
+  static constexpr int N = 16;
+
+  int q[2][3];
+
+  static float Weight(int index) {
+    return WEIGHTS4[index] / 64.0f;
+  }
+
+  static int Unquantize(int value) {
+    if (value == 0)
+      return 0;
+    if (value == 1023)
+      return 0xffff;
+    return ((value << 16) + 0x8000) >> 10;
+  }
+
+  void Quantize(const float e0[3], const float e1[3]) {
+    for (int c = 0; c < 3; c++) {
+      q[0][c] = std::clamp((int)std::lround((e0[c] - 15.5f) / 31.0f), 0, 1023);
+      q[1][c] = std::clamp((int)std::lround((e1[c] - 15.5f) / 31.0f), 0, 1023);
+    }
+  }
+
+  void Palette(float palette[N][3]) const {
+    for (int i = 0; i < N; i++) {
+      for (int c = 0; c < 3; c++) {
+        const int a = Unquantize(q[0][c]), b = Unquantize(q[1][c]);
+        const int value = ((64 - WEIGHTS4[i]) * a + WEIGHTS4[i] * b + 32) >> 6;
+        palette[i][c] = (value * 31) >> 6;
+      }
+    }
+  }
+
+  // The first texel's index has an implicit 0 high bit
+  void Write(const uint8_t indices[16], uint8_t* block) const {
+    const bool swap = indices[0] >= 8;
+    const int(&q0)[3] = swap ? q[1] : q[0];
+    const int(&q1)[3] = swap ? q[0] : q[1];
+
+    BitWriter writer(block);
+    writer.Write(0x03, 5);
+    for (int c = 0; c < 3; c++)
+      writer.Write(q0[c], 10);
+    for (int c = 0; c < 3; c++)
+      writer.Write(q1[c], 10);
+
+    for (int i = 0; i < 16; i++)
+      writer.Write(swap ? 15 - indices[i] : indices[i], i == 0 ? 3 : 4);
+  }
+};
+
+// Fits endpoints to the principal axis, then refits them to the indices they pick while that
+// lowers the error
+template <typename Endpoints>
+void EncodeBlock(const Texels& texels, uint8_t* block) {
+  constexpr int N = Endpoints::N;
+
+  float e0[3], e1[3];
+  FitEndpoints(texels, e0, e1);
+
+  Endpoints best;
+  best.Quantize(e0, e1);
+
+  float palette[N][3];
+  uint8_t bestIndices[16];
+  best.Palette(palette);
+  float bestError = PickIndices<N>(texels, palette, bestIndices);
+
+  for (int iteration = 0; iteration < 2 && bestError > 0.0f; iteration++) {
+    float w[16];
+    for (int i = 0; i < 16; i++)
+      w[i] = Endpoints::Weight(bestIndices[i]);
+
+    if (!RefitEndpoints(texels, w, e0, e1))
+      break;
+
+    Endpoints candidate;
+    candidate.Quantize(e0, e1);
+    candidate.Palette(palette);
+
+    uint8_t indices[16];
+    const float error = PickIndices<N>(texels, palette, indices);
+    if (error >= bestError)
+      break;
+
+    best = candidate;
+    bestError = error;
+    memcpy(bestIndices, indices, sizeof(indices));
+  }
+
+  best.Write(bestIndices, block);
+}
+
+void EncodeLevel(
+    const uint8_t* level,
+    const int dim,
+    const AtlasCompression::Format format,
+    uint8_t* blocks) {
+  const int blocksWide = (dim + 3) / 4;
+  const size_t blockBytes = BlockBytes(format);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int by = 0; by < blocksWide; by++) {
+    Texels texels;
+    for (int bx = 0; bx < blocksWide; bx++) {
+      uint8_t* block = blocks + ((size_t)by * blocksWide + bx) * blockBytes;
+
+      switch (format) {
+        case AtlasCompression::Format::BC1:
+          LoadTexels(level, dim, bx, by, false, texels);
+          EncodeBlock<Bc1Endpoints>(texels, block);
+          break;
+        case AtlasCompression::Format::BC7:
+          LoadTexels(level, dim, bx, by, false, texels);
+          EncodeBlock<Bc7Endpoints>(texels, block);
+          break;
+        case AtlasCompression::Format::BC6H:
+          LoadTexels(level, dim, bx, by, true, texels);
+          EncodeBlock<Bc6hEndpoints>(texels, block);
+          break;
+      }
+    }
+  }
+}
+
+} // namespace
+
+AtlasCompression::Key AtlasCompression::MakeKey(
+    const std::string& atlasFile,
+    size_t offset,
+    int dim,
+    int numLevels,
+    Format format) {
+  Key key;
+  key.atlasSize = std::filesystem::file_size(atlasFile);
+  key.atlasTime = std::filesystem::last_write_time(atlasFile).time_since_epoch().count();
+  key.offset = offset;
+  key.dim = dim;
+  key.numLevels = numLevels;
+  key.format = format;
+  return key;
+}
+
+const char* AtlasCompression::Name(Format format) {
+  switch (format) {
+    case Format::BC1:
+      return "BC1";
+    case Format::BC7:
+      return "BC7";
+    case Format::BC6H:
+      return "BC6H";
+  }
+  return "";
+}
+
+size_t AtlasCompression::DataOffset() {
+  return sizeof(FileHeader);
+}
+
+size_t AtlasCompression::NumBytes(const Key& key) {
+  size_t numBlocks = 0;
+  for (uint32_t level = 0; level < key.numLevels; level++)
+    numBlocks += LevelBlocks(LevelDim(key.dim, level));
+  return numBlocks * BlockBytes(key.format);
+}
+
+bool AtlasCompression::IsCurrent(const std::string& compressedFile, const Key& key) {
+  std::ifstream file(compressedFile, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  FileHeader header;
+  if (!file.read((char*)&header, sizeof(header)))
+    return false;
+
+  const FileHeader expected = MakeHeader(key);
+  return memcmp(&header, &expected, sizeof(FileHeader)) == 0;
+}
+
+bool AtlasCompression::Build(
+    const std::string& atlasFile,
+    const std::string& compressedFile,
+    const Key& key) {
+  const size_t texelBytes = key.format == Format::BC6H ? 3 * sizeof(uint16_t) : 3;
+
+  std::ifstream atlas(atlasFile, std::ios::binary);
+  if (!atlas.seekg(key.offset))
+    return false;
+
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path(compressedFile).parent_path(), error);
+
+  // write to a temporary file first, so concurrent runs never see a partial copy
+  const std::string tmpFile = compressedFile + ".tmp" + std::to_string(std::random_device()());
+  {
+    const FileHeader header = MakeHeader(key);
+
+    std::ofstream file(tmpFile, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+
+    std::vector<uint8_t> level;
+    std::vector<uint8_t> blocks;
+    for (uint32_t i = 0; i < key.numLevels && file; i++) {
+      const int dim = LevelDim(key.dim, i);
+
+      level.resize((size_t)dim * dim * texelBytes);
+      if (!atlas.read((char*)level.data(), level.size())) {
+        file.setstate(std::ios::failbit);
+        break;
+      }
+
+      blocks.assign(LevelBlocks(dim) * BlockBytes(key.format), 0);
+      EncodeLevel(level.data(), dim, key.format, blocks.data());
+
+      file.write((const char*)blocks.data(), blocks.size());
+    }
+
+    if (!file) {
+      file.close();
+      std::filesystem::remove(tmpFile, error);
+      return false;
+    }
+  }
+
+  std::filesystem::rename(tmpFile, compressedFile, error);
+  if (error) {
+    std::filesystem::remove(tmpFile, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,175 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "AtlasMipmaps.h"
+
+#include <Eigen/Core>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr char MAGIC[8] = {'P', 'T', 'E', 'X', 'M', 'I', 'P', '\0'};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t tileSize;
+  uint64_t atlasSize;
+  int64_t atlasTime;
+};
+
+FileHeader MakeHeader(const AtlasMipmaps::Key& key) {
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = AtlasMipmaps::VERSION;
+  header.tileSize = key.tileSize;
+  header.atlasSize = key.atlasSize;
+  header.atlasTime = key.atlasTime;
+  return header;
+}
+
+// Averages 2x2 blocks of src, a dim x dim image of numChannels channels of T. Tiles are an even
+// number of texels wide, so no block straddles two of them.
+template <typename T>
+void Downsample(const T* src, T* dst, const int dim, const int numChannels) {
+  const int half = dim / 2;
+
+#pragma omp parallel for
+  for (int y = 0; y < half; y++) {
+    for (int x = 0; x < half; x++) {
+      for (int c = 0; c < numChannels; c++) {
+        const size_t i = ((size_t)(2 * y) * dim + 2 * x) * numChannels + c;
+        const float sum = (float)src[i] + (float)src[i + numChannels] +
+            (float)src[i + (size_t)dim * numChannels] +
+            (float)src[i + ((size_t)dim + 1) * numChannels];
+        dst[((size_t)y * half + x) * numChannels + c] = T(sum * 0.25f);
+      }
+    }
+  }
+}
+
+// 8-bit channels round to nearest
+template <>
+void Downsample<uint8_t>(const uint8_t* src, uint8_t* dst, const int dim, const int numChannels) {
+  const int half = dim / 2;
+
+#pragma omp parallel for
+  for (int y = 0; y < half; y++) {
+    for (int x = 0; x < half; x++) {
+      for (int c = 0; c < numChannels; c++) {
+        const size_t i = ((size_t)(2 * y) * dim + 2 * x) * numChannels + c;
+        const int sum = src[i] + src[i + numChannels] + src[i + (size_t)dim * numChannels] +
+            src[i + ((size_t)dim + 1) * numChannels];
+        dst[((size_t)y * half + x) * numChannels + c] = (sum + 2) / 4;
+      }
+    }
+  }
+}
+
+} // namespace
+
+AtlasMipmaps::Key AtlasMipmaps::MakeKey(const std::string& atlasFile, int tileSize) {
+  Key key;
+  key.atlasSize = std::filesystem::file_size(atlasFile);
+  key.atlasTime = std::filesystem::last_write_time(atlasFile).time_since_epoch().count();
+  key.tileSize = tileSize;
+  return key;
+}
+
+int AtlasMipmaps::NumLevels(int dim, int tileSize) {
+  if (tileSize <= 0 || (tileSize & (tileSize - 1)) != 0 || dim % tileSize != 0)
+    return 0;
+
+  int numLevels = 1;
+  while ((tileSize >> (numLevels - 1)) > 1)
+    numLevels++;
+
+  return numLevels;
+}
+
+size_t AtlasMipmaps::LevelOffset(int dim, size_t texelBytes, int level) {
+  size_t offset = sizeof(FileHeader);
+  for (int i = 0; i < level; i++)
+    offset += (size_t)(dim >> i) * (dim >> i) * texelBytes;
+  return offset;
+}
+
+bool AtlasMipmaps::IsCurrent(const std::string& mipFile, const Key& key) {
+  std::ifstream file(mipFile, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  FileHeader header;
+  if (!file.read((char*)&header, sizeof(header)))
+    return false;
+
+  const FileHeader expected = MakeHeader(key);
+  return memcmp(&header, &expected, sizeof(FileHeader)) == 0;
+}
+
+bool AtlasMipmaps::Build(
+    const std::string& atlasFile,
+    const std::string& mipFile,
+    const Key& key,
+    const int dim,
+    const size_t texelBytes,
+    const bool halfFloat) {
+  const int numLevels = NumLevels(dim, key.tileSize);
+  if (numLevels == 0)
+    return false;
+
+  std::vector<uint8_t> level((size_t)dim * dim * texelBytes);
+  {
+    std::ifstream file(atlasFile, std::ios::binary);
+    if (!file.read((char*)level.data(), level.size()))
+      return false;
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path(mipFile).parent_path(), error);
+
+  // write to a temporary file first, so concurrent runs never see a partial chain
+  const std::string tmpFile = mipFile + ".tmp" + std::to_string(std::random_device()());
+  {
+    const FileHeader header = MakeHeader(key);
+
+    std::ofstream file(tmpFile, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)level.data(), level.size());
+
+    std::vector<uint8_t> next;
+    for (int i = 1; i < numLevels && file; i++) {
+      const int levelDim = dim >> (i - 1);
+      next.resize((size_t)(levelDim / 2) * (levelDim / 2) * texelBytes);
+
+      if (halfFloat) {
+        Downsample(
+            (const Eigen::half*)level.data(),
+            (Eigen::half*)next.data(),
+            levelDim,
+            texelBytes / sizeof(Eigen::half));
+      } else {
+        Downsample(level.data(), next.data(), levelDim, texelBytes);
+      }
+
+      file.write((const char*)next.data(), next.size());
+      level.swap(next);
+    }
+
+    if (!file) {
+      file.close();
+      std::filesystem::remove(tmpFile, error);
+      return false;
+    }
+  }
+
+  std::filesystem::rename(tmpFile, mipFile, error);
+  if (error) {
+    std::filesystem::remove(tmpFile, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,230 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "AtlasPadding.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr char MAGIC[8] = {'P', 'T', 'E', 'X', 'P', 'A', 'D', '\0'};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t border;
+  uint64_t atlasSize;
+  int64_t atlasTime;
+  uint64_t meshSize;
+  int64_t meshTime;
+  uint64_t meshHash;
+  float splitSize;
+  uint32_t tileSize;
+};
+
+// matches the packing of PTexMesh adjacency and atlas.glsl
+constexpr int ROTATION_SHIFT = 30;
+constexpr uint32_t FACE_MASK = 0x3FFFFFFF;
+
+FileHeader MakeHeader(const AtlasPadding::Key& key) {
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = AtlasPadding::VERSION;
+  header.border = AtlasPadding::BORDER;
+  header.atlasSize = key.atlasSize;
+  header.atlasTime = key.atlasTime;
+  header.meshSize = key.meshKey.meshSize;
+  header.meshTime = key.meshKey.meshTime;
+  header.meshHash = key.meshKey.meshHash;
+  header.splitSize = key.meshKey.splitSize;
+  header.tileSize = key.tileSize;
+  return header;
+}
+
+// Walks the adjacency like indexAdjacentFaces in atlas.glsl
+class AdjacencyWalker {
+ public:
+  AdjacencyWalker(const Span<const uint32_t>& adjFaces, const int tileSize)
+      : adjFaces(adjFaces), size(tileSize) {}
+
+  // Face whose tile holds texel p of face, which may lie outside the tile. p is moved into the
+  // returned face's tile frame, or left as is when there is no neighbour to fetch from.
+  uint32_t Walk(const uint32_t face, int& x, int& y) const {
+    int rot;
+
+    // edges 0 and 2, then around the corner through edge 1 or 3 of that neighbour
+    if (y < 0 || y > size - 1) {
+      uint32_t adjFace = AdjFace(face, y < 0 ? 0 : 2, rot);
+
+      if (adjFace != FACE_MASK) {
+        y += y < 0 ? size : -size;
+
+        if (x > size - 1 || x < 0) {
+          const int edge = x > size - 1 ? 1 : 3;
+          x += x < 0 ? size : -size;
+          Rotate(x, y, rot);
+
+          adjFace = AdjFace(adjFace, (edge - rot) & 3, rot);
+          if (adjFace != FACE_MASK) {
+            Rotate(x, y, rot);
+            return adjFace;
+          }
+        } else {
+          Rotate(x, y, rot);
+          return adjFace;
+        }
+      }
+    } else if (x < 0 || x > size - 1) {
+      // edges 3 and 1
+      const uint32_t adjFace = AdjFace(face, x < 0 ? 3 : 1, rot);
+
+      if (adjFace != FACE_MASK) {
+        x += x < 0 ? size : -size;
+        Rotate(x, y, rot);
+        return adjFace;
+      }
+    }
+
+    return face;
+  }
+
+ private:
+  uint32_t AdjFace(const uint32_t face, const int edge, int& rot) const {
+    const uint32_t data = adjFaces[face * 4 + edge];
+    rot = data >> ROTATION_SHIFT;
+    return data & FACE_MASK;
+  }
+
+  // rot anti-clockwise quarter turns into the neighbouring face's frame
+  void Rotate(int& x, int& y, const int rot) const {
+    const int px = x;
+    const int py = y;
+
+    switch (rot) {
+      case 1:
+        x = py;
+        y = (size - 1) - px;
+        break;
+      case 2:
+        x = (size - 1) - px;
+        y = (size - 1) - py;
+        break;
+      case 3:
+        x = (size - 1) - py;
+        y = px;
+        break;
+    }
+  }
+
+  const Span<const uint32_t> adjFaces;
+  const int size;
+};
+
+} // namespace
+
+AtlasPadding::Key AtlasPadding::MakeKey(
+    const std::string& atlasFile,
+    const MeshCache::Key& meshKey,
+    int tileSize) {
+  Key key;
+  key.atlasSize = std::filesystem::file_size(atlasFile);
+  key.atlasTime = std::filesystem::last_write_time(atlasFile).time_since_epoch().count();
+  key.meshKey = meshKey;
+  key.tileSize = tileSize;
+  return key;
+}
+
+size_t AtlasPadding::DataOffset() {
+  return sizeof(FileHeader);
+}
+
+bool AtlasPadding::IsCurrent(const std::string& paddedFile, const Key& key) {
+  std::ifstream file(paddedFile, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  FileHeader header;
+  if (!file.read((char*)&header, sizeof(header)))
+    return false;
+
+  const FileHeader expected = MakeHeader(key);
+  return memcmp(&header, &expected, sizeof(FileHeader)) == 0;
+}
+
+bool AtlasPadding::Build(
+    const std::string& atlasFile,
+    const std::string& paddedFile,
+    const Key& key,
+    const int dim,
+    const size_t texelBytes,
+    const Span<const uint32_t>& adjFaces) {
+  const int tileSize = key.tileSize;
+  const int paddedTileSize = tileSize + 2 * BORDER;
+  const int widthInTiles = dim / tileSize;
+  const int paddedDim = PaddedDim(dim, tileSize);
+  const int numFaces = adjFaces.size() / 4;
+
+  std::vector<uint8_t> atlas((size_t)dim * dim * texelBytes);
+  {
+    std::ifstream file(atlasFile, std::ios::binary);
+    if (!file.read((char*)atlas.data(), atlas.size()))
+      return false;
+  }
+
+  std::vector<uint8_t> padded((size_t)paddedDim * paddedDim * texelBytes, 0);
+  const AdjacencyWalker walker(adjFaces, tileSize);
+
+#pragma omp parallel for
+  for (int face = 0; face < numFaces; face++) {
+    const int dstX = (face % widthInTiles) * paddedTileSize + BORDER;
+    const int dstY = (face / widthInTiles) * paddedTileSize + BORDER;
+
+    for (int y = -BORDER; y < tileSize + BORDER; y++) {
+      for (int x = -BORDER; x < tileSize + BORDER; x++) {
+        // the texel texelFetchAtlasAdj would return, clamped to the tile edge
+        int px = x;
+        int py = y;
+        const uint32_t srcFace = walker.Walk(face, px, py);
+        px = std::min(std::max(px, 0), tileSize - 1);
+        py = std::min(std::max(py, 0), tileSize - 1);
+
+        const size_t srcX = (srcFace % widthInTiles) * tileSize + px;
+        const size_t srcY = (srcFace / widthInTiles) * tileSize + py;
+
+        memcpy(
+            &padded[((size_t)(dstY + y) * paddedDim + dstX + x) * texelBytes],
+            &atlas[(srcY * dim + srcX) * texelBytes],
+            texelBytes);
+      }
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path(paddedFile).parent_path(), error);
+
+  // write to a temporary file first, so concurrent runs never see a partial atlas
+  const std::string tmpFile = paddedFile + ".tmp" + std::to_string(std::random_device()());
+  {
+    const FileHeader header = MakeHeader(key);
+
+    std::ofstream file(tmpFile, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)padded.data(), padded.size());
+
+    if (!file) {
+      file.close();
+      std::filesystem::remove(tmpFile, error);
+      return false;
+    }
+  }
+
+  std::filesystem::rename(tmpFile, paddedFile, error);
+  if (error) {
+    std::filesystem::remove(tmpFile, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,340 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "AtlasResidency.h"
+#include "Assert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+// Reads a whole atlas file into dst, called on reader threads while dst is a mapped PBO
+bool ReadAtlasFile(
+    const std::string& filename,
+    const size_t offset,
+    void* dst,
+    const size_t numBytes) {
+  if (!dst)
+    return false;
+
+  std::ifstream file(filename, std::ios::binary);
+  file.seekg(offset);
+  file.read((char*)dst, numBytes);
+  return (size_t)file.gcount() == numBytes;
+}
+
+} // namespace
+
+AtlasResidency::AtlasResidency(
+    std::vector<AtlasFile> atlasFiles,
+    const size_t budgetBytes,
+    const int queueDepth)
+    : budgetBytes(budgetBytes > 0 ? budgetBytes : std::numeric_limits<size_t>::max()),
+      slots(std::max(queueDepth, 1)) {
+  atlases.resize(atlasFiles.size());
+  for (size_t i = 0; i < atlasFiles.size(); i++)
+    atlases[i].file = std::move(atlasFiles[i]);
+
+  // drawn while an atlas is on its way
+  const uint8_t grey[4] = {128, 128, 128, 255};
+  placeholder.Reinitialise(1, 1, GL_RGBA8, false, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)grey);
+}
+
+AtlasResidency::~AtlasResidency() {
+  // the reader threads write into mapped buffers, so wait for them before those are deleted
+  while (numLoading > 0)
+    FinishOldestLoad();
+}
+
+void AtlasResidency::LoadAll() {
+  for (size_t i = 0; i < atlases.size(); i++) {
+    if (atlases[i].state == State::Evicted)
+      StartLoad(i);
+  }
+
+  while (numLoading > 0)
+    FinishOldestLoad();
+}
+
+const pangolin::GlTexture& AtlasResidency::Acquire(size_t i, const bool wait) {
+  ASSERT(i < atlases.size());
+  Atlas& atlas = atlases[i];
+
+  atlas.lastUsed = ++tick;
+  atlas.lastUsedFrame = frame;
+
+  if (atlas.state == State::Resident) {
+    stats.hits++;
+    return atlas.texture;
+  }
+
+  stats.misses++;
+
+  if (atlas.state == State::Evicted) {
+    // the atlas is needed now, so it is loaded even if the budget cannot be met
+    MakeRoom(atlas.file.gpuBytes, false);
+    StartLoad(i);
+  }
+
+  if (wait) {
+    while (atlas.state == State::Loading)
+      FinishOldestLoad();
+  } else {
+    FinishCompletedLoads();
+  }
+
+  return atlas.state == State::Resident ? atlas.texture : placeholder;
+}
+
+GLuint64 AtlasResidency::AcquireHandle(size_t i, const bool wait) {
+  const pangolin::GlTexture& texture = Acquire(i, wait);
+  GLuint64& handle = &texture == &placeholder ? placeholderHandle : atlases[i].handle;
+
+  // the texture can no longer be respecified once it has a handle, evicting deletes it anyway
+  if (!handle) {
+    handle = glGetTextureHandleARB(texture.tid);
+    glMakeTextureHandleResidentARB(handle);
+  }
+
+  return handle;
+}
+
+void AtlasResidency::Prefetch(const std::vector<size_t>& upcoming) {
+  frame++;
+
+  for (size_t i : prefetchQueue)
+    atlases[i].upcoming = false;
+
+  prefetchQueue.clear();
+
+  // atlases beyond what fits the budget would only evict more urgent ones
+  size_t upcomingBytes = 0;
+  for (size_t i : upcoming) {
+    ASSERT(i < atlases.size());
+    if (atlases[i].upcoming)
+      continue;
+
+    upcomingBytes += atlases[i].file.gpuBytes;
+    if (upcomingBytes > budgetBytes)
+      break;
+
+    atlases[i].upcoming = true;
+    prefetchQueue.push_back(i);
+  }
+
+  Update();
+}
+
+void AtlasResidency::Update() {
+  FinishCompletedLoads();
+
+  // only start reads that do not have to wait for a free slot
+  while (!prefetchQueue.empty() && numLoading < slots.size()) {
+    const size_t i = prefetchQueue.front();
+
+    if (atlases[i].state == State::Evicted) {
+      if (!MakeRoom(atlases[i].file.gpuBytes, true))
+        break;
+
+      StartLoad(i);
+    }
+
+    prefetchQueue.pop_front();
+  }
+}
+
+bool AtlasResidency::MakeRoom(const size_t numBytes, const bool prefetch) {
+  while (residentBytes + loadingBytes + numBytes > budgetBytes) {
+    // least recently used resident atlas. Prefetching must not evict what it is about to need, or
+    // what the current frame has drawn.
+    size_t victim = atlases.size();
+    for (size_t i = 0; i < atlases.size(); i++) {
+      const Atlas& atlas = atlases[i];
+
+      if (atlas.state != State::Resident)
+        continue;
+
+      if (prefetch && (atlas.upcoming || atlas.lastUsedFrame == frame))
+        continue;
+
+      if (victim == atlases.size() || atlas.lastUsed < atlases[victim].lastUsed)
+        victim = i;
+    }
+
+    if (victim == atlases.size())
+      return false;
+
+    Evict(victim);
+  }
+
+  return true;
+}
+
+void AtlasResidency::Evict(size_t i) {
+  Atlas& atlas = atlases[i];
+
+  if (atlas.handle) {
+    glMakeTextureHandleNonResidentARB(atlas.handle);
+    atlas.handle = 0;
+  }
+
+  // pending draws keep using the texture storage until they are done
+  atlas.texture.Delete();
+  atlas.state = State::Evicted;
+
+  residentBytes -= atlas.file.gpuBytes;
+  stats.evictions++;
+}
+
+void AtlasResidency::StartLoad(size_t i) {
+  if (numLoading == slots.size())
+    FinishOldestLoad();
+
+  Atlas& atlas = atlases[i];
+  Slot& slot = slots[(firstSlot + numLoading) % slots.size()];
+
+  // re-specifying the storage orphans the previous contents, so this does not wait for the
+  // earlier upload from the same slot to finish
+  slot.pbo.Reinitialise(pangolin::GlPixelUnpackBuffer, atlas.file.numBytes, GL_STREAM_DRAW);
+  slot.pbo.Bind();
+  void* dst = glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER,
+      0,
+      atlas.file.numBytes,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  slot.pbo.Unbind();
+  CheckGlDieOnError();
+
+  slot.atlas = i;
+  slot.read = std::async(
+      std::launch::async,
+      ReadAtlasFile,
+      atlas.file.filename,
+      atlas.file.offset,
+      dst,
+      atlas.file.numBytes);
+
+  atlas.state = State::Loading;
+  loadingBytes += atlas.file.gpuBytes;
+  numLoading++;
+}
+
+void AtlasResidency::FinishOldestLoad() {
+  ASSERT(numLoading > 0);
+
+  Slot& slot = slots[firstSlot];
+  Atlas& atlas = atlases[slot.atlas];
+
+  const bool readOk = slot.read.get();
+
+  // allocate the storage before the PBO is bound, otherwise it would be filled from it
+  atlas.texture.Reinitialise(
+      atlas.file.dim,
+      atlas.file.dim,
+      atlas.file.internalFormat,
+      atlas.file.samplingLinear,
+      0,
+      atlas.file.compressed ? GL_RGBA : atlas.file.format,
+      atlas.file.compressed ? GL_UNSIGNED_BYTE : atlas.file.type);
+
+  slot.pbo.Bind();
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  ASSERT(readOk, "Failed reading " + atlas.file.filename);
+
+  // with the PBO bound the data pointers below are offsets into it
+  if (atlas.file.numLevels > 1) {
+    UploadLevels(atlas.texture, atlas.file);
+  } else if (atlas.file.compressed) {
+    atlas.texture.Bind();
+    glCompressedTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        atlas.file.dim,
+        atlas.file.dim,
+        atlas.file.internalFormat,
+        atlas.file.numBytes,
+        nullptr);
+  } else {
+    atlas.texture.Upload(nullptr, atlas.file.format, atlas.file.type);
+  }
+  CheckGlDieOnError();
+
+  slot.pbo.Unbind();
+
+  atlas.state = State::Resident;
+  loadingBytes -= atlas.file.gpuBytes;
+  residentBytes += atlas.file.gpuBytes;
+
+  stats.uploads++;
+  stats.uploadedBytes += atlas.file.numBytes;
+  stats.peakResidentBytes = std::max(stats.peakResidentBytes, residentBytes);
+
+  firstSlot = (firstSlot + 1) % slots.size();
+  numLoading--;
+}
+
+void AtlasResidency::UploadLevels(pangolin::GlTexture& texture, const AtlasFile& file) {
+  texture.Bind();
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file.numLevels - 1);
+
+  // coarse levels have rows of any length
+  GLint alignment = 4;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // level sizes in texels, or in 4x4 blocks when compressed
+  auto levelUnits = [&file](int level) -> size_t {
+    const size_t dim = file.dim >> level;
+    return file.compressed ? ((dim + 3) / 4) * ((dim + 3) / 4) : dim * dim;
+  };
+
+  size_t numUnits = 0;
+  for (int level = 0; level < file.numLevels; level++)
+    numUnits += levelUnits(level);
+  const size_t unitBytes = file.numBytes / numUnits;
+
+  // the level-0 storage already exists, the data pointers are offsets into the bound PBO
+  size_t offset = 0;
+  for (int level = 0; level < file.numLevels; level++) {
+    const GLsizei dim = file.dim >> level;
+    const size_t levelBytes = levelUnits(level) * unitBytes;
+
+    if (file.compressed) {
+      glCompressedTexImage2D(
+          GL_TEXTURE_2D,
+          level,
+          file.internalFormat,
+          dim,
+          dim,
+          0,
+          levelBytes,
+          (const GLvoid*)offset);
+    } else {
+      glTexImage2D(
+          GL_TEXTURE_2D,
+          level,
+          file.internalFormat,
+          dim,
+          dim,
+          0,
+          file.format,
+          file.type,
+          (const GLvoid*)offset);
+    }
+    offset += levelBytes;
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+  texture.Unbind();
+}
+
+void AtlasResidency::FinishCompletedLoads() {
+  while (numLoading > 0 &&
+         slots[firstSlot].read.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    FinishOldestLoad();
+}
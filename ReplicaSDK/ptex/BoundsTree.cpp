@@ -0,0 +1,113 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "BoundsTree.h"
+
+#include <algorithm>
+
+void BoundsTree::Build(const std::vector<Eigen::AlignedBox3f>& boxes) {
+  nodes.clear();
+  order.resize(boxes.size());
+  for (size_t i = 0; i < boxes.size(); i++)
+    order[i] = i;
+
+  if (!boxes.empty()) {
+    nodes.reserve(2 * boxes.size());
+    BuildNode(boxes, 0, boxes.size());
+  }
+
+  itemBounds.resize(boxes.size());
+  for (size_t i = 0; i < boxes.size(); i++)
+    itemBounds[i] = boxes[order[i]];
+}
+
+uint32_t BoundsTree::BuildNode(
+    const std::vector<Eigen::AlignedBox3f>& boxes,
+    const size_t begin,
+    const size_t end) {
+  const uint32_t index = nodes.size();
+  nodes.emplace_back();
+
+  Eigen::AlignedBox3f bounds;
+  Eigen::AlignedBox3f centers;
+  for (size_t i = begin; i < end; i++) {
+    bounds.extend(boxes[order[i]]);
+    if (!boxes[order[i]].isEmpty())
+      centers.extend(boxes[order[i]].center());
+  }
+  nodes[index].bounds = bounds;
+
+  if (end - begin <= MAX_LEAF_ITEMS || centers.isEmpty()) {
+    nodes[index].first = begin;
+    nodes[index].count = end - begin;
+    return index;
+  }
+
+  // split at the median along the axis the centres spread most on. Sub-meshes are spatial
+  // chunks of similar size, so this gives tight and balanced nodes.
+  int axis;
+  centers.sizes().maxCoeff(&axis);
+
+  const size_t middle = begin + (end - begin) / 2;
+  std::nth_element(
+      order.begin() + begin,
+      order.begin() + middle,
+      order.begin() + end,
+      [&](const uint32_t a, const uint32_t b) {
+        const float ca = boxes[a].isEmpty() ? 0.0f : boxes[a].center()(axis);
+        const float cb = boxes[b].isEmpty() ? 0.0f : boxes[b].center()(axis);
+        return ca < cb;
+      });
+
+  BuildNode(boxes, begin, middle);
+  const uint32_t right = BuildNode(boxes, middle, end);
+  nodes[index].first = right;
+  return index;
+}
+
+size_t BoundsTree::Query(const Frustum& frustum, std::vector<size_t>& items) const {
+  if (nodes.empty())
+    return 0;
+
+  const size_t firstItem = items.size();
+  size_t numTested = 0;
+
+  // nodes with the planes they still have to be tested against
+  std::vector<std::pair<uint32_t, unsigned>> stack;
+  stack.emplace_back(0, frustum.AllPlanes());
+
+  while (!stack.empty()) {
+    const uint32_t index = stack.back().first;
+    unsigned mask = stack.back().second;
+    stack.pop_back();
+
+    const Node& node = nodes[index];
+
+    if (mask != 0) {
+      numTested++;
+      if (frustum.Classify(node.bounds, mask) == Frustum::Overlap::Outside)
+        continue;
+    }
+
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        // empty items have nothing to draw
+        if (itemBounds[i].isEmpty())
+          continue;
+
+        unsigned itemMask = mask;
+        if (itemMask != 0) {
+          numTested++;
+          if (frustum.Classify(itemBounds[i], itemMask) == Frustum::Overlap::Outside)
+            continue;
+        }
+        items.push_back(order[i]);
+      }
+    } else {
+      stack.emplace_back(node.first, mask);
+      stack.emplace_back(index + 1, mask);
+    }
+  }
+
+  // draw in sub-mesh order, like without culling
+  std::sort(items.begin() + firstItem, items.end());
+  return numTested;
+}
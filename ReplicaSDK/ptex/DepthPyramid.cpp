@@ -0,0 +1,133 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "DepthPyramid.h"
+
+#include <algorithm>
+
+namespace {
+
+// must match local_size in depth-pyramid.comp
+constexpr GLuint GROUP_SIZE = 8;
+
+GLuint NumGroups(const GLsizei size) {
+  return (size + GROUP_SIZE - 1) / GROUP_SIZE;
+}
+
+} // namespace
+
+DepthPyramid::~DepthPyramid() {
+  glDeleteTextures(1, &depthCopy);
+  glDeleteTextures(1, &pyramid);
+}
+
+void DepthPyramid::Resize(const GLsizei width, const GLsizei height, const GLenum depthFormat) {
+  if (width == this->width && height == this->height && depthFormat == this->depthFormat)
+    return;
+
+  glDeleteTextures(1, &depthCopy);
+  glDeleteTextures(1, &pyramid);
+
+  this->width = width;
+  this->height = height;
+  this->depthFormat = depthFormat;
+
+  numLevels = 1;
+  while ((std::max(width, height) >> numLevels) > 0)
+    numLevels++;
+
+  // copies must go to the depth buffer's own format, which can be sampled but not written by
+  // compute shaders
+  glGenTextures(1, &depthCopy);
+  glBindTexture(GL_TEXTURE_2D, depthCopy);
+  glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+  glGenTextures(1, &pyramid);
+  glBindTexture(GL_TEXTURE_2D, pyramid);
+  glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_R32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool DepthPyramid::Capture(GLuint reduceProgram) {
+  GLint framebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+  if (framebuffer == 0)
+    return false;
+
+  GLint type = GL_NONE;
+  GLint name = 0;
+  glGetNamedFramebufferAttachmentParameteriv(
+      framebuffer, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+  glGetNamedFramebufferAttachmentParameteriv(
+      framebuffer, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+
+  GLint width = 0;
+  GLint height = 0;
+  GLint format = 0;
+  GLint samples = 0;
+  GLenum target;
+
+  if (type == GL_RENDERBUFFER) {
+    glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_WIDTH, &width);
+    glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_HEIGHT, &height);
+    glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_INTERNAL_FORMAT, &format);
+    glGetNamedRenderbufferParameteriv(name, GL_RENDERBUFFER_SAMPLES, &samples);
+    target = GL_RENDERBUFFER;
+  } else if (type == GL_TEXTURE) {
+    GLint level = 0;
+    glGetNamedFramebufferAttachmentParameteriv(
+        framebuffer, GL_DEPTH_ATTACHMENT, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &level);
+    if (level != 0)
+      return false;
+
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_SAMPLES, &samples);
+    target = GL_TEXTURE_2D;
+  } else {
+    return false;
+  }
+
+  if (samples > 0 || width <= 0 || height <= 0)
+    return false;
+
+  Resize(width, height, format);
+
+  glCopyImageSubData(
+      name, target, 0, 0, 0, 0, depthCopy, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+
+  glUseProgram(reduceProgram);
+  const GLint srcLevelLocation = glGetUniformLocation(reduceProgram, "srcLevel");
+
+  // level 0 converts the copied depth, every further level takes the maximum of the one above
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depthCopy);
+
+  for (GLint level = 0; level < numLevels; level++) {
+    const GLsizei levelWidth = std::max(width >> level, 1);
+    const GLsizei levelHeight = std::max(height >> level, 1);
+
+    glUniform1i(srcLevelLocation, level - 1);
+
+    if (level > 0)
+      glBindImageTexture(0, pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+    glDispatchCompute(NumGroups(levelWidth), NumGroups(levelHeight), 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+
+  // the pyramid is sampled next
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  return true;
+}
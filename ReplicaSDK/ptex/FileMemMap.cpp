@@ -8,6 +8,7 @@
 	#include <atlstr.h>
 	#include <algorithm>
 #elif __linux__
+	#include <cstdint>
 	#include <fcntl.h>
 	#include <sys/mman.h>
 	#include <unistd.h>
@@ -15,7 +16,7 @@
 
 #ifdef _WIN32
 
-char *FileMemMap::mapfile(const std::string &filename)
+char *FileMemMap::mapfile(const std::string &filename, bool populate)
 {
 	// 0)open file  // TODO support wchar
 	//TCHAR szName[512];
@@ -81,21 +82,72 @@ void FileMemMap::release()
 	}
 }
 
+// views are only read in when touched, and the system trims them as it needs
+void FileMemMap::adviseSequential()
+{
+}
+
+void FileMemMap::dropPages()
+{
+}
+
+void FileMemMap::dropPages(const void *begin, const void *end)
+{
+}
+
 #elif __linux__
 
-char *FileMemMap::mapfile(const std::string &filename)
+char *FileMemMap::mapfile(const std::string &filename, bool populate)
 {
 	this->fileSize = std::filesystem::file_size(filename);
 	int fd = open(filename.c_str(), O_RDONLY, 0);
-	this->mmappedData = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (fd < 0)
+	{
+		this->mmappedData = nullptr;
+		return nullptr;
+	}
+	const int flags = populate ? MAP_PRIVATE | MAP_POPULATE : MAP_PRIVATE;
+	this->mmappedData = mmap(NULL, fileSize, PROT_READ, flags, fd, 0);
 	// Parse each vertex packet and unpack
 	close(fd);
+	if (this->mmappedData == MAP_FAILED)
+	{
+		this->mmappedData = nullptr;
+		return nullptr;
+	}
 	return reinterpret_cast<char *>(mmappedData);
 }
 
+void FileMemMap::adviseSequential()
+{
+	if (mmappedData)
+		madvise(mmappedData, fileSize, MADV_SEQUENTIAL);
+}
+
+void FileMemMap::dropPages()
+{
+	// the mapping is read only, so its pages are clean and can be dropped
+	if (mmappedData)
+		madvise(mmappedData, fileSize, MADV_DONTNEED);
+}
+
+void FileMemMap::dropPages(const void *begin, const void *end)
+{
+	if (!mmappedData || end <= begin)
+		return;
+
+	// whole pages, the ones straddling the ends are read again if needed
+	const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	const uintptr_t first = (uintptr_t)begin & ~(pageSize - 1);
+	const uintptr_t last = ((uintptr_t)end + pageSize - 1) & ~(pageSize - 1);
+	madvise((void *)first, last - first, MADV_DONTNEED);
+}
+
 void FileMemMap::release()
 {
-	munmap(mmappedData, fileSize);
+	if (mmappedData)
+		munmap(mmappedData, fileSize);
+	mmappedData = nullptr;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "MeshBuffers.h"
+#include "Assert.h"
+
+#include <algorithm>
+#include <vector>
+
+MeshBuffers::Range MeshBuffers::Append(
+    const void* vertexData,
+    const size_t numVertices,
+    const GLenum vertexType,
+    const GLint vertexComponents,
+    const void* indexData,
+    const size_t numIndices,
+    const GLenum indexType,
+    const uint32_t* adjacencyData,
+    const size_t numAdjacency) {
+  if (this->vertexType == 0) {
+    this->vertexType = vertexType;
+    this->vertexComponents = vertexComponents;
+    vertexSize = vertexComponents * (vertexType == GL_SHORT ? sizeof(int16_t) : sizeof(float));
+  }
+
+  ASSERT(
+      this->vertexType == vertexType && this->vertexComponents == vertexComponents,
+      "Sub-meshes must share one vertex format");
+
+  if (this->indexType == GL_UNSIGNED_SHORT && indexType == GL_UNSIGNED_INT)
+    WidenIndices();
+
+  Range range;
+  range.baseVertex = vertices.size / vertexSize;
+  range.numVertices = numVertices;
+  range.firstIndex = indices.size / IndexSize();
+  range.numIndices = numIndices;
+  range.firstAdjacency = adjacency.size / sizeof(uint32_t);
+  range.numAdjacency = numAdjacency;
+
+  Append(vertices, pangolin::GlArrayBuffer, vertexData, numVertices * vertexSize);
+
+  if (this->indexType == indexType) {
+    Append(indices, pangolin::GlElementArrayBuffer, indexData, numIndices * IndexSize());
+  } else {
+    const uint16_t* narrow = (const uint16_t*)indexData;
+    const std::vector<uint32_t> wide(narrow, narrow + numIndices);
+    Append(indices, pangolin::GlElementArrayBuffer, wide.data(), numIndices * sizeof(uint32_t));
+  }
+
+  Append(adjacency, pangolin::GlShaderStorageBuffer, adjacencyData, numAdjacency * sizeof(uint32_t));
+
+  return range;
+}
+
+void MeshBuffers::Finish() {
+  if (vertices.size > 0)
+    Resize(vertices, pangolin::GlArrayBuffer, vertices.size);
+
+  if (indices.size > 0)
+    Resize(indices, pangolin::GlElementArrayBuffer, indices.size);
+
+  if (adjacency.size > 0)
+    Resize(adjacency, pangolin::GlShaderStorageBuffer, adjacency.size);
+}
+
+void MeshBuffers::Append(
+    Pool& pool,
+    const pangolin::GlBufferType type,
+    const void* data,
+    const size_t numBytes) {
+  if (numBytes == 0)
+    return;
+
+  // doubling keeps the number of copies logarithmic in the number of sub-meshes
+  const size_t capacity = pool.buffer.IsValid() ? pool.buffer.size_bytes : 0;
+  if (pool.size + numBytes > capacity)
+    Resize(pool, type, std::max(2 * capacity, pool.size + numBytes));
+
+  pool.buffer.Upload(data, numBytes, pool.size);
+  pool.size += numBytes;
+}
+
+void MeshBuffers::Resize(Pool& pool, const pangolin::GlBufferType type, const size_t capacity) {
+  pangolin::GlBufferData resized(type, capacity, GL_STATIC_DRAW);
+
+  // the contents are copied on the GPU, without a round trip through host memory
+  if (pool.size > 0) {
+    glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer.bo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resized.bo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  pool.buffer = std::move(resized);
+}
+
+void MeshBuffers::WidenIndices() {
+  std::vector<uint16_t> narrow(indices.size / sizeof(uint16_t));
+  if (!narrow.empty())
+    indices.buffer.Download(narrow.data(), indices.size);
+
+  const std::vector<uint32_t> wide(narrow.begin(), narrow.end());
+
+  indices = Pool();
+  indexType = GL_UNSIGNED_INT;
+
+  Append(indices, pangolin::GlElementArrayBuffer, wide.data(), wide.size() * sizeof(uint32_t));
+}
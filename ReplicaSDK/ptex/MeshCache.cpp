@@ -0,0 +1,247 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "MeshCache.h"
+#include "Assert.h"
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+namespace {
+constexpr char MAGIC[8] = {'P', 'T', 'E', 'X', 'M', 'S', 'H', '\0'};
+
+// all arrays in the cache start on this boundary so they can be uploaded straight from the map
+constexpr uint64_t ALIGNMENT = 16;
+
+// bytes hashed from each sampled block of the mesh file
+constexpr size_t HASH_BLOCK_BYTES = 64 * 1024;
+constexpr size_t HASH_NUM_BLOCKS = 5;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numSubMeshes;
+  uint64_t meshSize;
+  int64_t meshTime;
+  uint64_t meshHash;
+  float splitSize;
+  uint32_t vertexCacheOrder;
+  uint64_t tableOffset;
+};
+
+uint64_t HashBytes(const char* data, size_t numBytes, uint64_t hash) {
+  // 64-bit FNV-1a
+  for (size_t i = 0; i < numBytes; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+} // namespace
+
+struct MeshCache::Entry {
+  uint64_t vboOffset;
+  uint64_t numVertices;
+  uint64_t iboOffset;
+  uint64_t numIndices;
+  uint64_t aboOffset;
+  uint64_t numAdjacency;
+  uint64_t faceOrderOffset;
+  uint64_t numFaceOrder;
+};
+
+std::string MeshCache::CachePath(const std::string& cacheDir, const std::string& meshFile) {
+  const std::string stem = std::filesystem::path(meshFile).stem().string();
+  return (std::filesystem::path(cacheDir) / (stem + ".ptexcache")).string();
+}
+
+MeshCache::Key MeshCache::MakeKey(const std::string& meshFile, const float splitSize) {
+  Key key;
+  key.meshSize = std::filesystem::file_size(meshFile);
+  key.meshTime = std::filesystem::last_write_time(meshFile).time_since_epoch().count();
+  key.splitSize = splitSize;
+
+  // hash the start of the file (which holds the PLY header) and evenly spaced blocks up to the
+  // end, rather than the whole body, so that validating the cache stays cheap
+  std::ifstream file(meshFile, std::ios::binary);
+  std::vector<char> block(HASH_BLOCK_BYTES);
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < HASH_NUM_BLOCKS; i++) {
+    const uint64_t last = key.meshSize > HASH_BLOCK_BYTES ? key.meshSize - HASH_BLOCK_BYTES : 0;
+    const uint64_t offset = last * i / (HASH_NUM_BLOCKS - 1);
+
+    file.seekg(offset);
+    file.read(block.data(), block.size());
+    hash = HashBytes(block.data(), file.gcount(), hash);
+    file.clear();
+  }
+  key.meshHash = hash;
+
+  return key;
+}
+
+MeshCache::~MeshCache() {
+  Close();
+}
+
+bool MeshCache::Open(const std::string& cacheFile, const Key& key) {
+  Close();
+
+  if (!std::filesystem::exists(cacheFile))
+    return false;
+
+  const uint64_t fileSize = std::filesystem::file_size(cacheFile);
+
+  if (fileSize < sizeof(FileHeader))
+    return false;
+
+  data = fileMap.mapfile(cacheFile);
+
+  if (!data)
+    return false;
+
+  FileHeader header;
+  memcpy(&header, data, sizeof(FileHeader));
+
+  const bool valid = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+      header.version == VERSION && header.meshSize == key.meshSize &&
+      header.meshTime == key.meshTime && header.meshHash == key.meshHash &&
+      header.splitSize == key.splitSize &&
+      header.vertexCacheOrder == (uint32_t)key.vertexCacheOrder &&
+      header.tableOffset + header.numSubMeshes * sizeof(Entry) <= fileSize;
+
+  if (!valid) {
+    Close();
+    return false;
+  }
+
+  const Entry* entries = (const Entry*)&data[header.tableOffset];
+
+  subMeshes.resize(header.numSubMeshes);
+
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    const Entry& e = entries[i];
+
+    if (e.vboOffset + e.numVertices * 3 * sizeof(float) > fileSize ||
+        e.iboOffset + e.numIndices * sizeof(uint32_t) > fileSize ||
+        e.aboOffset + e.numAdjacency * sizeof(uint32_t) > fileSize ||
+        e.faceOrderOffset + e.numFaceOrder > fileSize) {
+      Close();
+      return false;
+    }
+
+    subMeshes[i].vbo = (const float*)&data[e.vboOffset];
+    subMeshes[i].numVertices = e.numVertices;
+    subMeshes[i].ibo = (const uint32_t*)&data[e.iboOffset];
+    subMeshes[i].numIndices = e.numIndices;
+    subMeshes[i].abo = (const uint32_t*)&data[e.aboOffset];
+    subMeshes[i].numAdjacency = e.numAdjacency;
+    subMeshes[i].faceOrder = (const uint8_t*)&data[e.faceOrderOffset];
+    subMeshes[i].numFaceOrder = e.numFaceOrder;
+  }
+
+  return true;
+}
+
+void MeshCache::Close() {
+  if (data) {
+    fileMap.release();
+    data = nullptr;
+  }
+  subMeshes.clear();
+}
+
+MeshCache::Writer::Writer(const std::string& cacheFile, const Key& key)
+    : cacheFile(cacheFile),
+      tmpFile(cacheFile + ".tmp" + std::to_string(std::random_device()())),
+      key(key),
+      file(tmpFile, std::ios::binary | std::ios::trunc) {
+  if (file.is_open()) {
+    // placeholder, rewritten by Finish()
+    const FileHeader header = {};
+    file.write((const char*)&header, sizeof(FileHeader));
+  }
+}
+
+MeshCache::Writer::~Writer() {
+  if (!finished) {
+    file.close();
+    std::error_code ec;
+    std::filesystem::remove(tmpFile, ec);
+  }
+}
+
+bool MeshCache::Writer::IsOpen() const {
+  return file.is_open() && file.good();
+}
+
+void MeshCache::Writer::WriteAligned(const void* data, size_t numBytes, uint64_t& offset) {
+  const uint64_t pos = file.tellp();
+  const uint64_t aligned = (pos + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  const char zeros[ALIGNMENT] = {};
+  file.write(zeros, aligned - pos);
+  file.write((const char*)data, numBytes);
+
+  offset = aligned;
+}
+
+void MeshCache::Writer::Append(
+    const float* vbo,
+    size_t numVertices,
+    const uint32_t* ibo,
+    size_t numIndices,
+    const uint32_t* abo,
+    size_t numAdjacency,
+    const uint8_t* faceOrder,
+    size_t numFaceOrder) {
+  if (!IsOpen())
+    return;
+
+  Entry e;
+  e.numVertices = numVertices;
+  e.numIndices = numIndices;
+  e.numAdjacency = numAdjacency;
+  e.numFaceOrder = numFaceOrder;
+
+  WriteAligned(vbo, numVertices * 3 * sizeof(float), e.vboOffset);
+  WriteAligned(ibo, numIndices * sizeof(uint32_t), e.iboOffset);
+  WriteAligned(abo, numAdjacency * sizeof(uint32_t), e.aboOffset);
+  WriteAligned(faceOrder, numFaceOrder, e.faceOrderOffset);
+
+  entries.push_back(e);
+}
+
+bool MeshCache::Writer::Finish() {
+  if (!IsOpen())
+    return false;
+
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.numSubMeshes = entries.size();
+  header.meshSize = key.meshSize;
+  header.meshTime = key.meshTime;
+  header.meshHash = key.meshHash;
+  header.splitSize = key.splitSize;
+  header.vertexCacheOrder = key.vertexCacheOrder;
+
+  WriteAligned(entries.data(), entries.size() * sizeof(Entry), header.tableOffset);
+
+  file.seekp(0);
+  file.write((const char*)&header, sizeof(FileHeader));
+  file.close();
+
+  if (file.fail())
+    return false;
+
+  // rename is atomic, so concurrent jobs on the same scene never see a partial cache
+  std::error_code ec;
+  std::filesystem::rename(tmpFile, cacheFile, ec);
+
+  if (ec)
+    return false;
+
+  finished = true;
+  return true;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "Meshlets.h"
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// cones this close to a half space are never culled
+constexpr float MIN_CONE_COS = 0.01f;
+
+// widens cones a little, so triangles rasterized from compacted positions still fall inside
+constexpr float CONE_SLACK = 1.0e-2f;
+
+} // namespace
+
+void BuildMeshlets(
+    const Span<const Eigen::Vector3f>& positions,
+    const Span<const uint32_t>& indices,
+    const size_t maxFaces,
+    const float padding,
+    std::vector<Meshlet>& meshlets) {
+  const size_t numFaces = indices.size() / 4;
+
+  std::vector<Eigen::Vector3f> normals;
+
+  for (size_t first = 0; first < numFaces; first += maxFaces) {
+    const size_t last = std::min(first + maxFaces, numFaces);
+
+    Meshlet meshlet;
+    meshlet.firstFace = first;
+    meshlet.numFaces = last - first;
+
+    // quads are rasterized as triangles (0, 1, 2) and (0, 2, 3)
+    Eigen::AlignedBox3f bounds;
+    Eigen::Vector3f normalSum = Eigen::Vector3f::Zero();
+    normals.clear();
+
+    for (size_t f = first; f < last; f++) {
+      const Eigen::Vector3f& p0 = positions[indices[f * 4 + 0]];
+      const Eigen::Vector3f& p1 = positions[indices[f * 4 + 1]];
+      const Eigen::Vector3f& p2 = positions[indices[f * 4 + 2]];
+      const Eigen::Vector3f& p3 = positions[indices[f * 4 + 3]];
+
+      bounds.extend(p0);
+      bounds.extend(p1);
+      bounds.extend(p2);
+      bounds.extend(p3);
+
+      // degenerate triangles produce no fragments
+      for (const Eigen::Vector3f& n : {(p1 - p0).cross(p2 - p0), (p2 - p0).cross(p3 - p0)}) {
+        const float length = n.norm();
+        if (length > 0.0f) {
+          normals.push_back(n / length);
+          normalSum += normals.back();
+        }
+      }
+    }
+
+    meshlet.center = bounds.center();
+    meshlet.radius = 0.0f;
+    for (size_t f = first; f < last; f++) {
+      for (int j = 0; j < 4; j++) {
+        meshlet.radius =
+            std::max(meshlet.radius, (positions[indices[f * 4 + j]] - meshlet.center).norm());
+      }
+    }
+    meshlet.radius += padding;
+
+    meshlet.coneAxis = Eigen::Vector3f::UnitZ();
+    meshlet.coneCutoff = 1.0f;
+
+    const float sumLength = normalSum.norm();
+    if (sumLength > 0.0f) {
+      meshlet.coneAxis = normalSum / sumLength;
+
+      float minCos = 1.0f;
+      for (const Eigen::Vector3f& n : normals)
+        minCos = std::min(minCos, n.dot(meshlet.coneAxis));
+
+      if (minCos > MIN_CONE_COS)
+        meshlet.coneCutoff = std::min(1.0f, std::sqrt(1.0f - minCos * minCos) + CONE_SLACK);
+    }
+
+    meshlets.push_back(meshlet);
+  }
+}
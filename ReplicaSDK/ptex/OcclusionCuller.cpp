@@ -0,0 +1,165 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "OcclusionCuller.h"
+#include "Assert.h"
+
+#include <algorithm>
+
+namespace {
+
+// must match local_size in occlusion-cull.comp
+constexpr GLuint GROUP_SIZE = 64;
+
+} // namespace
+
+OcclusionCuller::OcclusionCuller(const std::vector<Eigen::AlignedBox3f>& boxes)
+    : numSubMeshes(boxes.size()), drawnFirst(boxes.size(), 0) {
+  // vec4 pairs, empty boxes keep their inverted extents and are never visible
+  std::vector<float> data(boxes.size() * 8, 0.0f);
+  for (size_t i = 0; i < boxes.size(); i++) {
+    for (int j = 0; j < 3; j++) {
+      data[i * 8 + j] = boxes[i].min()(j);
+      data[i * 8 + 4 + j] = boxes[i].max()(j);
+    }
+  }
+
+  bounds.Reinitialise(
+      pangolin::GlShaderStorageBuffer,
+      std::max<size_t>(data.size(), 1) * sizeof(float),
+      GL_STATIC_DRAW,
+      data.data());
+
+  candidateBuffer.Reinitialise(
+      pangolin::GlShaderStorageBuffer,
+      std::max<size_t>(numSubMeshes, 1) * sizeof(uint32_t),
+      GL_STREAM_DRAW);
+  visibilityBuffer.Reinitialise(
+      pangolin::GlShaderStorageBuffer,
+      std::max<size_t>(numSubMeshes, 1) * sizeof(uint32_t),
+      GL_STREAM_READ);
+}
+
+void OcclusionCuller::AddPrograms(ShaderProgramCache& programCache, const std::string& shaderDir) {
+  programCache.Add(
+      reduceProgram, {{pangolin::GlSlComputeShader, shaderDir + "/depth-pyramid.comp"}}, {shaderDir});
+  programCache.Add(
+      cullProgram, {{pangolin::GlSlComputeShader, shaderDir + "/occlusion-cull.comp"}}, {shaderDir});
+}
+
+bool OcclusionCuller::CanCull() {
+  GLboolean depthWrite = GL_FALSE;
+  glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWrite);
+
+  GLint depthFunc = GL_LESS;
+  glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+
+  return glIsEnabled(GL_DEPTH_TEST) && depthWrite &&
+      (depthFunc == GL_LESS || depthFunc == GL_LEQUAL);
+}
+
+OcclusionCuller::View& OcclusionCuller::FindView(const Eigen::Matrix4d& mvp) {
+  View* nearest = nullptr;
+  double nearestDistance = 0.0;
+
+  for (View& view : views) {
+    const double distance = (view.mvp - mvp).norm();
+    if (!nearest || distance < nearestDistance) {
+      nearest = &view;
+      nearestDistance = distance;
+    }
+  }
+
+  if (!nearest || (nearestDistance > MAX_VIEW_DISTANCE && views.size() < MAX_VIEWS)) {
+    views.emplace_back();
+    views.back().visible.assign(numSubMeshes, 0);
+    nearest = &views.back();
+  } else if (nearestDistance > MAX_VIEW_DISTANCE) {
+    // replace the least recently used view
+    nearest = &*std::min_element(views.begin(), views.end(), [](const View& a, const View& b) {
+      return a.lastUsed < b.lastUsed;
+    });
+    std::fill(nearest->visible.begin(), nearest->visible.end(), 0);
+  }
+
+  nearest->mvp = mvp;
+  nearest->lastUsed = ++tick;
+  return *nearest;
+}
+
+std::vector<size_t> OcclusionCuller::Begin(
+    const pangolin::OpenGlMatrix& mvp,
+    const std::vector<size_t>& candidates) {
+  ASSERT(!view, "Occlusion culling pass already in progress");
+
+  this->mvp = mvp;
+  this->candidates = candidates;
+  view = &FindView(this->mvp);
+
+  std::vector<size_t> first;
+  for (const size_t i : candidates) {
+    if (view->visible[i]) {
+      first.push_back(i);
+      drawnFirst[i] = 1;
+    }
+  }
+
+  return first;
+}
+
+std::vector<size_t> OcclusionCuller::End() {
+  ASSERT(view, "No occlusion culling pass in progress");
+
+  std::vector<size_t> remaining;
+  for (const size_t i : candidates) {
+    if (!drawnFirst[i])
+      remaining.push_back(i);
+  }
+
+  std::vector<uint32_t> visible(candidates.size(), 1);
+
+  if (!candidates.empty() && depthPyramid.Capture(reduceProgram.ProgramId())) {
+    const std::vector<uint32_t> ids(candidates.begin(), candidates.end());
+    candidateBuffer.Upload(ids.data(), ids.size() * sizeof(uint32_t));
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // every candidate is tested, so those drawn first drop out of later views once hidden
+    cullProgram.Bind();
+    cullProgram.SetUniform("MVP", mvp);
+    cullProgram.SetUniform("viewport", viewport[0], viewport[1], viewport[2], viewport[3]);
+    cullProgram.SetUniform("numCandidates", (int)candidates.size());
+    cullProgram.SetUniform("numLevels", depthPyramid.NumLevels());
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid.Texture());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bounds.bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, candidateBuffer.bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, visibilityBuffer.bo);
+
+    glDispatchCompute((candidates.size() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    cullProgram.Unbind();
+
+    // waits for the test, the sub-meshes to draw must be known to stream in their atlases
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    visibilityBuffer.Download(visible.data(), visible.size() * sizeof(uint32_t));
+  }
+
+  std::vector<size_t> revealed;
+  for (size_t j = 0; j < candidates.size(); j++) {
+    const size_t i = candidates[j];
+    view->visible[i] = visible[j] != 0;
+
+    if (!drawnFirst[i] && visible[j])
+      revealed.push_back(i);
+
+    drawnFirst[i] = 0;
+  }
+
+  view = nullptr;
+  return revealed;
+}
@@ -2,6 +2,7 @@
 #include "PLYParser.h"
 #include "Assert.h"
 
+#include <algorithm>
 #include <filesystem>
 
 #ifdef __linux__
@@ -14,7 +15,7 @@
 #include <fstream>
 #include <set>
 
-void PLYParse(MeshData& meshData, const std::string& filename) {
+PLYFile::PLYFile(const std::string& filename, const bool streamed) {
   std::vector<std::string> comments;
   std::vector<std::string> objInfo;
 
@@ -23,16 +24,8 @@ void PLYParse(MeshData& meshData, const std::string& filename) {
 
   enum Properties { POSITION = 0, NORMAL, COLOR, NUM_PROPERTIES };
 
-  size_t numVertices = 0;
-
-  size_t positionDimensions = 0;
-  size_t normalDimensions = 0;
-  size_t colorDimensions = 0;
-
   std::vector<Properties> vertexLayout;
 
-  size_t numFaces = 0;
-
   std::ifstream file(filename, std::ios::binary);
 
   // Header parsing
@@ -183,29 +176,12 @@ void PLYParse(MeshData& meshData, const std::string& filename) {
     ASSERT(positionDimensions > 0);
   }
 
-  meshData.vbo.Reinitialise(numVertices, 1);
-  meshData.vbo.Fill(Eigen::Vector4f(0, 0, 0, 1));
-
-  if (normalDimensions) {
-    meshData.nbo.Reinitialise(numVertices, 1);
-    meshData.nbo.Fill(Eigen::Vector4f(0, 0, 0, 1));
-  }
-
-  if (colorDimensions) {
-    meshData.cbo.Reinitialise(numVertices, 1);
-    meshData.cbo.Fill(Eigen::Matrix<unsigned char, 4, 1>(0, 0, 0, 255));
-  }
-
   // Can only be FLOAT32 or UINT8
   const size_t positionBytes = positionDimensions * sizeof(float); // floats
   const size_t normalBytes = normalDimensions * sizeof(float); // floats
   const size_t colorBytes = colorDimensions * sizeof(uint8_t); // bytes
 
-  const size_t vertexPacketSizeBytes = positionBytes + normalBytes + colorBytes;
-
-  size_t positionOffsetBytes = 0;
-  size_t normalOffsetBytes = 0;
-  size_t colorOffsetBytes = 0;
+  vertexPacketSizeBytes = positionBytes + normalBytes + colorBytes;
 
   size_t offsetSoFarBytes = 0;
 
@@ -231,36 +207,27 @@ void PLYParse(MeshData& meshData, const std::string& filename) {
 
   const size_t fileSize = std::filesystem::file_size(filename);
 
-  FileMemMap filemap;
-  void* mmappedData = filemap.mapfile(filename);
- // Parse each vertex packet and unpack
-  char* bytes = &(((char*)mmappedData)[postHeader]);
+  const char* mmappedData = fileMap.mapfile(filename, !streamed);
+  ASSERT(mmappedData, "Can't map PLY file");
 
-  for (size_t i = 0; i < numVertices; i++) {
-    char* nextBytes = &bytes[vertexPacketSizeBytes * i];
+  if (streamed)
+    fileMap.adviseSequential();
 
-    memcpy(meshData.vbo[i].data(), &nextBytes[positionOffsetBytes], positionBytes);
-
-    if (normalDimensions)
-      memcpy(meshData.nbo[i].data(), &nextBytes[normalOffsetBytes], normalBytes);
-
-    if (colorDimensions)
-      memcpy(meshData.cbo[i].data(), &nextBytes[colorOffsetBytes], colorBytes);
-  }
+  vertexBytes = &mmappedData[postHeader];
 
   const size_t bytesSoFar = postHeader + vertexPacketSizeBytes * numVertices;
+  ASSERT(bytesSoFar <= fileSize, "PLY file is truncated");
 
-  bytes = &(((char*)mmappedData)[postHeader + vertexPacketSizeBytes * numVertices]);
+  faceBytes = &mmappedData[bytesSoFar];
 
-  if (numFaces > 0) {
+  if (numFaces > 0 && bytesSoFar < fileSize) {
     // Read first face to get number of indices;
-    const uint8_t faceDimensions = *bytes;
+    const uint8_t faceDimensions = *faceBytes;
 
     ASSERT(faceDimensions == 3 || faceDimensions == 4);
 
     const size_t countBytes = 1;
-    const size_t faceBytes = faceDimensions * sizeof(uint32_t); // uint32_t
-    const size_t facePacketSizeBytes = countBytes + faceBytes;
+    const size_t facePacketSizeBytes = countBytes + faceDimensions * sizeof(uint32_t);
 
     const size_t predictedFaces = (fileSize - bytesSoFar) / facePacketSizeBytes;
 
@@ -277,18 +244,134 @@ void PLYParse(MeshData& meshData, const std::string& filename) {
 
     numFaces = std::min(numFaces, predictedFaces);
 
-    meshData.ibo.Reinitialise(numFaces * faceDimensions, 1);
+    // Faces are only addressable in place if every packet has the same size. A streamed file is
+    // checked a block at a time, dropping each block's pages after it.
+    bool constantCount = true;
+
+    const size_t blockFaces = streamed
+        ? std::max<size_t>(STREAM_BLOCK_BYTES / facePacketSizeBytes, 1)
+        : std::max<size_t>(numFaces, 1);
 
-    for (size_t i = 0; i < numFaces; i++) {
-      char* nextBytes = &bytes[facePacketSizeBytes * i];
+    for (size_t block = 0; block < numFaces; block += blockFaces) {
+      const size_t blockEnd = std::min(numFaces, block + blockFaces);
 
-      memcpy(&meshData.ibo[i * faceDimensions], &nextBytes[countBytes], faceBytes);
+#pragma omp parallel for reduction(&& : constantCount)
+      for (size_t i = block; i < blockEnd; i++) {
+        constantCount =
+            constantCount && (uint8_t)faceBytes[facePacketSizeBytes * i] == faceDimensions;
+      }
+
+      if (streamed)
+        fileMap.dropPages(
+            &faceBytes[facePacketSizeBytes * block], &faceBytes[facePacketSizeBytes * blockEnd]);
     }
 
-    meshData.polygonStride = faceDimensions;
+    ASSERT(constantCount, "Can only parse meshes with a single polygon size");
+
+    polygonStride = faceDimensions;
   } else {
-    meshData.polygonStride = 0;
+    numFaces = 0;
+    polygonStride = 0;
   }
+}
+
+PLYFile::~PLYFile() {
+  fileMap.release();
+}
+
+void PLYFile::DropPages() {
+  fileMap.dropPages();
+}
+
+void PLYFile::DropPages(const void* begin, const void* end) {
+  fileMap.dropPages(begin, end);
+}
+
+StridedView<float> PLYFile::Positions() const {
+  return StridedView<float>(&vertexBytes[positionOffsetBytes], numVertices, vertexPacketSizeBytes);
+}
+
+StridedView<float> PLYFile::Normals() const {
+  return normalDimensions
+      ? StridedView<float>(&vertexBytes[normalOffsetBytes], numVertices, vertexPacketSizeBytes)
+      : StridedView<float>();
+}
+
+StridedView<uint8_t> PLYFile::Colors() const {
+  return colorDimensions
+      ? StridedView<uint8_t>(&vertexBytes[colorOffsetBytes], numVertices, vertexPacketSizeBytes)
+      : StridedView<uint8_t>();
+}
+
+StridedView<uint32_t> PLYFile::Faces() const {
+  const size_t countBytes = 1;
+  return StridedView<uint32_t>(
+      &faceBytes[countBytes], numFaces, countBytes + polygonStride * sizeof(uint32_t));
+}
+
+void PLYParse(
+    MeshData& meshData,
+    const PLYFile& file,
+    const bool parseFaces,
+    const unsigned attributes) {
+  const size_t numVertices = file.NumVertices();
+  const size_t numIndices = parseFaces ? file.NumFaces() * file.PolygonStride() : 0;
+
+  const StridedView<float> positions = file.Positions();
+  const StridedView<float> normals = file.Normals();
+  const StridedView<uint8_t> colors = file.Colors();
+
+  const size_t positionDimensions = std::min<size_t>(file.PositionDimensions(), 3);
+  const size_t normalDimensions =
+      attributes & MESH_NORMALS ? std::min<size_t>(file.NormalDimensions(), 3) : 0;
+  const size_t colorDimensions =
+      attributes & MESH_COLORS ? std::min<size_t>(file.ColorDimensions(), 4) : 0;
+
+  // Arrays are fully written below, so there is no separate Fill pass
+  meshData.Reinitialise(
+      numVertices,
+      numIndices,
+      (normalDimensions ? (unsigned)MESH_NORMALS : 0u) |
+          (colorDimensions ? (unsigned)MESH_COLORS : 0u),
+      file.PolygonStride());
+
+  const Span<Eigen::Vector3f> dstPositions = meshData.Positions();
+  const Span<Eigen::Vector3f> dstNormals = meshData.Normals();
+  const Span<MeshColor> dstColors = meshData.Colors();
+
+  // Parse each vertex packet and unpack
+#pragma omp parallel for
+  for (int i = 0; i < (int)numVertices; i++) {
+    Eigen::Vector3f p(0, 0, 0);
+    memcpy(p.data(), positions.Packet(i), positionDimensions * sizeof(float));
+    dstPositions[i] = p;
+
+    if (normalDimensions) {
+      Eigen::Vector3f n(0, 0, 0);
+      memcpy(n.data(), normals.Packet(i), normalDimensions * sizeof(float));
+      dstNormals[i] = n;
+    }
+
+    if (colorDimensions) {
+      MeshColor c(0, 0, 0, 255);
+      memcpy(c.data(), colors.Packet(i), colorDimensions * sizeof(uint8_t));
+      dstColors[i] = c;
+    }
+  }
+
+  if (numIndices > 0) {
+    const StridedView<uint32_t> faces = file.Faces();
+    const size_t faceBytes = file.PolygonStride() * sizeof(uint32_t);
+    uint32_t* dstIndices = meshData.Indices().data();
+
+#pragma omp parallel for
+    for (int i = 0; i < (int)faces.size(); i++) {
+      memcpy(&dstIndices[i * file.PolygonStride()], faces.Packet(i), faceBytes);
+    }
+  }
+}
 
-  filemap.release();
+void PLYParse(MeshData& meshData, const std::string& filename, const unsigned attributes) {
+  const PLYFile file(filename);
+  PLYParse(meshData, file, true, attributes);
 }
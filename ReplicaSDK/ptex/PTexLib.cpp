@@ -1,6 +1,9 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #include "PTexLib.h"
+#include "Frustum.h"
+#include "IntroSort.h"
 #include "PLYParser.h"
+#include "RadixSort.h"
 
 #include <pangolin/utils/file_utils.h>
 #include <pangolin/utils/picojson.h>
@@ -8,21 +11,25 @@
 
  #include <filesystem>
 
-#ifdef _WIN32
-  #include <iostream>
-  #include <sort_linux.hpp>
-#elif __linux__
+#ifdef __linux__
   #include <fcntl.h>
   #include <sys/mman.h>
   #include <unistd.h>
 #endif
 
 #include "FileMemMap.h"
+#include "GlExtensions.h"
 
+#include <chrono>
 #include <fstream>
-#include <unordered_map>
-
-PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder, const bool panoramic_enable) {
+#include <tuple>
+
+PTexMesh::PTexMesh(
+    const std::string& meshFile,
+    const std::string& atlasFolder,
+    const bool panoramic_enable,
+    const PTexMeshOptions& options)
+    : options(options) {
   // Check everything exists
   ASSERT(pangolin::FileExists(meshFile));
   ASSERT(pangolin::FileExists(atlasFolder));
@@ -42,9 +49,11 @@ PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder,
   splitSize = json["splitSize"].get<double>();
   tileSize = json["tileSize"].get<int64_t>();
 
-  LoadMeshData(meshFile);
+  const std::string cacheDir = options.meshCacheDir.empty() ? atlasFolder : options.meshCacheDir;
+
+  LoadMeshData(meshFile, cacheDir);
 
-  LoadAtlasData(atlasFolder);
+  LoadAtlasData(atlasFolder, meshFile, cacheDir);
   if (isHdr) {
     // set defaults for HDR scene
     exposure = 0.025f;
@@ -52,41 +61,185 @@ PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder,
     saturation = 1.5f;
   }
 
+  FinishMeshes();
+
   // Load shader
   const std::string shadir = STR(SHADER_DIR);
   ASSERT(pangolin::FileExists(shadir), "Shader directory not found!");
 
-  shader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-ptex.vert", {}, {shadir});
-  shader.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-ptex.geom", {}, {shadir});
-  shader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-ptex.frag", {}, {shadir});
-  shader.Link();
+  ShaderProgramCache programCache(
+      options.shaderCacheEnable ? options.shaderCacheDir : std::string());
+
+  // textured shaders either sample each sub-mesh's atlas through its handle or one bound atlas
+  std::vector<std::string> atlasDefines;
+  if (bindlessAtlases)
+    atlasDefines.push_back("BINDLESS_ATLAS");
+  if (atlasLevels > 1)
+    atlasDefines.push_back("ATLAS_MIPMAPS");
+  if (tileBorder > 0) {
+    atlasDefines.push_back("PADDED_TILES");
+    atlasDefines.push_back("TILE_BORDER " + std::to_string(tileBorder));
+  }
+  if (options.depthPrepassEnable)
+    atlasDefines.push_back("DEPTH_PREPASS");
+  if (options.vertexCacheOrderEnable)
+    atlasDefines.push_back("FACE_ORDER_WINDOW " + std::to_string(MESHLET_FACES));
+
+  // the perspective passes either expand quads in a geometry shader or pull their vertices
+  std::vector<std::string> quadDefines;
+  if (options.vertexPullingEnable) {
+    quadDefines.push_back("VERTEX_PULLING");
+    if (meshBuffers.VertexType() == GL_SHORT)
+      quadDefines.push_back("PULL_SHORT_POSITIONS");
+    if (meshBuffers.IndexType() == GL_UNSIGNED_SHORT)
+      quadDefines.push_back("PULL_SHORT_INDICES");
+  }
+
+  auto quadShaders = [&](const std::string& name) {
+    std::vector<ShaderProgramCache::ShaderFile> files = {
+        {pangolin::GlSlVertexShader, shadir + "/" + name + ".vert"},
+        {pangolin::GlSlFragmentShader, shadir + "/" + name + ".frag"}};
+    if (!options.vertexPullingEnable)
+      files.push_back({pangolin::GlSlGeometryShader, shadir + "/" + name + ".geom"});
+    return files;
+  };
+
+  std::vector<std::string> texturedQuadDefines = quadDefines;
+  texturedQuadDefines.insert(texturedQuadDefines.end(), atlasDefines.begin(), atlasDefines.end());
+
+  // Each pass picks the variant without the work its state makes dead. The depth prepass is a
+  // variant of the textured programs, so its vertex stages and depth match them exactly.
+  std::vector<ShaderPermutations::Switch> quadSwitches = {{CLIP_PLANE, "CLIP_PLANE"}};
+
+  // the depth prepass writes no colour or motion vectors, so neither changes its program
+  std::vector<ShaderPermutations::Switch> textureSwitches = {{TONE_MAPPING, "TONE_MAPPING"}};
+  if (options.depthPrepassEnable)
+    textureSwitches.push_back({DEPTH_ONLY, "DEPTH_ONLY", TONE_MAPPING | BACKWARD_MOTION});
+
+  std::vector<ShaderPermutations::Switch> texturedQuadSwitches = quadSwitches;
+  texturedQuadSwitches.insert(
+      texturedQuadSwitches.end(), textureSwitches.begin(), textureSwitches.end());
+
+  // the programs writing motion vectors can write the backward ones from the same rasterization
+  std::vector<ShaderPermutations::Switch> motionSwitches = quadSwitches;
+  std::vector<ShaderPermutations::Switch> combinedSwitches = texturedQuadSwitches;
+  if (options.bidirectionalFlowEnable) {
+    motionSwitches.push_back({BACKWARD_MOTION, "BACKWARD_MOTION"});
+    combinedSwitches.push_back({BACKWARD_MOTION, "BACKWARD_MOTION"});
+  }
+
+  shader.Add(
+      programCache, quadShaders("mesh-ptex"), {shadir}, texturedQuadDefines, texturedQuadSwitches);
+
+  // the textured programs writing the depth and motion vector outputs as well
+  std::vector<std::string> combinedDefines = {"COMBINED_OUTPUTS"};
+
+  if (options.combinedPassEnable) {
+    std::vector<std::string> combinedQuadDefines = texturedQuadDefines;
+    combinedQuadDefines.insert(
+        combinedQuadDefines.end(), combinedDefines.begin(), combinedDefines.end());
 
-  shaderPano.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano.vert", {}, {shadir});
-  shaderPano.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano.geom", {}, {shadir});
-  shaderPano.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano.frag", {}, {shadir});
-  shaderPano.Link();
+    combinedShader.Add(
+        programCache,
+        quadShaders("mesh-ptex"),
+        {shadir},
+        combinedQuadDefines,
+        combinedSwitches);
+  }
+
+  shaderPano.Add(
+      programCache,
+      {{pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano.vert"},
+       {pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano.geom"},
+       {pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano.frag"}},
+      {shadir},
+      atlasDefines,
+      textureSwitches);
+
+  depthShader.Add(
+      programCache,
+      {{pangolin::GlSlVertexShader, shadir + "/mesh-depth.vert"},
+       {pangolin::GlSlFragmentShader, shadir + "/mesh-depth.frag"}},
+      {shadir},
+      quadDefines,
+      quadSwitches);
+
+  depthPanoShader.Add(
+      programCache,
+      {{pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano-depth.vert"},
+       {pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano-depth.geom"},
+       {pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano-depth.frag"}},
+      {shadir},
+      {});
+
+  motionVectorShader.Add(
+      programCache, quadShaders("mesh-motionflow"), {shadir}, quadDefines, motionSwitches);
+
+  motionVectorPanoShader.Add(
+      programCache,
+      {{pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano-motionflow.vert"},
+       {pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano-motionflow.geom"},
+       {pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano-motionflow.frag"}},
+      {shadir},
+      {"WRAP_AROUND_METHOD " + std::string(options.panoFlowWrapAround ? "1" : "0")});
+
+  // the cube passes always expand quads in geometry shaders, one invocation per face
+  if (options.layeredCubemapEnable) {
+    auto cubeShaders = [&](const std::string& name) {
+      return std::vector<ShaderProgramCache::ShaderFile>{
+          {pangolin::GlSlVertexShader, shadir + "/" + name + ".vert"},
+          {pangolin::GlSlGeometryShader, shadir + "/" + name + ".geom"},
+          {pangolin::GlSlFragmentShader, shadir + "/" + name + ".frag"}};
+    };
+
+    std::vector<std::string> cubeDefines = {"CUBE_LAYERS"};
+    std::vector<std::string> texturedCubeDefines = cubeDefines;
+    texturedCubeDefines.insert(texturedCubeDefines.end(), atlasDefines.begin(), atlasDefines.end());
+
+    cubeShader.Add(
+        programCache,
+        cubeShaders("mesh-ptex"),
+        {shadir},
+        texturedCubeDefines,
+        texturedQuadSwitches);
+    cubeDepthShader.Add(
+        programCache, cubeShaders("mesh-depth"), {shadir}, cubeDefines, quadSwitches);
+    cubeMotionVectorShader.Add(
+        programCache, cubeShaders("mesh-motionflow"), {shadir}, cubeDefines, motionSwitches);
+
+    if (options.combinedPassEnable) {
+      std::vector<std::string> combinedCubeDefines = texturedCubeDefines;
+      combinedCubeDefines.insert(
+          combinedCubeDefines.end(), combinedDefines.begin(), combinedDefines.end());
+
+      cubeCombinedShader.Add(
+          programCache,
+          cubeShaders("mesh-ptex"),
+          {shadir},
+          combinedCubeDefines,
+          combinedSwitches);
+    }
+  }
 
-  depthShader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-depth.vert", {}, {shadir});
-  depthShader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-depth.frag", {}, {shadir});
-  depthShader.Link();
+  if (occlusionCuller)
+    occlusionCuller->AddPrograms(programCache, shadir);
 
-  depthPanoShader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano-depth.vert", {}, { shadir });
-  depthPanoShader.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano-depth.geom", {}, { shadir });
-  depthPanoShader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano-depth.frag", {}, { shadir });
-  depthPanoShader.Link();
+  programCache.Build();
 
-  motionVectorShader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-motionflow.vert", {}, {shadir});
-  motionVectorShader.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-motionflow.geom", {}, {shadir});
-  motionVectorShader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-motionflow.frag", {}, {shadir});
-  motionVectorShader.Link();
+  if (options.overdrawStatsEnable)
+    glGenQueries(1, &overdrawQuery);
 
-  motionVectorPanoShader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-ptex-pano-motionflow.vert", {}, {shadir});
-  motionVectorPanoShader.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-ptex-pano-motionflow.geom", {}, {shadir});
-  motionVectorPanoShader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-ptex-pano-motionflow.frag", {}, {shadir});
-  motionVectorPanoShader.Link();
+  if (options.gpuTimeStatsEnable)
+    glGenQueries(1, &gpuTimeQuery);
 }
 
-PTexMesh::~PTexMesh() {}
+PTexMesh::~PTexMesh() {
+  if (overdrawQuery)
+    glDeleteQueries(1, &overdrawQuery);
+
+  if (gpuTimeQuery)
+    glDeleteQueries(1, &gpuTimeQuery);
+}
 
 float PTexMesh::Exposure() const {
   return exposure;
@@ -112,84 +265,542 @@ void PTexMesh::SetSaturation(const float& val) {
   saturation = val;
 }
 
-void PTexMesh::RenderSubMesh(
-    size_t subMesh,
-    const pangolin::OpenGlRenderState& cam,
-    const Eigen::Vector4f& clipPlane) {
-  ASSERT(subMesh < meshes.size());
-  Mesh& mesh = *meshes[subMesh];
+namespace {
 
-  shader.Bind();
-  shader.SetUniform("MVP", cam.GetProjectionModelViewMatrix());
-  shader.SetUniform("tileSize", (int)tileSize);
-  shader.SetUniform("exposure", exposure);
-  shader.SetUniform("gamma", 1.0f / gamma);
-  shader.SetUniform("saturation", saturation);
-  shader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+void CopyMatrix(float* dst, const pangolin::OpenGlMatrix& m) {
+  for (int i = 0; i < 16; i++)
+    dst[i] = m.m[i];
+}
 
-  shader.SetUniform("widthInTiles", int(mesh.atlas.width / tileSize));
+// Bounds of what any face of a cube sees, each face's far plane closing one side of it
+Frustum CubeFrustum(const std::vector<pangolin::OpenGlRenderState>& cams) {
+  Frustum frustum;
+  for (const pangolin::OpenGlRenderState& cam : cams) {
+    const Eigen::Matrix4f m = Eigen::Matrix4d(cam.GetProjectionModelViewMatrix()).cast<float>();
+    frustum.AddPlane((m.row(3) - m.row(2)).transpose());
+  }
+  return frustum;
+}
 
-  glActiveTexture(GL_TEXTURE0);
-  mesh.atlas.Bind();
+} // namespace
 
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
+unsigned PTexMesh::Features() const {
+  unsigned features = 0;
 
-  mesh.vbo.Bind();
-  glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(0);
-  mesh.vbo.Unbind();
+  // the clip distance is never read with clipping disabled, even if a clip plane is set
+  if (glIsEnabled(GL_CLIP_DISTANCE0))
+    features |= CLIP_PLANE;
 
-  mesh.ibo.Bind();
-  // using GL_LINES_ADJACENCY here to send quads to geometry shader
-  glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-  mesh.ibo.Unbind();
+  if (exposure != 1.0f || gamma != 1.0f || saturation != 1.0f)
+    features |= TONE_MAPPING;
 
-  glDisableVertexAttribArray(0);
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  return features;
+}
+
+std::vector<size_t> PTexMesh::VisibleSubMeshes(const Frustum& frustum) {
+  std::vector<size_t> visible;
+  const size_t boxesTested = boundsTree.Query(frustum, visible);
 
-  glActiveTexture(GL_TEXTURE0);
-  mesh.atlas.Unbind();
+  lastCullStats.passes = 1;
+  lastCullStats.drawn = visible.size();
+  lastCullStats.culled = meshes.size() - visible.size();
+  lastCullStats.occluded = 0;
+  lastCullStats.boxesTested = boxesTested;
+  lastCullStats.meshletsDrawn = 0;
+  lastCullStats.meshletsCulled = 0;
 
-  shader.Unbind();
+  cullStats.passes++;
+  cullStats.drawn += lastCullStats.drawn;
+  cullStats.culled += lastCullStats.culled;
+  cullStats.boxesTested += boxesTested;
+
+  return visible;
 }
 
-void PTexMesh::RenderPanoSubMesh(
-    size_t subMesh,
-    const pangolin::OpenGlRenderState &cam)
-{
-  ASSERT(subMesh < meshes.size());
-  Mesh& mesh = *meshes[subMesh];
+PTexMesh::FrameUniforms PTexMesh::MakeFrame(
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane) const {
+  FrameUniforms frame = {};
+  CopyMatrix(frame.MV, cam.GetModelViewMatrix());
+  CopyMatrix(frame.MVP, cam.GetProjectionModelViewMatrix());
+  CopyMatrix(frame.MVNext, cam.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam.GetProjectionModelViewMatrix());
+  CopyMatrix(frame.MVPPrev, cam.GetProjectionModelViewMatrix());
+
+  for (int i = 0; i < 4; i++)
+    frame.clipPlane[i] = clipPlane(i);
+
+  frame.exposure = exposure;
+  frame.gamma = 1.0f / gamma;
+  frame.saturation = saturation;
+  frame.depthScale = 1.0f;
+  frame.tileSize = tileSize >> atlasBaseLevel;
+  return frame;
+}
 
-  shaderPano.Bind();
-  shaderPano.SetUniform("MV", cam.GetModelViewMatrix());
-  shaderPano.SetUniform("tileSize", (int)tileSize);
-  shaderPano.SetUniform("exposure", exposure);
-  shaderPano.SetUniform("gamma", 1.0f / gamma);
-  shaderPano.SetUniform("saturation", saturation);
-  shaderPano.SetUniform("widthInTiles", int(mesh.atlas.width / tileSize));
+void PTexMesh::BindGeometry(const GLenum mode) {
+  if (mode == GL_TRIANGLES) {
+    // the vertex shader fetches positions itself, the vertex IDs of a draw index faces
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, meshBuffers.Vertices().bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, meshBuffers.Indices().bo);
+  } else {
+    // 16-bit positions are fractions of the bounds' half extent
+    glBindBuffer(GL_ARRAY_BUFFER, meshBuffers.Vertices().bo);
+    glVertexAttribPointer(
+        0,
+        meshBuffers.VertexComponents(),
+        meshBuffers.VertexType(),
+        meshBuffers.VertexType() == GL_SHORT ? GL_TRUE : GL_FALSE,
+        0,
+        0);
+    glEnableVertexAttribArray(0);
+  }
 
-  glActiveTexture(GL_TEXTURE0);
-  mesh.atlas.Bind();
+  glBindBuffer(GL_ARRAY_BUFFER, meshletInstances.bo);
+  glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 2 * sizeof(uint32_t), 0);
+  glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 2 * sizeof(uint32_t), (const GLvoid*)sizeof(uint32_t));
+  glVertexAttribDivisor(1, 1);
+  glVertexAttribDivisor(2, 1);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffers.Indices().bo);
+
+  glBindBufferBase(GL_UNIFORM_BUFFER, 0, frameUniforms.bo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, meshBuffers.Adjacency().bo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, subMeshData.bo);
+  if (bindlessAtlases)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, atlasHandles.bo);
+  if (options.vertexCacheOrderEnable)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, faceOrderData.bo);
+}
 
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
+void PTexMesh::UnbindGeometry(const GLenum mode) {
+  if (mode == GL_TRIANGLES) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+  } else {
+    glDisableVertexAttribArray(0);
+  }
 
-  mesh.vbo.Bind();
-  glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(0);
-  mesh.vbo.Unbind();
+  glDisableVertexAttribArray(1);
+  glDisableVertexAttribArray(2);
+  glVertexAttribDivisor(1, 0);
+  glVertexAttribDivisor(2, 0);
 
-  mesh.ibo.Bind();
-  // using GL_LINES_ADJACENCY here to send quads to geometry shader
-  glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-  mesh.ibo.Unbind();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-  glDisableVertexAttribArray(0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+  if (bindlessAtlases)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+  if (options.vertexCacheOrderEnable)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+}
+
+void PTexMesh::DrawSubMeshes(
+    const size_t* subMeshes,
+    const size_t count,
+    const GLenum mode,
+    const MeshletCuller* meshletCuller) {
+  const bool pulled = mode == GL_TRIANGLES;
+
+  // the base instance is the first meshlet drawn, through which the shaders find the sub-mesh and
+  // the face the draw starts at
+  commands.clear();
+  arrayCommands.clear();
+
+  auto addRun = [&](const Mesh& mesh, size_t firstFace, size_t numFaces, size_t meshlet) {
+    if (pulled) {
+      arrayCommands.push_back(
+          {(GLuint)(numFaces * 6), 1, (GLuint)(firstFace * 6), (GLuint)meshlet});
+    } else {
+      commands.push_back(
+          {(GLuint)(numFaces * 4),
+           1,
+           (GLuint)(mesh.range.firstIndex + firstFace * 4),
+           mesh.range.baseVertex,
+           (GLuint)meshlet});
+    }
+  };
+
+  auto extendRun = [&](size_t numFaces) {
+    if (pulled)
+      arrayCommands.back().count += numFaces * 6;
+    else
+      commands.back().count += numFaces * 4;
+  };
+
+  for (size_t i = 0; i < count; i++) {
+    const Mesh& mesh = *meshes[subMeshes[i]];
+
+    if (!meshletCuller) {
+      addRun(mesh, 0, mesh.range.numIndices / 4, mesh.firstMeshlet);
+      continue;
+    }
+
+    // runs of consecutive visible meshlets are drawn together
+    bool inRun = false;
+    for (size_t m = mesh.firstMeshlet; m < mesh.firstMeshlet + mesh.numMeshlets; m++) {
+      const Meshlet& meshlet = meshlets[m];
+
+      if (!meshletCuller->IsVisible(meshlet)) {
+        lastCullStats.meshletsCulled++;
+        inRun = false;
+        continue;
+      }
+
+      lastCullStats.meshletsDrawn++;
+
+      if (inRun) {
+        extendRun(meshlet.numFaces);
+      } else {
+        addRun(mesh, meshlet.firstFace, meshlet.numFaces, m);
+        inRun = true;
+      }
+    }
+  }
+
+  const size_t numCommands = pulled ? arrayCommands.size() : commands.size();
+  if (numCommands == 0)
+    return;
+
+  if (options.multiDrawEnable) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommands.bo);
+
+    if (pulled) {
+      indirectCommands.Upload(
+          arrayCommands.data(), numCommands * sizeof(DrawArraysIndirectCommand));
+      glMultiDrawArraysIndirect(mode, 0, numCommands, 0);
+    } else {
+      indirectCommands.Upload(commands.data(), numCommands * sizeof(DrawElementsIndirectCommand));
+      glMultiDrawElementsIndirect(mode, meshBuffers.IndexType(), 0, numCommands, 0);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return;
+  }
+
+  for (const DrawArraysIndirectCommand& command : arrayCommands) {
+    glDrawArraysInstancedBaseInstance(
+        mode, command.first, command.count, 1, command.baseInstance);
+  }
+
+  for (const DrawElementsIndirectCommand& command : commands) {
+    glDrawElementsInstancedBaseVertexBaseInstance(
+        mode,
+        command.count,
+        meshBuffers.IndexType(),
+        (const GLvoid*)(command.firstIndex * meshBuffers.IndexSize()),
+        1,
+        command.baseVertex,
+        command.baseInstance);
+  }
+}
+
+std::unique_ptr<MeshletCuller> PTexMesh::MakeMeshletCuller(
+    const FrameUniforms& frame,
+    const Frustum& frustum,
+    const GLenum mode) const {
+  if (!options.meshletCullingEnable)
+    return nullptr;
+
+  const Eigen::Matrix4f mv = Eigen::Map<const Eigen::Matrix4f>(frame.MV);
+  const Eigen::Matrix4f mvpf = Eigen::Map<const Eigen::Matrix4f>(frame.MVP);
+  const Eigen::Matrix4f mvInverse = mv.inverse();
+  const Eigen::Matrix4f projection = mvpf * mvInverse;
+
+  // orthographic views have no eye point, faces are only tested against the frustum then
+  bool cullFacingEye = false;
+  bool cullFacingAway = false;
+
+  if (glIsEnabled(GL_CULL_FACE) && std::abs(projection(3, 3)) < 1.0e-6f) {
+    GLint cullFace = GL_BACK;
+    GLint frontFace = GL_CCW;
+    glGetIntegerv(GL_CULL_FACE_MODE, &cullFace);
+    glGetIntegerv(GL_FRONT_FACE, &frontFace);
+
+    // quads facing the eye, right handed in index order, appear counter-clockwise unless the
+    // projection mirrors them. The geometry shaders and vertex pulling emit triangles of reversed
+    // winding, only GL_QUADS keeps it.
+    const bool facingEyeIsCCW = (mvpf.determinant() < 0.0f) != (mode != GL_QUADS);
+    const bool facingEyeIsFront = facingEyeIsCCW == (frontFace == GL_CCW);
+
+    cullFacingEye =
+        cullFace == GL_FRONT_AND_BACK || (cullFace == GL_FRONT) == facingEyeIsFront;
+    cullFacingAway =
+        cullFace == GL_FRONT_AND_BACK || (cullFace == GL_FRONT) != facingEyeIsFront;
+  }
+
+  return std::unique_ptr<MeshletCuller>(new MeshletCuller(
+      frustum, mvInverse.block<3, 1>(0, 3), cullFacingEye, cullFacingAway));
+}
+
+void PTexMesh::RenderVisibleSubMeshes(
+    ShaderProgramCache::Program& program,
+    const FrameUniforms& frame,
+    const pangolin::OpenGlMatrix& mvp,
+    const Eigen::Vector4f& clipPlane,
+    const GLenum mode,
+    const bool textured,
+    ShaderProgramCache::Program* prepass) {
+  Frustum frustum(mvp);
+  frustum.AddPlane(clipPlane);
+
+  std::vector<size_t> inView = VisibleSubMeshes(frustum);
+  SortFrontToBack(frame, inView);
+
+  // reads the face culling state the caller set up for this pass
+  const std::unique_ptr<MeshletCuller> meshletCuller = MakeMeshletCuller(frame, frustum, mode);
+
+  auto draw = [&](const std::vector<size_t>& subMeshes) {
+    if (textured)
+      RenderTextured(program, frame, subMeshes, mode, meshletCuller.get(), prepass != nullptr);
+    else
+      RenderSubMeshes(program, frame, subMeshes, mode, false, meshletCuller.get());
+  };
+
+  if (!occlusionCuller || !OcclusionCuller::CanCull()) {
+    if (prepass)
+      RenderPrepass(*prepass, frame, inView, mode, meshletCuller.get());
+    draw(inView);
+  } else {
+    // the occlusion test only needs the depth of the sub-meshes drawn first, so with a prepass
+    // nothing is shaded until all depth is drawn
+    const std::vector<size_t> first = occlusionCuller->Begin(mvp, inView);
+    if (prepass)
+      RenderPrepass(*prepass, frame, first, mode, meshletCuller.get());
+    else
+      draw(first);
+
+    const std::vector<size_t> revealed = occlusionCuller->End();
+    if (prepass) {
+      RenderPrepass(*prepass, frame, revealed, mode, meshletCuller.get());
+      draw(first);
+    }
+    draw(revealed);
+
+    const size_t occluded = inView.size() - first.size() - revealed.size();
+    lastCullStats.drawn -= occluded;
+    lastCullStats.occluded = occluded;
+    cullStats.drawn -= occluded;
+    cullStats.occluded += occluded;
+  }
+
+  cullStats.meshletsDrawn += lastCullStats.meshletsDrawn;
+  cullStats.meshletsCulled += lastCullStats.meshletsCulled;
+}
+
+void PTexMesh::SortFrontToBack(const FrameUniforms& frame, std::vector<size_t>& subMeshes) const {
+  if (!options.frontToBackEnable)
+    return;
+
+  const Eigen::Matrix4f mv = Eigen::Map<const Eigen::Matrix4f>(frame.MV);
+  const Eigen::Vector3f eye = mv.inverse().block<3, 1>(0, 3);
+
+  // the eye is inside the bounds of the sub-meshes around it, their centers break the tie
+  std::vector<std::tuple<float, float, size_t>> order(subMeshes.size());
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    const Eigen::AlignedBox3f& bounds = meshes[subMeshes[i]]->bounds;
+    order[i] = std::make_tuple(
+        bounds.squaredExteriorDistance(eye), (bounds.center() - eye).squaredNorm(), subMeshes[i]);
+  }
+
+  std::sort(order.begin(), order.end());
+
+  for (size_t i = 0; i < subMeshes.size(); i++)
+    subMeshes[i] = std::get<2>(order[i]);
+}
+
+void PTexMesh::RenderPrepass(
+    ShaderProgramCache::Program& prepass,
+    const FrameUniforms& frame,
+    const std::vector<size_t>& subMeshes,
+    const GLenum mode,
+    const MeshletCuller* meshletCuller) {
+  // the textured pass counts the same meshlets again
+  const CullStats counted = lastCullStats;
+
+  glPushAttrib(GL_COLOR_BUFFER_BIT);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  RenderSubMeshes(prepass, frame, subMeshes, mode, false, meshletCuller);
+
+  glPopAttrib();
+
+  lastCullStats = counted;
+}
+
+void PTexMesh::RenderTextured(
+    ShaderProgramCache::Program& program,
+    const FrameUniforms& frame,
+    const std::vector<size_t>& subMeshes,
+    const GLenum mode,
+    const MeshletCuller* meshletCuller,
+    const bool afterPrepass) {
+  if (subMeshes.empty())
+    return;
+
+  glPushAttrib(GL_DEPTH_BUFFER_BIT);
+  if (afterPrepass) {
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+
+  // samples passing the depth test when drawn, including those drawn over later. Fragments the
+  // test rejects only after shading them aren't counted.
+  if (overdrawQuery)
+    glBeginQuery(GL_SAMPLES_PASSED, overdrawQuery);
+
+  RenderSubMeshes(program, frame, subMeshes, mode, true, meshletCuller);
+
+  if (overdrawQuery) {
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    GLuint64 samplesPassed = 0;
+    glGetQueryObjectui64v(overdrawQuery, GL_QUERY_RESULT, &samplesPassed);
+    overdrawStats.samplesPassed += samplesPassed;
+  }
+
+  glPopAttrib();
+}
+
+void PTexMesh::CountOverdrawPass(const int layers) {
+  if (!overdrawQuery)
+    return;
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  overdrawStats.passes++;
+  overdrawStats.pixels += (size_t)viewport[2] * viewport[3] * layers;
+}
+
+PTexMesh::CubeUniforms PTexMesh::MakeCube(
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const std::vector<pangolin::OpenGlRenderState>& camsNext,
+    const std::vector<pangolin::OpenGlRenderState>& camsPrev) {
+  ASSERT(
+      cams.size() == CUBE_FACES && camsNext.size() == CUBE_FACES &&
+      camsPrev.size() == CUBE_FACES);
+
+  CubeUniforms cube = {};
+  for (int i = 0; i < CUBE_FACES; i++) {
+    CopyMatrix(cube.MV[i], cams[i].GetModelViewMatrix());
+    CopyMatrix(cube.MVP[i], cams[i].GetProjectionModelViewMatrix());
+    CopyMatrix(cube.MVNext[i], camsNext[i].GetModelViewMatrix());
+    CopyMatrix(cube.MVPNext[i], camsNext[i].GetProjectionModelViewMatrix());
+    CopyMatrix(cube.MVPPrev[i], camsPrev[i].GetProjectionModelViewMatrix());
+  }
+  return cube;
+}
+
+void PTexMesh::RenderCubeFaces(
+    ShaderProgramCache::Program& program,
+    const FrameUniforms& frame,
+    const CubeUniforms& cube,
+    const Frustum& frustum,
+    const bool textured,
+    ShaderProgramCache::Program* prepass) {
+  std::vector<size_t> inView = VisibleSubMeshes(frustum);
+  SortFrontToBack(frame, inView);
+
+  // the faces share the eye, so the meshlets facing away from it face away in all of them
+  const std::unique_ptr<MeshletCuller> meshletCuller =
+      MakeMeshletCuller(frame, frustum, GL_LINES_ADJACENCY);
+
+  cubeUniforms.Upload(&cube, sizeof(cube));
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, cubeUniforms.bo);
+
+  if (textured) {
+    if (prepass)
+      RenderPrepass(*prepass, frame, inView, GL_LINES_ADJACENCY, meshletCuller.get());
+    RenderTextured(
+        program, frame, inView, GL_LINES_ADJACENCY, meshletCuller.get(), prepass != nullptr);
+  } else {
+    RenderSubMeshes(program, frame, inView, GL_LINES_ADJACENCY, false, meshletCuller.get());
+  }
+
+  glBindBufferBase(GL_UNIFORM_BUFFER, 1, 0);
+
+  cullStats.meshletsDrawn += lastCullStats.meshletsDrawn;
+  cullStats.meshletsCulled += lastCullStats.meshletsCulled;
+}
+
+void PTexMesh::RenderSubMeshes(
+    ShaderProgramCache::Program& program,
+    const FrameUniforms& frame,
+    const std::vector<size_t>& subMeshes,
+    const GLenum mode,
+    const bool textured,
+    const MeshletCuller* meshletCuller) {
+  if (subMeshes.empty())
+    return;
+
+  frameUniforms.Upload(&frame, sizeof(frame));
+
+  if (gpuTimeQuery)
+    glBeginQuery(GL_TIME_ELAPSED, gpuTimeQuery);
+
+  program.Bind();
+  BindGeometry(mode);
+
+  if (!textured || bindlessAtlases) {
+    DrawSubMeshes(subMeshes.data(), subMeshes.size(), mode, meshletCuller);
+  } else {
+    // each sub-mesh samples its own atlas, which can only be swapped between draws
+    glActiveTexture(GL_TEXTURE0);
+
+    for (const size_t i : subMeshes) {
+      atlases->Acquire(i, options.atlasWaitForUpload).Bind();
+      DrawSubMeshes(&i, 1, mode, meshletCuller);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  UnbindGeometry(mode);
+  program.Unbind();
 
-  glActiveTexture(GL_TEXTURE0);
-  mesh.atlas.Unbind();
+  if (gpuTimeQuery) {
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(gpuTimeQuery, GL_QUERY_RESULT, &nanoseconds);
+    gpuTimeStats.batches++;
+    gpuTimeStats.nanoseconds += nanoseconds;
+  }
+}
+
+void PTexMesh::RenderSubMesh(
+    size_t subMesh,
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane) {
+  ASSERT(subMesh < meshes.size());
+
+  // using GL_LINES_ADJACENCY here to send quads to geometry shader
+  RenderSubMeshes(
+      shader.Get(Features()),
+      MakeFrame(cam, clipPlane),
+      {subMesh},
+      QuadMode(GL_LINES_ADJACENCY),
+      true);
+}
+
+void PTexMesh::RenderPanoSubMesh(
+    size_t subMesh,
+    const pangolin::OpenGlRenderState &cam)
+{
+  ASSERT(subMesh < meshes.size());
 
-  shaderPano.Unbind();
+  RenderSubMeshes(
+      shaderPano.Get(Features()),
+      MakeFrame(cam, Eigen::Vector4f::Zero()),
+      {subMesh},
+      GL_LINES_ADJACENCY,
+      true);
 }
 
 // render depth
@@ -199,31 +810,20 @@ void PTexMesh::RenderSubMeshDepth(
     const float depthScale,
     const Eigen::Vector4f& clipPlane) {
   ASSERT(subMesh < meshes.size());
-  Mesh& mesh = *meshes[subMesh];
+
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  frame.depthScale = depthScale;
+
+  const GLenum mode = QuadMode(GL_QUADS);
 
   glPushAttrib(GL_POLYGON_BIT);
   int currFrontFace;
   glGetIntegerv(GL_FRONT_FACE, &currFrontFace);
   //Drawing the faces has the opposite winding order to the GL_LINES_ADJACENCY
-  glFrontFace(currFrontFace == GL_CW ? GL_CCW : GL_CW);
+  if (mode == GL_QUADS)
+    glFrontFace(currFrontFace == GL_CW ? GL_CCW : GL_CW);
 
-  depthShader.Bind();
-  depthShader.SetUniform("MVP", cam.GetProjectionModelViewMatrix());  
-  depthShader.SetUniform("MV", cam.GetModelViewMatrix());
-  depthShader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
-  depthShader.SetUniform("scale", depthScale);
-
-  mesh.vbo.Bind();
-  glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(0);
-  mesh.vbo.Unbind();
-
-  mesh.ibo.Bind();
-  glDrawElements(GL_QUADS, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-  mesh.ibo.Unbind();
-  glDisableVertexAttribArray(0);
-
-  depthShader.Unbind();
+  RenderSubMeshes(depthShader.Get(Features()), frame, {subMesh}, mode, false);
 
   glPopAttrib();
 }
@@ -234,36 +834,12 @@ void PTexMesh::RenderPanoSubMeshDepth(
     const float depthScale,
     const Eigen::Vector4f& clipPlane)
 {
-    ASSERT(subMesh < meshes.size());
-    Mesh& mesh = *meshes[subMesh];
-
-    depthPanoShader.Bind();
-    depthPanoShader.SetUniform("MV", cam.GetModelViewMatrix());
-    depthPanoShader.SetUniform("tileSize", (int)tileSize);
-    depthPanoShader.SetUniform("exposure", exposure);
-    depthPanoShader.SetUniform("gamma", 1.0f / gamma);
-    depthPanoShader.SetUniform("saturation", saturation);
-    depthPanoShader.SetUniform("widthInTiles", int(mesh.atlas.width / tileSize));
-
-    glActiveTexture(GL_TEXTURE0);
-    mesh.atlas.Bind();
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
-
-    mesh.vbo.Bind();
-    glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
-    mesh.vbo.Unbind();
+  ASSERT(subMesh < meshes.size());
 
-    mesh.ibo.Bind();
-    // using GL_LINES_ADJACENCY here to send quads to geometry shader
-    glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-    mesh.ibo.Unbind();
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  frame.depthScale = depthScale;
 
-    glDisableVertexAttribArray(0);
-    
-    mesh.atlas.Unbind();
-    depthPanoShader.Unbind();
+  RenderSubMeshes(depthPanoShader.Get(Features()), frame, {subMesh}, GL_LINES_ADJACENCY, false);
 }
 
 void PTexMesh::RenderSubMeshMotionVector(
@@ -273,37 +849,20 @@ void PTexMesh::RenderSubMeshMotionVector(
     const int image_width,
     const int image_height,
     const Eigen::Vector4f& clipPlane) {
+  ASSERT(subMesh < meshes.size());
 
-    ASSERT(subMesh < meshes.size());
-    Mesh& mesh = *meshes[subMesh];
-
-  // int currFrontFace;
-  // glGetIntegerv(GL_FRONT_FACE, &currFrontFace);
-  // //Drawing the faces has the opposite winding order to the GL_LINES_ADJACENCY
-  // glFrontFace(currFrontFace == GL_CW ? GL_CCW : GL_CW);
-  // glPushAttrib(GL_POLYGON_BIT);
-
-    motionVectorShader.Bind();
-
-    motionVectorShader.SetUniform("MVP_current", cam_currnet.GetProjectionModelViewMatrix());
-    motionVectorShader.SetUniform("MVP_next", cam_next.GetProjectionModelViewMatrix());
-    motionVectorShader.SetUniform("window_size",(float)image_width, (float)image_height);
-    motionVectorShader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
-    mesh.vbo.Bind();
-    glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
-    mesh.vbo.Unbind();
-
-    mesh.ibo.Bind();
-    // using GL_LINES_ADJACENCY here to send quads to geometry shader
-    glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-    mesh.ibo.Unbind();
-
-    glDisableVertexAttribArray(0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-    motionVectorShader.Unbind();
+  FrameUniforms frame = MakeFrame(cam_currnet, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  RenderSubMeshes(
+      motionVectorShader.Get(Features()),
+      frame,
+      {subMesh},
+      QuadMode(GL_LINES_ADJACENCY),
+      false);
 }
 
 void PTexMesh::RenderSubMeshPanoMotionVector(
@@ -314,54 +873,93 @@ void PTexMesh::RenderSubMeshPanoMotionVector(
     const int image_height,
     const Eigen::Vector4f& clipPlane)
     {
-      ASSERT(subMesh < meshes.size());
-      Mesh& mesh = *meshes[subMesh];
-
-      motionVectorPanoShader.Bind();
-      motionVectorPanoShader.SetUniform("MV_current", cam_currnet.GetModelViewMatrix());
-      motionVectorPanoShader.SetUniform("MV_next", cam_next.GetModelViewMatrix());
-      motionVectorPanoShader.SetUniform("window_size",(float)image_width, (float)image_height);
-
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
-      mesh.vbo.Bind();
-      glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-      glEnableVertexAttribArray(0);
-      mesh.vbo.Unbind();
-
-      mesh.ibo.Bind();
-      // using GL_LINES_ADJACENCY here to send quads to geometry shader
-      glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-      mesh.ibo.Unbind();
-
-      glDisableVertexAttribArray(0);
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
-      motionVectorPanoShader.Unbind();
-    }
+  ASSERT(subMesh < meshes.size());
+
+  FrameUniforms frame = MakeFrame(cam_currnet, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  RenderSubMeshes(
+      motionVectorPanoShader.Get(Features()), frame, {subMesh}, GL_LINES_ADJACENCY, false);
+}
 
 void PTexMesh::Render(const pangolin::OpenGlRenderState& cam, const Eigen::Vector4f& clipPlane) {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMesh(i, cam, clipPlane);
-  }
+  const unsigned features = Features();
+
+  CountOverdrawPass();
+
+  // skipping sub-meshes outside the view also keeps their atlases from being requested. The
+  // panoramic passes see all around and do not clip, so they draw everything.
+  RenderVisibleSubMeshes(
+      shader.Get(features),
+      MakeFrame(cam, clipPlane),
+      cam.GetProjectionModelViewMatrix(),
+      clipPlane,
+      QuadMode(GL_LINES_ADJACENCY),
+      true,
+      options.depthPrepassEnable ? &shader.Get(features | DEPTH_ONLY) : nullptr);
 }
 
 
 void PTexMesh::RenderPano(const pangolin::OpenGlRenderState& cam) {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderPanoSubMesh(i, cam);
+  const FrameUniforms frame = MakeFrame(cam, Eigen::Vector4f::Zero());
+
+  std::vector<size_t> subMeshes = allSubMeshes;
+  SortFrontToBack(frame, subMeshes);
+
+  const unsigned features = Features();
+
+  CountOverdrawPass();
+
+  if (options.depthPrepassEnable) {
+    RenderPrepass(
+        shaderPano.Get(features | DEPTH_ONLY), frame, subMeshes, GL_LINES_ADJACENCY, nullptr);
   }
+
+  RenderTextured(
+      shaderPano.Get(features),
+      frame,
+      subMeshes,
+      GL_LINES_ADJACENCY,
+      nullptr,
+      options.depthPrepassEnable);
 }
 
 void PTexMesh::RenderDepth(const pangolin::OpenGlRenderState& cam, const float depthScale, const Eigen::Vector4f& clipPlane) {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMeshDepth(i, cam, depthScale, clipPlane);
-  }
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  frame.depthScale = depthScale;
+
+  const GLenum mode = QuadMode(GL_QUADS);
+
+  glPushAttrib(GL_POLYGON_BIT);
+  int currFrontFace;
+  glGetIntegerv(GL_FRONT_FACE, &currFrontFace);
+  //Drawing the faces has the opposite winding order to the GL_LINES_ADJACENCY
+  if (mode == GL_QUADS)
+    glFrontFace(currFrontFace == GL_CW ? GL_CCW : GL_CW);
+
+  RenderVisibleSubMeshes(
+      depthShader.Get(Features()),
+      frame,
+      cam.GetProjectionModelViewMatrix(),
+      clipPlane,
+      mode,
+      false);
+
+  glPopAttrib();
 }
 
 void PTexMesh::RenderPanoDepth(const pangolin::OpenGlRenderState& cam, const float depthScale , const Eigen::Vector4f& clipPlane)
 {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderPanoSubMeshDepth(i, cam, depthScale, clipPlane);
-  }
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  frame.depthScale = depthScale;
+
+  std::vector<size_t> subMeshes = allSubMeshes;
+  SortFrontToBack(frame, subMeshes);
+
+  RenderSubMeshes(depthPanoShader.Get(Features()), frame, subMeshes, GL_LINES_ADJACENCY, false);
 }
 
 void PTexMesh::RenderMotionVector(const pangolin::OpenGlRenderState& cam_currnet, 
@@ -369,9 +967,20 @@ void PTexMesh::RenderMotionVector(const pangolin::OpenGlRenderState& cam_currnet
     const int image_width,
     const int image_height,
     const Eigen::Vector4f& clipPlane) {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMeshMotionVector(i, cam_currnet, cam_next, image_width, image_height, clipPlane);
-  }
+  FrameUniforms frame = MakeFrame(cam_currnet, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  // flow is only written where the current view sees the mesh
+  RenderVisibleSubMeshes(
+      motionVectorShader.Get(Features()),
+      frame,
+      cam_currnet.GetProjectionModelViewMatrix(),
+      clipPlane,
+      QuadMode(GL_LINES_ADJACENCY),
+      false);
 }
 
 void PTexMesh::RenderPanoMotionVector(const pangolin::OpenGlRenderState& cam_currnet, 
@@ -379,9 +988,180 @@ void PTexMesh::RenderPanoMotionVector(const pangolin::OpenGlRenderState& cam_cur
     const int image_width,
     const int image_height,
     const Eigen::Vector4f& clipPlane) {
-  for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMeshPanoMotionVector(i, cam_currnet, cam_next, image_width, image_height, clipPlane);
-  }
+  FrameUniforms frame = MakeFrame(cam_currnet, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  std::vector<size_t> subMeshes = allSubMeshes;
+  SortFrontToBack(frame, subMeshes);
+
+  RenderSubMeshes(
+      motionVectorPanoShader.Get(Features()), frame, subMeshes, GL_LINES_ADJACENCY, false);
+}
+
+void PTexMesh::RenderCube(const std::vector<pangolin::OpenGlRenderState>& cams) {
+  ASSERT(options.layeredCubemapEnable, "RenderCube needs layeredCubemapEnable");
+
+  const unsigned features = Features();
+
+  CountOverdrawPass(CUBE_FACES);
+
+  RenderCubeFaces(
+      cubeShader.Get(features),
+      MakeFrame(cams[0], Eigen::Vector4f::Zero()),
+      MakeCube(cams, cams, cams),
+      CubeFrustum(cams),
+      true,
+      options.depthPrepassEnable ? &cubeShader.Get(features | DEPTH_ONLY) : nullptr);
+}
+
+void PTexMesh::RenderCubeDepth(
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const float depthScale) {
+  ASSERT(options.layeredCubemapEnable, "RenderCubeDepth needs layeredCubemapEnable");
+
+  FrameUniforms frame = MakeFrame(cams[0], Eigen::Vector4f::Zero());
+  frame.depthScale = depthScale;
+
+  // unlike GL_QUADS in RenderDepth, the geometry shader keeps the winding of the other passes
+  RenderCubeFaces(
+      cubeDepthShader.Get(Features()), frame, MakeCube(cams, cams, cams), CubeFrustum(cams), false);
+}
+
+void PTexMesh::RenderCubeMotionVector(
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const std::vector<pangolin::OpenGlRenderState>& camsNext,
+    const int image_width,
+    const int image_height) {
+  ASSERT(options.layeredCubemapEnable, "RenderCubeMotionVector needs layeredCubemapEnable");
+
+  FrameUniforms frame = MakeFrame(cams[0], Eigen::Vector4f::Zero());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  // flow is only written where the current views see the mesh
+  RenderCubeFaces(
+      cubeMotionVectorShader.Get(Features()),
+      frame,
+      MakeCube(cams, camsNext, cams),
+      CubeFrustum(cams),
+      false);
+}
+
+void PTexMesh::RenderMotionVectors(
+    const pangolin::OpenGlRenderState& cam_prev,
+    const pangolin::OpenGlRenderState& cam,
+    const pangolin::OpenGlRenderState& cam_next,
+    const int image_width,
+    const int image_height,
+    const Eigen::Vector4f& clipPlane) {
+  ASSERT(options.bidirectionalFlowEnable, "RenderMotionVectors needs bidirectionalFlowEnable");
+
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  CopyMatrix(frame.MVPPrev, cam_prev.GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  // both directions are only written where this view sees the mesh, as the backward pass of
+  // RenderMotionVector from the next frame would
+  RenderVisibleSubMeshes(
+      motionVectorShader.Get(Features() | BACKWARD_MOTION),
+      frame,
+      cam.GetProjectionModelViewMatrix(),
+      clipPlane,
+      QuadMode(GL_LINES_ADJACENCY),
+      false);
+}
+
+void PTexMesh::RenderCubeMotionVectors(
+    const std::vector<pangolin::OpenGlRenderState>& camsPrev,
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const std::vector<pangolin::OpenGlRenderState>& camsNext,
+    const int image_width,
+    const int image_height) {
+  ASSERT(
+      options.bidirectionalFlowEnable && options.layeredCubemapEnable,
+      "RenderCubeMotionVectors needs bidirectionalFlowEnable and layeredCubemapEnable");
+
+  FrameUniforms frame = MakeFrame(cams[0], Eigen::Vector4f::Zero());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+
+  RenderCubeFaces(
+      cubeMotionVectorShader.Get(Features() | BACKWARD_MOTION),
+      frame,
+      MakeCube(cams, camsNext, camsPrev),
+      CubeFrustum(cams),
+      false);
+}
+
+void PTexMesh::RenderCombined(
+    const pangolin::OpenGlRenderState& cam,
+    const pangolin::OpenGlRenderState& cam_next,
+    const int image_width,
+    const int image_height,
+    const float depthScale,
+    const Eigen::Vector4f& clipPlane,
+    const pangolin::OpenGlRenderState* cam_prev) {
+  ASSERT(options.combinedPassEnable, "RenderCombined needs combinedPassEnable");
+  ASSERT(!cam_prev || options.bidirectionalFlowEnable, "cam_prev needs bidirectionalFlowEnable");
+
+  FrameUniforms frame = MakeFrame(cam, clipPlane);
+  CopyMatrix(frame.MVNext, cam_next.GetModelViewMatrix());
+  CopyMatrix(frame.MVPNext, cam_next.GetProjectionModelViewMatrix());
+  if (cam_prev)
+    CopyMatrix(frame.MVPPrev, cam_prev->GetProjectionModelViewMatrix());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+  frame.depthScale = depthScale;
+
+  const unsigned features = Features() | (cam_prev ? (unsigned)BACKWARD_MOTION : 0u);
+
+  CountOverdrawPass();
+
+  // the depth and motion vectors are drawn through the quads of Render, keeping its winding
+  RenderVisibleSubMeshes(
+      combinedShader.Get(features),
+      frame,
+      cam.GetProjectionModelViewMatrix(),
+      clipPlane,
+      QuadMode(GL_LINES_ADJACENCY),
+      true,
+      options.depthPrepassEnable ? &combinedShader.Get(features | DEPTH_ONLY) : nullptr);
+}
+
+void PTexMesh::RenderCubeCombined(
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const std::vector<pangolin::OpenGlRenderState>& camsNext,
+    const int image_width,
+    const int image_height,
+    const float depthScale,
+    const std::vector<pangolin::OpenGlRenderState>* camsPrev) {
+  ASSERT(
+      options.combinedPassEnable && options.layeredCubemapEnable,
+      "RenderCubeCombined needs combinedPassEnable and layeredCubemapEnable");
+  ASSERT(!camsPrev || options.bidirectionalFlowEnable, "camsPrev needs bidirectionalFlowEnable");
+
+  FrameUniforms frame = MakeFrame(cams[0], Eigen::Vector4f::Zero());
+  frame.windowSize[0] = image_width;
+  frame.windowSize[1] = image_height;
+  frame.depthScale = depthScale;
+
+  const unsigned features = Features() | (camsPrev ? (unsigned)BACKWARD_MOTION : 0u);
+
+  CountOverdrawPass(CUBE_FACES);
+
+  RenderCubeFaces(
+      cubeCombinedShader.Get(features),
+      frame,
+      MakeCube(cams, camsNext, camsPrev ? *camsPrev : cams),
+      CubeFrustum(cams),
+      true,
+      options.depthPrepassEnable ? &cubeCombinedShader.Get(features | DEPTH_ONLY) : nullptr);
 }
 
 void PTexMesh::RenderWireframe(
@@ -409,20 +1189,36 @@ void PTexMesh::RenderWireframe(
   glPushAttrib(GL_POLYGON_BIT);
   glFrontFace(GL_CCW);
 
-  for (size_t i = 0; i < meshes.size(); i++) {
-    meshes[i]->vbo.Bind();
-    glVertexPointer(meshes[i]->vbo.count_per_element, meshes[i]->vbo.datatype, 0, 0);
-    glEnableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, meshBuffers.Vertices().bo);
+  glVertexPointer(meshBuffers.VertexComponents(), meshBuffers.VertexType(), 0, 0);
+  glEnableClientState(GL_VERTEX_ARRAY);
 
-    meshes[i]->ibo.Bind();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffers.Indices().bo);
 
-    glDrawElements(GL_QUADS, meshes[i]->ibo.num_elements, meshes[i]->ibo.datatype, 0);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const MeshBuffers::Range& range = meshes[i]->range;
+
+    // quantized positions carry w = 32767, so scaling the homogeneous coordinates dequantizes them
+    glPushMatrix();
+    glTranslatef(
+        meshes[i]->positionOffset(0), meshes[i]->positionOffset(1), meshes[i]->positionOffset(2));
+    glScalef(
+        meshes[i]->positionScale(0), meshes[i]->positionScale(1), meshes[i]->positionScale(2));
+
+    glDrawElementsBaseVertex(
+        GL_QUADS,
+        range.numIndices,
+        meshBuffers.IndexType(),
+        (const GLvoid*)(range.firstIndex * meshBuffers.IndexSize()),
+        range.baseVertex);
+
+    glPopMatrix();
+  }
 
-    meshes[i]->ibo.Unbind();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    meshes[i]->vbo.Unbind();
-  }
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
   glPopAttrib();
 
@@ -435,10 +1231,85 @@ void PTexMesh::RenderWireframe(
   glPopAttrib();
 }
 
-std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float splitSize) {
-  std::vector<uint32_t> verts;
-  verts.resize(mesh.vbo.size());
+namespace {
+
+// Position of vertex i, positions hold x, y, z per packet
+Eigen::Vector3f Position(const StridedView<float>& positions, size_t i) {
+  return Eigen::Vector3f(positions(i, 0), positions(i, 1), positions(i, 2));
+}
+
+// Numbers the vertices referenced by one chunk at a time, in order of first reference
+class VertexRemap {
+ public:
+  // With numVertices > 0 dense tables over all vertices are used. A vertex's remap entry is only
+  // valid while its stamp holds the current chunk, so nothing needs clearing between chunks.
+  // Otherwise a hash table sized for each chunk keeps memory proportional to the chunk.
+  explicit VertexRemap(size_t numVertices)
+      : stamp(numVertices, std::numeric_limits<uint32_t>::max()), remap(numVertices) {}
+
+  void Begin(uint32_t chunk, size_t maxVertices) {
+    currentChunk = chunk;
+    numRefdVerts = 0;
+
+    if (stamp.empty()) {
+      int bits = 1;
+      while ((size_t(1) << bits) < 2 * maxVertices)
+        bits++;
+
+      hashShift = 64 - bits;
+      keys.assign(size_t(1) << bits, EMPTY);
+      values.resize(keys.size());
+    }
+  }
+
+  uint32_t operator()(uint32_t vertIndex) {
+    if (!stamp.empty()) {
+      if (stamp[vertIndex] != currentChunk) {
+        // vertex not seen in this chunk yet, add
+        stamp[vertIndex] = currentChunk;
+        remap[vertIndex] = numRefdVerts++;
+      }
+      return remap[vertIndex];
+    }
+
+    const size_t mask = keys.size() - 1;
+    size_t slot = (vertIndex * 0x9E3779B97F4A7C15ull) >> hashShift;
+
+    while (keys[slot] != EMPTY && keys[slot] != vertIndex)
+      slot = (slot + 1) & mask;
+
+    if (keys[slot] == EMPTY) {
+      keys[slot] = vertIndex;
+      values[slot] = numRefdVerts++;
+    }
+    return values[slot];
+  }
+
+  uint32_t NumRefdVerts() const {
+    return numRefdVerts;
+  }
+
+ private:
+  static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
 
+  std::vector<uint32_t> stamp;
+  std::vector<uint32_t> remap;
+
+  std::vector<uint32_t> keys;
+  std::vector<uint32_t> values;
+  int hashShift = 0;
+
+  uint32_t currentChunk = 0;
+  uint32_t numRefdVerts = 0;
+};
+
+} // namespace
+
+PTexMesh::ChunkLayout PTexMesh::LayoutChunks(
+    const StridedView<float>& positions,
+    const StridedView<uint32_t>& quads,
+    const float splitSize,
+    PLYFile* streamedFile) {
   auto Part1By2 = [](uint64_t x) {
     x &= 0x1fffff; // mask off lower 21 bits
     x = (x | (x << 32)) & 0x1f00000000ffff;
@@ -453,418 +1324,1087 @@ std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float spli
     return (Part1By2(v(2)) << 2) + (Part1By2(v(1)) << 1) + Part1By2(v(0));
   };
 
+  // a streamed file is read in blocks of packets, each dropped once all threads are done with it
+  auto blockPackets = [streamedFile](size_t stride) {
+    return streamedFile ? std::max<size_t>(PLYFile::STREAM_BLOCK_BYTES / stride, 1)
+                        : std::numeric_limits<size_t>::max();
+  };
+
+  auto dropBlock = [streamedFile](const void* begin, const void* last, size_t stride) {
+    if (streamedFile)
+      streamedFile->DropPages(begin, (const char*)last + stride);
+  };
+
+  const size_t numVertices = positions.size();
+  const size_t vertexBlock = blockPackets(positions.Stride());
+
   Eigen::AlignedBox3f boundingBox;
 
-  for (size_t i = 0; i < mesh.vbo.Area(); i++) {
-    boundingBox.extend(mesh.vbo[i].head<3>());
+#pragma omp parallel
+  {
+    Eigen::AlignedBox3f threadBoundingBox;
+
+    for (size_t block = 0; block < numVertices; block += vertexBlock) {
+      const size_t blockEnd = std::min(numVertices, block + vertexBlock);
+
+#pragma omp for
+      for (size_t i = block; i < blockEnd; i++) {
+        threadBoundingBox.extend(Position(positions, i));
+      }
+
+#pragma omp single
+      dropBlock(positions.Packet(block), positions.Packet(blockEnd - 1), positions.Stride());
+    }
+
+    // min/max is order independent, so the reduction is deterministic
+#pragma omp critical
+    boundingBox.extend(threadBoundingBox);
   }
 
-// calculate vertex grid position and code
+  std::vector<uint32_t> verts;
+  verts.resize(numVertices);
+
+  // calculate vertex grid position and code
+  for (size_t block = 0; block < numVertices; block += vertexBlock) {
+    const size_t blockEnd = std::min(numVertices, block + vertexBlock);
+
 #pragma omp parallel for
-  for (int i = 0; i < mesh.vbo.size(); i++) {
-    const Eigen::Vector3f p = mesh.vbo[i].head<3>();
-    Eigen::Vector3f pi = (p - boundingBox.min()) / splitSize;
-    verts[i] = EncodeMorton3(pi.cast<int>());
+    for (size_t i = block; i < blockEnd; i++) {
+      const Eigen::Vector3f p = Position(positions, i);
+      Eigen::Vector3f pi = (p - boundingBox.min()) / splitSize;
+      verts[i] = EncodeMorton3(pi.cast<int>());
+    }
+
+    dropBlock(positions.Packet(block), positions.Packet(blockEnd - 1), positions.Stride());
   }
 
-  // data structure for sorting faces
+  // compact per-face sort key, the face's vertices are looked up again after sorting
   struct SortFace {
-    uint32_t index[4];
     uint32_t code;
-    size_t originalFace;
+    uint32_t originalFace;
   };
 
   // fill per-face data structures (including codes)
-  size_t numFaces = mesh.ibo.size() / 4;
+  size_t numFaces = quads.size();
   std::vector<SortFace> faces;
   faces.resize(numFaces);
 
+  const size_t faceBlock = blockPackets(quads.Stride());
+
+  for (size_t block = 0; block < numFaces; block += faceBlock) {
+    const size_t blockEnd = std::min(numFaces, block + faceBlock);
+
 #pragma omp parallel for
-  for (int i = 0; i < numFaces; i++) {
-    faces[i].originalFace = i;
-    faces[i].code = std::numeric_limits<uint32_t>::max();
-    for (int j = 0; j < 4; j++) {
-      faces[i].index[j] = mesh.ibo[i * 4 + j];
-
-      // face code is minimum of referenced vertices codes
-      faces[i].code = std::min(faces[i].code, verts[faces[i].index[j]]);
+    for (size_t i = block; i < blockEnd; i++) {
+      faces[i].originalFace = i;
+      faces[i].code = std::numeric_limits<uint32_t>::max();
+      for (int j = 0; j < 4; j++) {
+        // face code is minimum of referenced vertices codes
+        faces[i].code = std::min(faces[i].code, verts[quads(i, j)]);
+      }
     }
-  }
 
-  // sort faces by code
-#ifdef _WIN32
-  auto sort_face = [](std::vector<SortFace>& sort_face_list)
-  {
-      const int index_ele_size = 4;
-      unsigned int* index_data_ptr = (unsigned int*)malloc(sizeof(unsigned int) * sort_face_list.size() * index_ele_size);
-      unsigned int* code_ptr = (unsigned int*)malloc(sizeof(unsigned int) * sort_face_list.size());
-      unsigned long long* originalFace_ptr = (unsigned long long*)malloc(sizeof(unsigned long long) * sort_face_list.size());
-
-      // convert to array
-      for (int i = 0; i < sort_face_list.size(); i++)
-      {
-          for (int j = 0; j < index_ele_size; j++)
-              index_data_ptr[i * index_ele_size + j] = sort_face_list[i].index[j];
-          code_ptr[i] = sort_face_list[i].code;
-          originalFace_ptr[i] = sort_face_list[i].originalFace;
-      }
-      int face_number = sort_face_list.size();
-      sortface_linux(index_data_ptr, face_number, code_ptr, face_number, originalFace_ptr, face_number);
-      printf("%s", "linux sort function");
-
-      // update the sort_face_list
-      for (int i = 0; i < sort_face_list.size(); i++)
-      {
-          for (int j = 0; j < index_ele_size; j++)
-              sort_face_list[i].index[j] = index_data_ptr[i * index_ele_size + j];
-          sort_face_list[i].code = code_ptr[i];
-          sort_face_list[i].originalFace = originalFace_ptr[i];
-      }
-  };
+    dropBlock(quads.Packet(block), quads.Packet(blockEnd - 1), quads.Stride());
+  }
 
-  sort_face(faces);
-
-  // output to file
-  //std::ofstream myfile;
-  //myfile.open("d:/faces_info_win32.txt");
-  //for (SortFace& sf : faces)
-  //{
-  //    myfile << sf.code << "\t" <<
-  //        sf.index[0] << "\t" <<
-  //        sf.index[1] << "\t" <<
-  //        sf.index[2] << "\t" <<
-  //        sf.index[3] << "\t" <<
-  //        sf.originalFace << "\n";
-  //}
-  //myfile.close();
-  //printf("face output finished !!!");
-
-  //// load data from files
-  //std::ifstream infile("d:/faces_info_cygwin.txt");
-
-  //uint32_t code_;
-  //uint32_t index_0, index_1, index_2, index_3;
-  //size_t originalFace_;
-
-  //int counter = 0;
-  //while (infile >> code_ >> index_0 >> index_1 >> index_2 >> index_3 >> originalFace_)
-  //{
-  //    // successfully extracted one line, data is in x1, ..., x4, c.
-  //    SortFace sf;
-  //    faces[counter].code = code_;
-  //    faces[counter].index[0] = index_0;
-  //    faces[counter].index[1] = index_1;
-  //    faces[counter].index[2] = index_2;
-  //    faces[counter].index[3] = index_3;
-  //    faces[counter].originalFace = originalFace_;
-  //    //faces[counter] = (sf);
-  //    counter++;
-  //    if (counter % 1000 == 0 )
-  //        printf("%d\n", counter);
-  //}
-  //infile.close();
-#elif __linux__
-
-  std::sort(faces.begin(), faces.end(), [](const SortFace &f1, const SortFace &f2) -> bool
-            { return (f1.code < f2.code); });
+  // sort faces by code. Faces are numbered by their position in the sorted order within each
+  // chunk and the atlases are indexed by that number, so faces with equal codes must come out in
+  // the order std::sort from libstdc++ gives them, which IntroSort reproduces on every platform.
+  IntroSort(faces.data(), faces.data() + faces.size(), [](const SortFace& f1, const SortFace& f2) {
+    return f1.code < f2.code;
+  });
 
-#endif
+  ChunkLayout layout;
 
   // find face chunk start indices
-  std::vector<uint32_t> chunkStart;
-  chunkStart.push_back(0);
+  layout.chunkStart.push_back(0);
   uint32_t prevCode = faces[0].code;
   for (size_t i = 1; i < faces.size(); i++) {
     if (faces[i].code != prevCode) {
-      chunkStart.push_back(i);
+      layout.chunkStart.push_back(i);
       prevCode = faces[i].code;
     }
   }
 
-  chunkStart.push_back(faces.size());
-  size_t numChunks = chunkStart.size() - 1;
+  layout.chunkStart.push_back(faces.size());
 
-  size_t maxFaces = 0;
-  for (size_t i = 0; i < numChunks; i++) {
-    uint32_t chunkSize = chunkStart[i + 1] - chunkStart[i];
-    if (chunkSize > maxFaces)
-      maxFaces = chunkSize;
+  // the codes are no longer needed
+  verts = std::vector<uint32_t>();
+  layout.faces.resize(numFaces);
+
+#pragma omp parallel for
+  for (size_t i = 0; i < numFaces; i++) {
+    layout.faces[i] = faces[i].originalFace;
   }
 
-  // create new mesh for each chunk of faces
-  std::vector<MeshData> subMeshes;
+  return layout;
+}
+
+MeshData PTexMesh::BuildChunks(
+    const StridedView<float>& positions,
+    const StridedView<uint32_t>& quads,
+    const ChunkLayout& layout,
+    const size_t firstChunk,
+    const size_t lastChunk,
+    const bool denseRemap) {
+  const size_t numChunks = lastChunk - firstChunk;
+  const size_t* chunkStart = &layout.chunkStart[firstChunk];
+  const size_t firstFace = chunkStart[0];
+
+  // a chunk references at most four vertices per quad, the unused tail of the position array is
+  // never touched
+  const size_t numIndices = (chunkStart[numChunks] - firstFace) * 4;
+
+  MeshData subMeshes;
+  subMeshes.Reinitialise(numIndices, numIndices, MESH_POSITIONS, 4);
+
+  // index ranges follow directly from the face chunks, four indices per quad
+  subMeshes.ranges.resize(numChunks);
 
   for (size_t i = 0; i < numChunks; i++) {
-    subMeshes.emplace_back(4);
+    subMeshes.ranges[i].indexOffset = (chunkStart[i] - firstFace) * 4;
+    subMeshes.ranges[i].numIndices = (chunkStart[i + 1] - chunkStart[i]) * 4;
   }
 
-#pragma omp parallel for
-  for (int i = 0; i < numChunks; i++) {
-    uint32_t chunkSize = chunkStart[i + 1] - chunkStart[i];
+  // first pass: number each chunk's vertices in order of first reference and write the remapped
+  // indices
+#pragma omp parallel
+  {
+    VertexRemap remap(denseRemap ? positions.size() : 0);
 
-    std::vector<uint32_t> refdVerts;
-    std::unordered_map<uint32_t, uint32_t> refdVertsMap;
-    subMeshes[i].ibo.Reinitialise(chunkSize * 4, 1);
+#pragma omp for schedule(dynamic)
+    for (int i = 0; i < (int)numChunks; i++) {
+      uint32_t* ibo = subMeshes.Indices().data() + subMeshes.ranges[i].indexOffset;
 
-    for (size_t j = 0; j < chunkSize; j++) {
-      size_t faceIdx = chunkStart[i] + j;
-      for (int k = 0; k < 4; k++) {
-        uint32_t vertIndex = faces[faceIdx].index[k];
-        uint32_t newIndex = 0;
-
-        auto it = refdVertsMap.find(vertIndex);
-
-        if (it == refdVertsMap.end()) {
-          // vertex not found, add
-          newIndex = refdVerts.size();
-          refdVerts.push_back(vertIndex);
-          refdVertsMap[vertIndex] = newIndex;
-        } else {
-          // found, use existing index
-          newIndex = it->second;
+      remap.Begin(firstChunk + i, subMeshes.ranges[i].numIndices);
+
+      for (size_t j = chunkStart[i]; j < chunkStart[i + 1]; j++) {
+        for (int k = 0; k < 4; k++) {
+          *ibo++ = remap(quads(layout.faces[j], k));
         }
-        subMeshes[i].ibo[j * 4 + k] = newIndex;
       }
+
+      subMeshes.ranges[i].numVertices = remap.NumRefdVerts();
     }
+  }
+
+  size_t numSplitVerts = 0;
+  for (size_t i = 0; i < numChunks; i++) {
+    subMeshes.ranges[i].vertexOffset = numSplitVerts;
+    numSplitVerts += subMeshes.ranges[i].numVertices;
+  }
 
-    // add referenced vertices to submesh
-    subMeshes[i].vbo.Reinitialise(refdVerts.size(), 1);
-    subMeshes[i].nbo.Reinitialise(refdVerts.size(), 1);
-    for (size_t j = 0; j < refdVerts.size(); j++) {
-      uint32_t index = refdVerts[j];
-      subMeshes[i].vbo[j] = mesh.vbo[index];
-      subMeshes[i].nbo[j] = mesh.nbo[index];
+  subMeshes.SetNumVertices(numSplitVerts);
+
+  // second pass: gather the referenced vertices. A vertex's first reference is exactly where the
+  // next unused local index appears, so no lookup tables are needed.
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < (int)numChunks; i++) {
+    const MeshData::Range& range = subMeshes.ranges[i];
+    const uint32_t* ibo = subMeshes.Indices().data() + range.indexOffset;
+    Eigen::Vector3f* vbo = subMeshes.Positions().data() + range.vertexOffset;
+    uint32_t nextIndex = 0;
+
+    for (size_t j = chunkStart[i]; j < chunkStart[i + 1]; j++) {
+      for (int k = 0; k < 4; k++) {
+        if (*ibo++ == nextIndex)
+          vbo[nextIndex++] = Position(positions, quads(layout.faces[j], k));
+      }
     }
   }
 
   return subMeshes;
 }
 
-void PTexMesh::CalculateAdjacency(const MeshData& mesh, std::vector<uint32_t>& adjFaces) {
+void PTexMesh::CalculateAdjacency(const MeshView& mesh, uint32_t* adjFaces) {
+  // one record per face edge, keyed on its unordered vertex pair
   struct EdgeData {
-    EdgeData(int f, int e) : face(f), edge(e) {}
-    int face;
-    int edge;
+    uint64_t key;
+    uint32_t face;
+    uint32_t edge;
   };
 
-  std::unordered_map<uint64_t, std::vector<EdgeData>> edgeMap;
+  // quad meshes only
+  const size_t polygonStride = 4;
+  ASSERT(mesh.polygonStride == polygonStride);
 
-  ASSERT(mesh.polygonStride == 4, "Only works on quad meshes");
+  const uint32_t* ibo = mesh.indices.data();
+  const size_t numFaces = mesh.NumIndices() / polygonStride;
+  const size_t numEdges = numFaces * polygonStride;
 
-  size_t numFaces = mesh.ibo.size() / mesh.polygonStride;
+  // pack the vertex pair densely so the sort only has to look at the bits in use
+  const uint64_t numVerts = std::max<uint64_t>(mesh.NumVertices(), 1);
+  int vertBits = 0;
+  while ((uint64_t(1) << vertBits) < numVerts)
+    vertBits++;
 
-  pangolin::ManagedImage<std::unordered_map<uint64_t, std::vector<EdgeData>>::iterator>
-      edgeIterators(mesh.polygonStride, numFaces);
+  std::vector<EdgeData> edges(numEdges);
 
   // for each face
-  for (size_t f = 0; f < numFaces; f++) {
+#pragma omp parallel for if (numFaces > 16384)
+  for (int f = 0; f < (int)numFaces; f++) {
     // for each edge
-    for (int e = 0; e < (int)mesh.polygonStride; e++) {
-      // add to edge to face map
-      const uint32_t i0 = mesh.ibo[f * mesh.polygonStride + e];
-      const uint32_t i1 = mesh.ibo[f * mesh.polygonStride + ((e + 1) % mesh.polygonStride)];
-      const uint64_t key = (uint64_t)std::min(i0, i1) << 32 | (uint32_t)std::max(i0, i1);
-
-      const EdgeData edgeData(f, e);
-
-      auto it = edgeMap.find(key);
-
-      if (it == edgeMap.end()) {
-        it = edgeMap.emplace(key, std::vector<EdgeData>()).first;
-        it->second.reserve(4);
-        it->second.push_back(edgeData);
-      } else {
-        it->second.push_back(edgeData);
-      }
-
-      edgeIterators(e, f) = it;
+    for (int e = 0; e < (int)polygonStride; e++) {
+      const uint32_t i0 = ibo[f * polygonStride + e];
+      const uint32_t i1 = ibo[f * polygonStride + ((e + 1) % polygonStride)];
+
+      EdgeData& edgeData = edges[f * polygonStride + e];
+      edgeData.key = (uint64_t)std::min(i0, i1) << vertBits | (uint64_t)std::max(i0, i1);
+      edgeData.face = f;
+      edgeData.edge = e;
     }
   }
 
-  adjFaces.resize(numFaces * mesh.polygonStride);
+  // group edges sharing vertices. The sort is stable, so each group lists its faces in the same
+  // (face, edge) order the neighbour search below has always seen them in.
+  {
+    std::vector<EdgeData> tmp(numEdges);
+    RadixSort(
+        edges.data(),
+        tmp.data(),
+        numEdges,
+        [](const EdgeData& edgeData) { return edgeData.key; },
+        2 * vertBits);
+  }
 
-  for (size_t f = 0; f < numFaces; f++) {
-    for (int e = 0; e < (int)mesh.polygonStride; e++) {
-      auto it = edgeIterators(e, f);
+  for (size_t begin = 0; begin < numEdges;) {
+    size_t end = begin + 1;
+    while (end < numEdges && edges[end].key == edges[begin].key)
+      end++;
 
-      const std::vector<EdgeData>& adj = it->second;
+    for (size_t i = begin; i < end; i++) {
+      const int f = edges[i].face;
+      const int e = edges[i].edge;
 
       // find adjacent face
       int adjFace = -1;
-      for (size_t i = 0; i < adj.size(); i++) {
-        if (adj[i].face != (int)f)
-          adjFace = adj[i].face;
+      for (size_t j = begin; j < end; j++) {
+        if ((int)edges[j].face != f)
+          adjFace = edges[j].face;
       }
 
       // find number of 90 degree rotation steps between faces
       int rot = 0;
-      if (adj.size() == 2) {
+      if (end - begin == 2) {
         int edge0 = 0, edge1 = 0;
-        if (adj[0].edge == e) {
-          edge0 = adj[0].edge;
-          edge1 = adj[1].edge;
-        } else if (adj[1].edge == e) {
-          edge0 = adj[1].edge;
-          edge1 = adj[0].edge;
+        if ((int)edges[begin].edge == e) {
+          edge0 = edges[begin].edge;
+          edge1 = edges[begin + 1].edge;
+        } else if ((int)edges[begin + 1].edge == e) {
+          edge0 = edges[begin + 1].edge;
+          edge1 = edges[begin].edge;
         }
 
         rot = (edge0 - edge1 + 2) & 3;
       }
 
       // pack adjacent face and rotation into 32-bit int
-      adjFaces[f * mesh.polygonStride + e] = (rot << ROTATION_SHIFT) | (adjFace & FACE_MASK);
+      adjFaces[f * polygonStride + e] = (rot << ROTATION_SHIFT) | (adjFace & FACE_MASK);
     }
+
+    begin = end;
   }
 }
 
-void PTexMesh::LoadMeshData(const std::string& meshFile) {
-  // Load the meshes
-  MeshData originalMesh;
-  PLYParse(originalMesh, meshFile);
+static Eigen::AlignedBox3f CalculateBounds(const Span<const Eigen::Vector3f>& positions) {
+  Eigen::AlignedBox3f bounds;
+  for (const Eigen::Vector3f& p : positions)
+    bounds.extend(p);
+  return bounds;
+}
 
-  ASSERT(originalMesh.polygonStride == 4, "Must be a quad mesh!");
+bool PTexMesh::LoadMeshCache(const std::string& cacheFile, const MeshCache::Key& key) {
+  MeshCache cache;
 
-  // Split into sub-meshes
-  std::vector<MeshData> splitMeshData;
+  if (!cache.Open(cacheFile, key))
+    return false;
 
-  if (splitSize > 0.0f) {
-    std::cout << "Splitting mesh... ";
+  // Upload straight from the mapped cache
+  for (size_t i = 0; i < cache.NumSubMeshes(); i++) {
+    std::cout << "\rLoading cached mesh " << i + 1 << "/" << cache.NumSubMeshes() << "... ";
     std::cout.flush();
-    splitMeshData = SplitMesh(originalMesh, splitSize);
-    std::cout << "done" << std::endl;
-  } else {
-    splitMeshData.emplace_back(std::move(originalMesh));
+
+    const MeshCache::SubMesh& subMesh = cache.GetSubMesh(i);
+
+    AddMesh(
+        Span<const Eigen::Vector3f>((const Eigen::Vector3f*)subMesh.vbo, subMesh.numVertices),
+        Span<const uint32_t>(subMesh.ibo, subMesh.numIndices),
+        Span<const uint32_t>(subMesh.abo, subMesh.numAdjacency),
+        Span<const uint8_t>(subMesh.faceOrder, subMesh.numFaceOrder));
+  }
+  std::cout << "\rLoading cached mesh " << cache.NumSubMeshes() << "/" << cache.NumSubMeshes()
+            << "... done" << std::endl;
+
+  return true;
+}
+
+void PTexMesh::AddMesh(
+    const Span<const Eigen::Vector3f>& positions,
+    const Span<const uint32_t>& indices,
+    const Span<const uint32_t>& adjFaces,
+    const Span<const uint8_t>& faceOrder) {
+  meshes.emplace_back(new Mesh);
+  Mesh& mesh = *meshes.back();
+
+  mesh.bounds = CalculateBounds(positions);
+
+  mesh.firstFace = faceOrders.size();
+  faceOrders.insert(faceOrders.end(), faceOrder.begin(), faceOrder.end());
+
+  // edges along the tiles' x axis
+  const size_t numFaces = indices.size() / 4;
+  for (size_t i = 0; i < numFaces; i++)
+    totalEdgeLength += (positions[indices[i * 4 + 1]] - positions[indices[i * 4]]).norm();
+  totalFaces += numFaces;
+
+  // compacted positions move by up to half a quantization step along each axis
+  const float padding =
+      options.compactMeshes ? (mesh.bounds.sizes() / 2.0f).norm() / 65534.0f : 0.0f;
+
+  mesh.firstMeshlet = meshlets.size();
+  BuildMeshlets(positions, indices, MESHLET_FACES, padding, meshlets);
+  mesh.numMeshlets = meshlets.size() - mesh.firstMeshlet;
+
+  if (!options.compactMeshes) {
+    mesh.range = meshBuffers.Append(
+        positions.data(),
+        positions.size(),
+        GL_FLOAT,
+        3,
+        indices.data(),
+        indices.size(),
+        GL_UNSIGNED_INT,
+        adjFaces.data(),
+        adjFaces.size());
+    return;
+  }
+
+  // positions become signed normalized fractions of the half extent around the bounds' centre,
+  // padded to 4 components to keep vertices 4-byte aligned. w = 1 once normalized.
+  mesh.positionOffset = mesh.bounds.center();
+  mesh.positionScale = (mesh.bounds.sizes() / 2.0f).cwiseMax(std::numeric_limits<float>::min());
+
+  std::vector<int16_t> quantized(positions.size() * 4);
+  for (size_t i = 0; i < positions.size(); i++) {
+    const Eigen::Vector3f q = (positions[i] - mesh.positionOffset)
+                                  .cwiseQuotient(mesh.positionScale)
+                                  .cwiseMax(-1.0f)
+                                  .cwiseMin(1.0f);
+    for (int j = 0; j < 3; j++)
+      quantized[i * 4 + j] = (int16_t)std::lround(q(j) * 32767.0f);
+    quantized[i * 4 + 3] = 32767;
+  }
+
+  // the shared index buffer only stays 16-bit while every sub-mesh fits
+  const bool shortIndexed = positions.size() <= 65536;
+  std::vector<uint16_t> shortIndices;
+  if (shortIndexed)
+    shortIndices.assign(indices.begin(), indices.end());
+
+  // 14 bits of face and 2 of rotation per edge, the all ones face marks a missing neighbour
+
+  std::vector<uint32_t> compact;
+  if (numFaces < COMPACT_FACE_MASK) {
+    compact.assign(adjFaces.size() / 2, 0);
+
+    for (size_t i = 0; i < adjFaces.size(); i++) {
+      const uint32_t rot = adjFaces[i] >> ROTATION_SHIFT;
+      const uint32_t adjFace = adjFaces[i] & FACE_MASK;
+      const uint32_t entry = (rot << COMPACT_ROTATION_SHIFT) |
+          (adjFace == FACE_MASK ? COMPACT_FACE_MASK : adjFace);
+      compact[i / 2] |= entry << (16 * (i & 1));
+    }
+
+    mesh.compactAdjacency = true;
+  }
+
+  mesh.range = meshBuffers.Append(
+      quantized.data(),
+      positions.size(),
+      GL_SHORT,
+      4,
+      shortIndexed ? (const void*)shortIndices.data() : indices.data(),
+      indices.size(),
+      shortIndexed ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+      mesh.compactAdjacency ? compact.data() : adjFaces.data(),
+      mesh.compactAdjacency ? compact.size() : adjFaces.size());
+}
+
+void PTexMesh::UploadSubMeshes(
+    MeshData& subMeshes,
+    const size_t totalSubMeshes,
+    MeshCache::Writer* cacheWriter) {
+  // one packed entry per quad edge, laid out like the indices
+  std::vector<uint32_t> adjFaces(subMeshes.NumIndices());
+
+  const auto adjacencyStart = std::chrono::steady_clock::now();
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < (int)subMeshes.NumSubMeshes(); i++) {
+    CalculateAdjacency(
+        subMeshes.SubMesh(i), adjFaces.data() + subMeshes.ranges[i].indexOffset);
+  }
+
+  adjacencySeconds +=
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - adjacencyStart).count();
+
+  // The adjacency stays in the order of the atlas tiles, faces reordered within their meshlet
+  // find their tile, and through it their adjacency, in faceOrder. One entry per quad.
+  std::vector<uint8_t> faceOrder;
+
+  if (options.vertexCacheOrderEnable) {
+    faceOrder.resize(subMeshes.NumIndices() / 4);
+
+    size_t missesBefore = 0;
+    size_t missesAfter = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+ : missesBefore, missesAfter)
+    for (int i = 0; i < (int)subMeshes.NumSubMeshes(); i++) {
+      const MeshData::Range& range = subMeshes.ranges[i];
+      const Span<Eigen::Vector3f> positions =
+          subMeshes.Positions().Subspan(range.vertexOffset, range.numVertices);
+      const Span<uint32_t> indices =
+          subMeshes.Indices().Subspan(range.indexOffset, range.numIndices);
+
+      missesBefore += CountCacheMisses(indices, positions.size(), VERTEX_CACHE_SIZE);
+
+      OrderForVertexCache(
+          positions,
+          indices,
+          MESHLET_FACES,
+          VERTEX_CACHE_SIZE,
+          Span<uint8_t>(faceOrder.data() + range.indexOffset / 4, range.numIndices / 4));
+
+      missesAfter += CountCacheMisses(indices, positions.size(), VERTEX_CACHE_SIZE);
+    }
+
+    cacheMissesBefore += missesBefore;
+    cacheMissesAfter += missesAfter;
   }
 
   // Upload mesh data to GPU
-  for (size_t i = 0; i < splitMeshData.size(); i++) {
-    std::cout << "\rLoading mesh " << i + 1 << "/" << splitMeshData.size() << "... ";
+  for (size_t i = 0; i < subMeshes.NumSubMeshes(); i++) {
+    std::cout << "\rLoading mesh " << meshes.size() + 1 << "/" << totalSubMeshes << "... ";
     std::cout.flush();
 
-    meshes.emplace_back(new Mesh);
+    const MeshView subMesh = subMeshes.SubMesh(i);
+    const Span<const uint32_t> abo(
+        adjFaces.data() + subMeshes.ranges[i].indexOffset, subMesh.NumIndices());
+    const Span<const uint8_t> order = faceOrder.empty()
+        ? Span<const uint8_t>()
+        : Span<const uint8_t>(
+              faceOrder.data() + subMeshes.ranges[i].indexOffset / 4, subMesh.NumIndices() / 4);
+
+    AddMesh(subMesh.positions, subMesh.indices, abo, order);
+
+    // the cache keeps full precision, compacting is cheap enough to repeat on every load
+    if (cacheWriter) {
+      cacheWriter->Append(
+          (const float*)subMesh.positions.data(),
+          subMesh.NumVertices(),
+          subMesh.indices.data(),
+          subMesh.NumIndices(),
+          abo.data(),
+          abo.size(),
+          order.data(),
+          order.size());
+    }
+  }
+}
 
-    meshes.back()->vbo.Reinitialise(
-        pangolin::GlArrayBuffer, splitMeshData[i].vbo.Area(), GL_FLOAT, 4, GL_STATIC_DRAW);
-    meshes.back()->vbo.Upload(
-        splitMeshData[i].vbo.ptr, splitMeshData[i].vbo.Area() * sizeof(Eigen::Vector4f));
-    meshes.back()->ibo.Reinitialise(
-        pangolin::GlElementArrayBuffer,
-        splitMeshData[i].ibo.Area(),
-        GL_UNSIGNED_INT,
-        1,
-        GL_STATIC_DRAW);
-    meshes.back()->ibo.Upload(
-        splitMeshData[i].ibo.ptr, splitMeshData[i].ibo.Area() * sizeof(unsigned int));
+void PTexMesh::LoadMeshData(const std::string& meshFile, const std::string& cacheDir) {
+  const std::string cacheFile = MeshCache::CachePath(cacheDir, meshFile);
+  MeshCache::Key cacheKey;
+
+  if (options.meshCacheEnable) {
+    cacheKey = MeshCache::MakeKey(meshFile, splitSize);
+    cacheKey.vertexCacheOrder = options.vertexCacheOrderEnable;
+
+    if (LoadMeshCache(cacheFile, cacheKey))
+      return;
   }
-  std::cout << "\rLoading mesh " << splitMeshData.size() << "/" << splitMeshData.size()
-            << "... done" << std::endl;
 
-  std::cout << "Calculating mesh adjacency... ";
-  std::cout.flush();
+  // Load the meshes. Within a memory budget the file is paged in as the splitter reads it, and
+  // dropped after each batch, rather than resident for the whole build.
+  const bool streamed = splitSize > 0.0f && options.meshMemoryBudgetBytes > 0;
+  PLYFile plyFile(meshFile, streamed);
 
-  std::vector<std::vector<uint32_t>> adjFaces(splitMeshData.size());
+  ASSERT(plyFile.PolygonStride() == 4, "Must be a quad mesh!");
 
-#pragma omp parallel for
-  for (int i = 0; i < splitMeshData.size(); i++) {
-    CalculateAdjacency(splitMeshData[i], adjFaces[i]);
+  // Sub-meshes are appended to the cache as they are uploaded
+  std::unique_ptr<MeshCache::Writer> cacheWriter;
+  if (options.meshCacheEnable)
+    cacheWriter.reset(new MeshCache::Writer(cacheFile, cacheKey));
+
+  if (splitSize > 0.0f) {
+    ASSERT(plyFile.PositionDimensions() == 3, "Vertex positions must have x, y and z");
+
+    // The splitter reads vertices and faces in place from the mapped file
+    const StridedView<float> positions = plyFile.Positions();
+    const StridedView<uint32_t> quads = plyFile.Faces();
+
+    std::cout << "Splitting mesh... ";
+    std::cout.flush();
+    const ChunkLayout layout =
+        LayoutChunks(positions, quads, splitSize, streamed ? &plyFile : nullptr);
+    std::cout << "done" << std::endl;
+
+    const size_t numChunks = layout.NumChunks();
+
+    // Without a memory budget all sub-meshes are built at once. Otherwise they are built,
+    // uploaded and freed in batches of whole chunks, never less than one chunk per batch.
+    const size_t budgetBytes = options.meshMemoryBudgetBytes > 0
+        ? options.meshMemoryBudgetBytes
+        : std::numeric_limits<size_t>::max();
+
+    for (size_t firstChunk = 0; firstChunk < numChunks;) {
+      size_t lastChunk = firstChunk + 1;
+      size_t batchBytes = layout.NumFaces(firstChunk) * BUILD_BYTES_PER_FACE;
+
+      while (lastChunk < numChunks &&
+             batchBytes + layout.NumFaces(lastChunk) * BUILD_BYTES_PER_FACE <= budgetBytes) {
+        batchBytes += layout.NumFaces(lastChunk) * BUILD_BYTES_PER_FACE;
+        lastChunk++;
+      }
+
+      MeshData subMeshes = BuildChunks(
+          positions, quads, layout, firstChunk, lastChunk, options.meshMemoryBudgetBytes == 0);
+      UploadSubMeshes(subMeshes, numChunks, cacheWriter.get());
+
+      // the next batch faults in the vertices and faces it shares with this one again
+      if (streamed)
+        plyFile.DropPages();
+
+      firstChunk = lastChunk;
+    }
+  } else {
+    // only positions are drawn, normals and colours stay in the file
+    MeshData wholeMesh;
+    PLYParse(wholeMesh, plyFile);
+
+    UploadSubMeshes(wholeMesh, 1, cacheWriter.get());
   }
 
-  for (size_t i = 0; i < splitMeshData.size(); i++) {
-    meshes[i]->abo.Reinitialise(
-        pangolin::GlShaderStorageBuffer, adjFaces[i].size(), GL_INT, 1, GL_STATIC_DRAW);
-    meshes[i]->abo.Upload(adjFaces[i].data(), sizeof(uint32_t) * adjFaces[i].size());
+  std::cout << "\rLoading mesh " << meshes.size() << "/" << meshes.size() << "... done"
+            << std::endl;
+
+  std::cout << "Adjacency of " << totalFaces << " faces built in " << adjacencySeconds << " s"
+            << std::endl;
+
+  // average transformed vertices per triangle, quads being two
+  if (options.vertexCacheOrderEnable && totalFaces > 0) {
+    std::cout << "Vertex cache order: ACMR " << cacheMissesBefore / (2.0 * totalFaces) << " -> "
+              << cacheMissesAfter / (2.0 * totalFaces) << std::endl;
+  }
+
+  if (cacheWriter) {
+    std::cout << "Writing mesh cache " << cacheFile << "... ";
+    std::cout << (cacheWriter->Finish() ? "done" : "failed, continuing without cache") << std::endl;
   }
-  std::cout << "done" << std::endl;
 }
 
-void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
+void PTexMesh::LoadAtlasData(
+    const std::string& atlasFolder,
+    const std::string& meshFile,
+    const std::string& cacheDir) {
+  std::vector<AtlasResidency::AtlasFile> atlasFiles(meshes.size());
+
   isHdr = false;
-  // Upload atlas data to GPU
   for (size_t i = 0; i < meshes.size(); i++) {
     const std::string dxtFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.dxt1";
     const std::string rgbFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.rgb";
     const std::string hdrFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.hdr";
 
+    AtlasResidency::AtlasFile& atlasFile = atlasFiles[i];
+
     if (pangolin::FileExists(dxtFile)) {
-      const size_t numBytes = std::filesystem::file_size(dxtFile);
+      atlasFile.filename = dxtFile;
+      atlasFile.numBytes = std::filesystem::file_size(dxtFile);
 
       // We know it's square
-      const size_t dim = std::sqrt(numBytes * 2);
-
-      meshes[i]->atlas.Reinitialise(
-          dim, dim, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, false, 0, GL_RGBA, GL_UNSIGNED_BYTE);
+      atlasFile.dim = std::sqrt(atlasFile.numBytes * 2);
+      atlasFile.gpuBytes = atlasFile.numBytes;
+      atlasFile.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+      atlasFile.compressed = true;
     } else if (pangolin::FileExists(rgbFile)) {
-      const size_t numBytes = std::filesystem::file_size(rgbFile);
+      atlasFile.filename = rgbFile;
+      atlasFile.numBytes = std::filesystem::file_size(rgbFile);
 
       // We know it's square
-      const size_t dim = std::sqrt(numBytes / 3);
-
-      meshes[i]->atlas.Reinitialise(dim, dim, GL_RGBA8, true, 0, GL_RGB, GL_UNSIGNED_BYTE);
+      atlasFile.dim = std::sqrt(atlasFile.numBytes / 3);
+      atlasFile.gpuBytes = (size_t)atlasFile.dim * atlasFile.dim * 4;
+      atlasFile.internalFormat = GL_RGBA8;
+      atlasFile.format = GL_RGB;
+      atlasFile.type = GL_UNSIGNED_BYTE;
+      atlasFile.samplingLinear = true;
     } else if (pangolin::FileExists(hdrFile)) {
-      const size_t numBytes = std::filesystem::file_size(hdrFile);
+      atlasFile.filename = hdrFile;
+      atlasFile.numBytes = std::filesystem::file_size(hdrFile);
 
       // We know it's square
-      const size_t dim = std::sqrt(numBytes / 6);
-
-      meshes[i]->atlas.Reinitialise(dim, dim, GL_RGBA16F, false, 0, GL_RGB, GL_HALF_FLOAT);
+      atlasFile.dim = std::sqrt(atlasFile.numBytes / 6);
+      atlasFile.gpuBytes = (size_t)atlasFile.dim * atlasFile.dim * 8;
+      atlasFile.internalFormat = GL_RGBA16F;
+      atlasFile.format = GL_RGB;
+      atlasFile.type = GL_HALF_FLOAT;
       isHdr = true;
     } else {
       ASSERT(false, "Can't parse texture filename " + atlasFolder + "/" + std::to_string(i));
     }
   }
 
-  for (size_t i = 0; i < meshes.size(); i++) {
-    std::cout << "\rLoading atlas " << i + 1 << "/" << meshes.size() << "... ";
-    std::cout.flush();
-    const std::string dxtFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.dxt1";
-    const std::string rgbFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.rgb";
-    const std::string hdrFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.hdr";
+  if (options.atlasMipmapsEnable)
+    MipmapAtlases(atlasFiles, cacheDir);
 
-    if (pangolin::FileExists(dxtFile)) {
-      const size_t numBytes = std::filesystem::file_size(dxtFile);
-
-      // Open file
-      FileMemMap fileMap;
-      void* mmappedData = fileMap.mapfile(std::string(dxtFile));
-
-      meshes[i]->atlas.Bind();
-      glCompressedTexSubImage2D(
-          GL_TEXTURE_2D,
-          0,
-          0,
-          0,
-          meshes[i]->atlas.width,
-          meshes[i]->atlas.height,
-          GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-          numBytes,
-          mmappedData);
-      CheckGlDieOnError();
-
-      fileMap.release();
-    } else if (pangolin::FileExists(rgbFile)) {
-      const size_t numBytes = std::filesystem::file_size(rgbFile);
+  // padded tiles would need a border on every level, breaking the halving of the atlas size
+  if (options.paddedTilesEnable) {
+    if (atlasLevels == 1 && atlasBaseLevel == 0)
+      PadAtlases(atlasFiles, meshFile, cacheDir);
+    else
+      std::cout << "Padded tiles aren't used with atlas mip levels" << std::endl;
+  }
 
-      // Open file
-      FileMemMap fileMap;
-      void* mmappedData = fileMap.mapfile(std::string(rgbFile));
+  if (options.atlasCompressionEnable)
+    CompressAtlases(atlasFiles, cacheDir);
 
-      meshes[i]->atlas.Upload(mmappedData, GL_RGB, GL_UNSIGNED_BYTE);
+  atlases.reset(
+      new AtlasResidency(atlasFiles, options.atlasBudgetBytes, options.atlasQueueDepth));
 
-      fileMap.release();
-    } else if (pangolin::FileExists(hdrFile)) {
-      const size_t numBytes = std::filesystem::file_size(hdrFile);
+  if (options.atlasBudgetBytes > 0) {
+    std::cout << "Streaming " << meshes.size() << " atlases within "
+              << options.atlasBudgetBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    return;
+  }
 
-      // Open file
-      FileMemMap fileMap;
-      void* mmappedData = fileMap.mapfile(std::string(hdrFile));
+  // Upload atlas data to GPU
+  std::cout << "Loading " << meshes.size() << " atlases... ";
+  std::cout.flush();
 
-      meshes[i]->atlas.Upload(mmappedData, GL_RGB, GL_HALF_FLOAT);
+  const auto start = std::chrono::steady_clock::now();
 
-      fileMap.release();
-    } else {
-      ASSERT(false, "Can't parse texture filename " + atlasFolder + "/" + std::to_string(i));
+  atlases->LoadAll();
+
+  // uploads only complete once the driver is done with the PBOs
+  glFinish();
+
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const double megabytes = atlases->GetStats().uploadedBytes / (1024.0 * 1024.0);
+
+  std::cout << "done (" << megabytes << " MB in " << seconds << " s, " << megabytes / seconds
+            << " MB/s)" << std::endl;
+}
+
+void PTexMesh::PadAtlases(
+    std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+    const std::string& meshFile,
+    const std::string& cacheDir) {
+  // re-encoding compressed atlases would lose quality
+  for (const AtlasResidency::AtlasFile& atlasFile : atlasFiles) {
+    if (atlasFile.compressed) {
+      std::cout << "Compressed atlases can't be padded, filtering through the adjacency"
+                << std::endl;
+      return;
     }
   }
-  std::cout << "\rLoading atlas " << meshes.size() << "/" << meshes.size() << "... done"
-            << std::endl;
+
+  const MeshCache::Key meshKey = MeshCache::MakeKey(meshFile, splitSize);
+
+  std::vector<AtlasResidency::AtlasFile> paddedFiles = atlasFiles;
+  size_t numBuilt = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < atlasFiles.size(); i++) {
+    const AtlasResidency::AtlasFile& atlasFile = atlasFiles[i];
+    AtlasResidency::AtlasFile& paddedFile = paddedFiles[i];
+
+    const size_t numTexels = (size_t)atlasFile.dim * atlasFile.dim;
+    const size_t texelBytes = atlasFile.numBytes / numTexels;
+
+    paddedFile.filename = (std::filesystem::path(cacheDir) /
+                           std::filesystem::path(atlasFile.filename).filename())
+                              .string() +
+        ".padded";
+    paddedFile.dim = AtlasPadding::PaddedDim(atlasFile.dim, tileSize);
+    paddedFile.offset = AtlasPadding::DataOffset();
+    paddedFile.numBytes = (size_t)paddedFile.dim * paddedFile.dim * texelBytes;
+    paddedFile.gpuBytes = atlasFile.gpuBytes / numTexels * paddedFile.dim * paddedFile.dim;
+    paddedFile.samplingLinear = true;
+
+    const AtlasPadding::Key key = AtlasPadding::MakeKey(atlasFile.filename, meshKey, tileSize);
+    if (AtlasPadding::IsCurrent(paddedFile.filename, key))
+      continue;
+
+    const std::vector<uint32_t> adjFaces = DownloadAdjacency(i);
+
+    if (!AtlasPadding::Build(
+            atlasFile.filename,
+            paddedFile.filename,
+            key,
+            atlasFile.dim,
+            texelBytes,
+            Span<const uint32_t>(adjFaces.data(), adjFaces.size()))) {
+      std::cout << "Failed padding " << atlasFile.filename << ", filtering through the adjacency"
+                << std::endl;
+      return;
+    }
+
+    numBuilt++;
+  }
+
+  if (numBuilt > 0) {
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Padded " << numBuilt << " atlases in " << seconds << " s" << std::endl;
+  }
+
+  atlasFiles = std::move(paddedFiles);
+  tileBorder = AtlasPadding::BORDER;
+}
+
+void PTexMesh::MipmapAtlases(
+    std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+    const std::string& cacheDir) {
+  // compressed levels would have to be re-encoded
+  int numLevels = std::numeric_limits<int>::max();
+  for (const AtlasResidency::AtlasFile& atlasFile : atlasFiles) {
+    if (atlasFile.compressed) {
+      std::cout << "Compressed atlases can't be mipmapped, loading full resolution" << std::endl;
+      return;
+    }
+    numLevels = std::min(numLevels, AtlasMipmaps::NumLevels(atlasFile.dim, tileSize));
+  }
+
+  if (atlasFiles.empty() || numLevels <= 1) {
+    std::cout << "Tiles of " << tileSize << " texels can't be mipmapped, loading full resolution"
+              << std::endl;
+    return;
+  }
+
+  // the finest level still giving every pixel of an average face a texel at the near distance
+  int baseLevel = 0;
+  if (options.atlasTargetWidth > 0 && options.atlasTargetFov > 0.0f && totalFaces > 0) {
+    const double faceEdge = totalEdgeLength / totalFaces;
+    const double pixels = faceEdge / options.atlasNearDistance * options.atlasTargetWidth /
+        options.atlasTargetFov;
+
+    while (baseLevel + 1 < numLevels && (tileSize >> (baseLevel + 1)) >= pixels)
+      baseLevel++;
+  }
+
+  std::vector<AtlasResidency::AtlasFile> mipFiles = atlasFiles;
+  size_t numBuilt = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < atlasFiles.size(); i++) {
+    const AtlasResidency::AtlasFile& atlasFile = atlasFiles[i];
+    AtlasResidency::AtlasFile& mipFile = mipFiles[i];
+
+    const size_t numTexels = (size_t)atlasFile.dim * atlasFile.dim;
+    const size_t texelBytes = atlasFile.numBytes / numTexels;
+
+    mipFile.filename = (std::filesystem::path(cacheDir) /
+                        std::filesystem::path(atlasFile.filename).filename())
+                           .string() +
+        ".mips";
+
+    const AtlasMipmaps::Key key = AtlasMipmaps::MakeKey(atlasFile.filename, tileSize);
+    if (!AtlasMipmaps::IsCurrent(mipFile.filename, key)) {
+      if (!AtlasMipmaps::Build(
+              atlasFile.filename,
+              mipFile.filename,
+              key,
+              atlasFile.dim,
+              texelBytes,
+              atlasFile.type == GL_HALF_FLOAT)) {
+        std::cout << "Failed mipmapping " << atlasFile.filename << ", loading full resolution"
+                  << std::endl;
+        return;
+      }
+
+      numBuilt++;
+    }
+
+    mipFile.offset = AtlasMipmaps::LevelOffset(atlasFile.dim, texelBytes, baseLevel);
+    mipFile.numBytes =
+        AtlasMipmaps::LevelOffset(atlasFile.dim, texelBytes, numLevels) - mipFile.offset;
+    mipFile.gpuBytes = atlasFile.gpuBytes / numTexels * (mipFile.numBytes / texelBytes);
+    mipFile.dim = atlasFile.dim >> baseLevel;
+    mipFile.numLevels = numLevels - baseLevel;
+  }
+
+  if (numBuilt > 0) {
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Mipmapped " << numBuilt << " atlases in " << seconds << " s" << std::endl;
+  }
+
+  std::cout << "Loading atlas levels " << baseLevel << " to " << numLevels - 1 << ", tiles of "
+            << (tileSize >> baseLevel) << " texels" << std::endl;
+
+  atlasFiles = std::move(mipFiles);
+  atlasBaseLevel = baseLevel;
+  atlasLevels = numLevels - baseLevel;
+}
+
+void PTexMesh::CompressAtlases(
+    std::vector<AtlasResidency::AtlasFile>& atlasFiles,
+    const std::string& cacheDir) {
+  // blocks are encoded across the whole atlas, so a block holding texels of two tiles would
+  // blend their colours. Padded tiles are tileSize + 2 texels wide.
+  if (tileBorder > 0) {
+    std::cout << "Padded tiles don't align with 4x4 blocks, loading the atlases uncompressed"
+              << std::endl;
+    return;
+  }
+
+  // levels with tiles of fewer than 4 texels, or not a multiple of 4, are dropped instead
+  int numLevels = 0;
+  while (numLevels < atlasLevels) {
+    const uint32_t levelTileSize = tileSize >> (atlasBaseLevel + numLevels);
+    if (levelTileSize == 0 || levelTileSize % 4 != 0)
+      break;
+    numLevels++;
+  }
+
+  if (numLevels == 0) {
+    std::cout << "Tiles of " << (tileSize >> atlasBaseLevel)
+              << " texels don't align with 4x4 blocks, loading the atlases uncompressed"
+              << std::endl;
+    return;
+  }
+
+  AtlasCompression::Format format =
+      options.atlasCompressionBc1 ? AtlasCompression::Format::BC1 : AtlasCompression::Format::BC7;
+  if (isHdr)
+    format = AtlasCompression::Format::BC6H;
+
+  // all atlases are compressed or none are, so they share a format and levels
+  std::vector<AtlasResidency::AtlasFile> compressedFiles = atlasFiles;
+  size_t numBuilt = 0;
+  size_t numBytes = 0;
+  size_t numCompressedBytes = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (AtlasResidency::AtlasFile& atlasFile : compressedFiles) {
+    // already compressed ones are used as they are
+    if (atlasFile.compressed)
+      continue;
+
+    const AtlasCompression::Key key = AtlasCompression::MakeKey(
+        atlasFile.filename,
+        atlasFile.offset,
+        atlasFile.dim,
+        std::min(atlasFile.numLevels, numLevels),
+        format);
+
+    const std::string compressedFile = (std::filesystem::path(cacheDir) /
+                                        std::filesystem::path(atlasFile.filename).filename())
+                                           .string() +
+        "." + AtlasCompression::Name(format);
+
+    if (!AtlasCompression::IsCurrent(compressedFile, key)) {
+      if (!AtlasCompression::Build(atlasFile.filename, compressedFile, key)) {
+        std::cout << "Failed compressing " << atlasFile.filename
+                  << ", loading the atlases uncompressed" << std::endl;
+        return;
+      }
+
+      numBuilt++;
+    }
+
+    numBytes += atlasFile.gpuBytes;
+
+    atlasFile.filename = compressedFile;
+    atlasFile.offset = AtlasCompression::DataOffset();
+    atlasFile.numBytes = AtlasCompression::NumBytes(key);
+    atlasFile.gpuBytes = atlasFile.numBytes;
+    atlasFile.numLevels = key.numLevels;
+    atlasFile.compressed = true;
+    switch (format) {
+      case AtlasCompression::Format::BC1:
+        atlasFile.internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        break;
+      case AtlasCompression::Format::BC7:
+        atlasFile.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+        break;
+      case AtlasCompression::Format::BC6H:
+        atlasFile.internalFormat = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+        break;
+    }
+
+    numCompressedBytes += atlasFile.gpuBytes;
+  }
+
+  if (numBuilt > 0) {
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Compressed " << numBuilt << " atlases to " << AtlasCompression::Name(format)
+              << " in " << seconds << " s" << std::endl;
+  }
+
+  if (numCompressedBytes > 0 && numLevels < atlasLevels) {
+    std::cout << "Compressed atlases keep levels " << atlasBaseLevel << " to "
+              << atlasBaseLevel + numLevels - 1 << ", coarser tiles don't align with 4x4 blocks"
+              << std::endl;
+    atlasLevels = numLevels;
+  }
+
+  if (numCompressedBytes > 0) {
+    std::cout << "Loading " << AtlasCompression::Name(format) << " atlases, "
+              << numCompressedBytes / (1024.0 * 1024.0) << " MB instead of "
+              << numBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+  }
+
+  atlasFiles = std::move(compressedFiles);
+}
+
+std::vector<uint32_t> PTexMesh::DownloadAdjacency(size_t subMesh) const {
+  const Mesh& mesh = *meshes[subMesh];
+
+  std::vector<uint32_t> stored(mesh.range.numAdjacency);
+  if (!stored.empty()) {
+    meshBuffers.Adjacency().Download(
+        stored.data(),
+        stored.size() * sizeof(uint32_t),
+        mesh.range.firstAdjacency * sizeof(uint32_t));
+  }
+
+  if (!mesh.compactAdjacency)
+    return stored;
+
+  std::vector<uint32_t> adjFaces(stored.size() * 2);
+  for (size_t i = 0; i < adjFaces.size(); i++) {
+    const uint32_t entry = (stored[i / 2] >> (16 * (i & 1))) & 0xFFFF;
+    const uint32_t rot = entry >> COMPACT_ROTATION_SHIFT;
+    const uint32_t adjFace = entry & COMPACT_FACE_MASK;
+    adjFaces[i] = (rot << ROTATION_SHIFT) | (adjFace == COMPACT_FACE_MASK ? FACE_MASK : adjFace);
+  }
+
+  return adjFaces;
+}
+
+void PTexMesh::FinishMeshes() {
+  meshBuffers.Finish();
+
+  std::vector<SubMeshData> data(meshes.size());
+  std::vector<uint32_t> instances(meshlets.size() * 2);
+
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const Mesh& mesh = *meshes[i];
+
+    for (int j = 0; j < 3; j++) {
+      data[i].positionOffset[j] = mesh.positionOffset(j);
+      data[i].positionScale[j] = mesh.positionScale(j);
+    }
+    data[i].positionOffset[3] = 0.0f;
+    data[i].positionScale[3] = 1.0f;
+
+    data[i].widthInTiles = atlases->Dim(i) / ((tileSize >> atlasBaseLevel) + 2 * tileBorder);
+    data[i].firstAdjacency = mesh.range.firstAdjacency;
+    data[i].compactAdjacency = mesh.compactAdjacency;
+    data[i].firstIndex = mesh.range.firstIndex;
+    data[i].baseVertex = mesh.range.baseVertex;
+    data[i].firstFace = mesh.firstFace;
+
+    for (size_t m = mesh.firstMeshlet; m < mesh.firstMeshlet + mesh.numMeshlets; m++) {
+      instances[m * 2 + 0] = i;
+      instances[m * 2 + 1] = meshlets[m].firstFace;
+    }
+  }
+
+  subMeshData.Reinitialise(
+      pangolin::GlShaderStorageBuffer,
+      data.size() * sizeof(SubMeshData),
+      GL_STATIC_DRAW,
+      data.data());
+  // bytes read as uints, padded to a whole one
+  if (options.vertexCacheOrderEnable) {
+    faceOrders.resize(std::max<size_t>((faceOrders.size() + 3) / 4 * 4, 4), 0);
+    faceOrderData.Reinitialise(
+        pangolin::GlShaderStorageBuffer, faceOrders.size(), GL_STATIC_DRAW, faceOrders.data());
+  }
+  faceOrders = std::vector<uint8_t>();
+
+  meshletInstances.Reinitialise(
+      pangolin::GlArrayBuffer,
+      std::max<size_t>(instances.size(), 2) * sizeof(uint32_t),
+      GL_STATIC_DRAW,
+      instances.empty() ? nullptr : instances.data());
+
+  frameUniforms.Reinitialise(
+      (pangolin::GlBufferType)GL_UNIFORM_BUFFER, sizeof(FrameUniforms), GL_STREAM_DRAW);
+  if (options.layeredCubemapEnable) {
+    cubeUniforms.Reinitialise(
+        (pangolin::GlBufferType)GL_UNIFORM_BUFFER, sizeof(CubeUniforms), GL_STREAM_DRAW);
+  }
+  indirectCommands.Reinitialise(
+      (pangolin::GlBufferType)GL_DRAW_INDIRECT_BUFFER,
+      std::max<size_t>({meshes.size(), meshlets.size(), 1}) * sizeof(DrawElementsIndirectCommand),
+      GL_STREAM_DRAW);
+
+  allSubMeshes.resize(meshes.size());
+  for (size_t i = 0; i < meshes.size(); i++)
+    allSubMeshes[i] = i;
+
+  std::vector<Eigen::AlignedBox3f> boxes(meshes.size());
+  for (size_t i = 0; i < meshes.size(); i++)
+    boxes[i] = meshes[i]->bounds;
+  boundsTree.Build(boxes);
+
+  if (options.occlusionCullingEnable)
+    occlusionCuller.reset(new OcclusionCuller(boxes));
+
+  // Streamed atlases come and go while a pass is drawn, so only fully resident ones can be drawn
+  // together through handles fetched up front
+  bindlessAtlases = options.multiDrawEnable && options.atlasBudgetBytes == 0 &&
+      HasGlExtension("GL_ARB_bindless_texture");
+
+  if (bindlessAtlases) {
+    std::vector<GLuint64> handles(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+      handles[i] = atlases->AcquireHandle(i, true);
+
+    atlasHandles.Reinitialise(
+        pangolin::GlShaderStorageBuffer,
+        handles.size() * sizeof(GLuint64),
+        GL_STATIC_DRAW,
+        handles.data());
+  }
+
+  std::cout << "Meshes use " << meshBuffers.NumBytes() / (1024.0 * 1024.0) << " MB of GPU memory"
+            << (bindlessAtlases ? ", drawing with bindless atlases" : "") << std::endl;
+}
+
+void PTexMesh::PrefetchAtlases(const std::vector<pangolin::OpenGlMatrix>& upcomingModelViews) {
+  if (options.atlasBudgetBytes == 0)
+    return;
+
+  std::vector<Eigen::Vector3f> positions;
+  for (const pangolin::OpenGlMatrix& modelView : upcomingModelViews) {
+    const Eigen::Matrix4d worldToCamera = modelView;
+    positions.push_back(worldToCamera.inverse().block<3, 1>(0, 3).cast<float>());
+  }
+
+  // The renderers look in all directions, so everything around a pose is potentially visible and
+  // the closest sub-meshes are the most likely to be seen
+  std::vector<std::pair<float, size_t>> distances(meshes.size());
+  for (size_t i = 0; i < meshes.size(); i++) {
+    distances[i].first = std::numeric_limits<float>::max();
+    distances[i].second = i;
+
+    for (const Eigen::Vector3f& p : positions)
+      distances[i].first = std::min(distances[i].first, meshes[i]->bounds.exteriorDistance(p));
+  }
+
+  std::sort(distances.begin(), distances.end());
+
+  std::vector<size_t> upcoming;
+  for (const auto& d : distances)
+    upcoming.push_back(d.second);
+
+  atlases->Prefetch(upcoming);
 }
@@ -0,0 +1,60 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "ShaderPermutations.h"
+#include "Assert.h"
+
+void ShaderPermutations::Add(
+    ShaderProgramCache& programCache,
+    const std::vector<ShaderProgramCache::ShaderFile>& shaderFiles,
+    const std::vector<std::string>& searchPath,
+    const std::vector<std::string>& defines,
+    const std::vector<Switch>& switches) {
+  ASSERT(programs.empty(), "Shader permutations already added");
+  ASSERT(switches.size() < 8, "Too many shader permutations");
+
+  this->switches = switches;
+
+  for (unsigned i = 0; i < (1u << switches.size()); i++) {
+    // the same program as its reduced combination
+    if (Reduce(i) != i) {
+      programs.emplace_back();
+      continue;
+    }
+
+    std::vector<std::string> permutationDefines = defines;
+    for (size_t j = 0; j < switches.size(); j++) {
+      if (i & (1u << j))
+        permutationDefines.push_back(switches[j].define);
+    }
+
+    programs.emplace_back(new ShaderProgramCache::Program());
+    programCache.Add(*programs.back(), shaderFiles, searchPath, permutationDefines);
+    numPrograms++;
+  }
+}
+
+unsigned ShaderPermutations::Reduce(unsigned combination) const {
+  unsigned reduced = combination;
+  for (size_t j = 0; j < switches.size(); j++) {
+    if (!(combination & (1u << j)))
+      continue;
+
+    for (size_t k = 0; k < switches.size(); k++) {
+      if (switches[k].feature & switches[j].ignores)
+        reduced &= ~(1u << k);
+    }
+  }
+  return reduced;
+}
+
+ShaderProgramCache::Program& ShaderPermutations::Get(unsigned features) {
+  unsigned i = 0;
+  for (size_t j = 0; j < switches.size(); j++) {
+    if (features & switches[j].feature)
+      i |= 1u << j;
+  }
+
+  i = Reduce(i);
+
+  ASSERT(i < programs.size(), "Shader permutations not added");
+  return *programs[i];
+}
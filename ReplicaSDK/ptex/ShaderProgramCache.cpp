@@ -0,0 +1,331 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "ShaderProgramCache.h"
+#include "Assert.h"
+#include "GlExtensions.h"
+
+#include <pangolin/utils/file_utils.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+constexpr char MAGIC[8] = {'P', 'T', 'E', 'X', 'P', 'R', 'G', '\0'};
+
+// bump when the file layout or the way keys are computed changes
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t binaryFormat;
+  uint64_t key;
+  uint64_t binarySize;
+};
+
+uint64_t Hash(const void* data, size_t numBytes, uint64_t hash = 0xcbf29ce484222325ull) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < numBytes; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t Hash(const std::string& str, uint64_t hash) {
+  // include the length so consecutive strings cannot run into each other
+  const uint64_t length = str.size();
+  return Hash(str.data(), str.size(), Hash(&length, sizeof(length), hash));
+}
+
+std::string GlString(GLenum name) {
+  const GLubyte* str = glGetString(name);
+  return str ? std::string((const char*)str) : std::string();
+}
+
+// Inlines #include "file" directives, the only preprocessing our shaders need
+std::string PreprocessFile(const std::string& filename, const std::vector<std::string>& searchPath) {
+  std::ifstream file(filename);
+  ASSERT(file.is_open(), "Can't open shader " + filename);
+
+  const std::string currentDir = std::filesystem::path(filename).parent_path().string();
+
+  std::ostringstream output;
+  std::string line;
+
+  while (std::getline(file, line)) {
+    const size_t directive = line.find_first_not_of(" \t");
+
+    if (directive != std::string::npos && line.compare(directive, 8, "#include") == 0) {
+      const size_t open = line.find_first_of("\"<", directive + 8);
+      const size_t close = line.find_first_of("\">", open + 1);
+      ASSERT(open != std::string::npos && close != std::string::npos, "Bad #include in " + filename);
+
+      const std::string name = line.substr(open + 1, close - open - 1);
+
+      std::string includeFile;
+      for (const std::string& dir : searchPath) {
+        if (pangolin::FileExists(dir + "/" + name)) {
+          includeFile = dir + "/" + name;
+          break;
+        }
+      }
+
+      if (includeFile.empty() && pangolin::FileExists(currentDir + "/" + name))
+        includeFile = currentDir + "/" + name;
+
+      ASSERT(!includeFile.empty(), "Can't find " + name + " included from " + filename);
+
+      output << PreprocessFile(includeFile, searchPath);
+    } else {
+      output << line << "\n";
+    }
+  }
+
+  return output.str();
+}
+
+// Defines the given macros right after the #version directive, which must come first
+std::string AddDefines(const std::string& source, const std::vector<std::string>& defines) {
+  if (defines.empty())
+    return source;
+
+  std::string lines;
+  for (const std::string& define : defines)
+    lines += "#define " + define + "\n";
+
+  const size_t version = source.find("#version");
+  if (version == std::string::npos)
+    return lines + source;
+
+  const size_t lineEnd = source.find('\n', version);
+  if (lineEnd == std::string::npos)
+    return source + "\n" + lines;
+
+  return source.substr(0, lineEnd + 1) + lines + source.substr(lineEnd + 1);
+}
+
+void PrintLog(GLuint object, bool isProgram) {
+  GLint length = 0;
+  if (isProgram)
+    glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+  else
+    glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+
+  std::string log(std::max(length, 1), '\0');
+  if (isProgram)
+    glGetProgramInfoLog(object, length, nullptr, &log[0]);
+  else
+    glGetShaderInfoLog(object, length, nullptr, &log[0]);
+
+  std::cout << log << std::endl;
+}
+} // namespace
+
+std::string ShaderProgramCache::DefaultDir() {
+  std::error_code error;
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path(error);
+  return error ? std::string() : (tmp / "ReplicaSDK-shaders").string();
+}
+
+ShaderProgramCache::ShaderProgramCache(const std::string& cacheDir) : cacheDir(cacheDir) {}
+
+void ShaderProgramCache::Add(
+    Program& program,
+    const std::vector<ShaderFile>& shaderFiles,
+    const std::vector<std::string>& searchPath,
+    const std::vector<std::string>& defines) {
+  Entry entry;
+  entry.program = &program;
+  entry.key = 0;
+
+  for (const ShaderFile& shaderFile : shaderFiles)
+    entry.sources.emplace_back(
+        shaderFile.first, AddDefines(PreprocessFile(shaderFile.second, searchPath), defines));
+
+  entries.push_back(std::move(entry));
+}
+
+void ShaderProgramCache::Build() {
+  // binaries only load on the exact driver that produced them
+  uint64_t driverKey = Hash(&VERSION, sizeof(VERSION));
+  driverKey = Hash(GlString(GL_VENDOR), driverKey);
+  driverKey = Hash(GlString(GL_RENDERER), driverKey);
+  driverKey = Hash(GlString(GL_VERSION), driverKey);
+
+  GLint numBinaryFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+  const bool useCache = !cacheDir.empty() && numBinaryFormats > 0;
+
+  std::vector<Entry*> misses;
+
+  for (Entry& entry : entries) {
+    entry.key = driverKey;
+    for (const auto& source : entry.sources) {
+      entry.key = Hash(&source.first, sizeof(source.first), entry.key);
+      entry.key = Hash(source.second, entry.key);
+    }
+
+    if (!useCache || !Load(entry))
+      misses.push_back(&entry);
+  }
+
+  if (useCache) {
+    std::cout << "Loaded " << entries.size() - misses.size() << "/" << entries.size()
+              << " shader programs from " << cacheDir << std::endl;
+  }
+
+  if (misses.empty()) {
+    entries.clear();
+    return;
+  }
+
+  // let the driver compile on as many threads as it likes. GLEW only declares the KHR entry
+  // point from 2.2, older ones have the ARB extension it was promoted from.
+#if defined(GL_KHR_parallel_shader_compile)
+  if (HasGlExtension("GL_KHR_parallel_shader_compile"))
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  else if (HasGlExtension("GL_ARB_parallel_shader_compile"))
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+#elif defined(GL_ARB_parallel_shader_compile)
+  if (HasGlExtension("GL_ARB_parallel_shader_compile"))
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+#endif
+
+  // issue all compiles and links first, querying any status would wait for that build
+  std::vector<GLuint> programs(misses.size());
+  std::vector<std::vector<GLuint>> shaders(misses.size());
+
+  for (size_t i = 0; i < misses.size(); i++) {
+    for (const auto& source : misses[i]->sources) {
+      const GLuint shader = glCreateShader(source.first);
+      const GLchar* str = source.second.c_str();
+      glShaderSource(shader, 1, &str, nullptr);
+      glCompileShader(shader);
+      shaders[i].push_back(shader);
+    }
+  }
+
+  for (size_t i = 0; i < misses.size(); i++) {
+    programs[i] = glCreateProgram();
+    if (useCache)
+      glProgramParameteri(programs[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    for (GLuint shader : shaders[i])
+      glAttachShader(programs[i], shader);
+
+    glLinkProgram(programs[i]);
+  }
+
+  for (size_t i = 0; i < misses.size(); i++) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(programs[i], GL_LINK_STATUS, &linked);
+
+    if (!linked) {
+      for (GLuint shader : shaders[i]) {
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled)
+          PrintLog(shader, false);
+      }
+      PrintLog(programs[i], true);
+      ASSERT(false, "Failed building shader program");
+    }
+
+    // the linked program keeps everything it needs
+    for (GLuint shader : shaders[i]) {
+      glDetachShader(programs[i], shader);
+      glDeleteShader(shader);
+    }
+
+    if (useCache)
+      Store(*misses[i], programs[i]);
+
+    misses[i]->program->Adopt(programs[i]);
+  }
+
+  entries.clear();
+}
+
+std::string ShaderProgramCache::CacheFile(uint64_t key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.glprog", (unsigned long long)key);
+  return (std::filesystem::path(cacheDir) / name).string();
+}
+
+bool ShaderProgramCache::Load(const Entry& entry) {
+  std::ifstream file(CacheFile(entry.key), std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  FileHeader header;
+  if (!file.read((char*)&header, sizeof(header)))
+    return false;
+
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+      header.key != entry.key) {
+    return false;
+  }
+
+  std::vector<char> binary(header.binarySize);
+  if (!file.read(binary.data(), binary.size()))
+    return false;
+
+  const GLuint program = glCreateProgram();
+  glProgramBinary(program, header.binaryFormat, binary.data(), binary.size());
+
+  // drivers may still reject a binary, e.g. after an update that kept the version string
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+  if (!linked) {
+    glDeleteProgram(program);
+    return false;
+  }
+
+  entry.program->Adopt(program);
+  return true;
+}
+
+void ShaderProgramCache::Store(const Entry& entry, GLuint program) {
+  GLint binarySize = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+  if (binarySize <= 0)
+    return;
+
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.key = entry.key;
+
+  std::vector<char> binary(binarySize);
+  GLenum binaryFormat = 0;
+  glGetProgramBinary(program, binarySize, nullptr, &binaryFormat, binary.data());
+  header.binaryFormat = binaryFormat;
+  header.binarySize = binary.size();
+
+  std::error_code error;
+  std::filesystem::create_directories(cacheDir, error);
+
+  // write to a temporary file first, so concurrent runs never see a partial binary
+  const std::string cacheFile = CacheFile(entry.key);
+  const std::string tmpFile = cacheFile + ".tmp" + std::to_string(std::random_device()());
+
+  {
+    std::ofstream file(tmpFile, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), binary.size());
+
+    if (!file) {
+      file.close();
+      std::filesystem::remove(tmpFile, error);
+      return;
+    }
+  }
+
+  std::filesystem::rename(tmpFile, cacheFile, error);
+  if (error)
+    std::filesystem::remove(tmpFile, error);
+}
@@ -0,0 +1,164 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "VertexCache.h"
+#include "Assert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// vertices of the last quad drawn are scored the same, whichever corner came last
+constexpr int LAST_FACE_VERTICES = 4;
+constexpr float LAST_FACE_SCORE = 0.75f;
+constexpr float CACHE_DECAY_POWER = 1.5f;
+
+// favours vertices with few faces left, so the remaining faces aren't left stranded
+constexpr float VALENCE_BOOST_SCALE = 2.0f;
+constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+float VertexScore(const int cachePosition, const int valence, const size_t cacheSize) {
+  float score = 0.0f;
+
+  if (cachePosition >= 0) {
+    if (cachePosition < LAST_FACE_VERTICES) {
+      score = LAST_FACE_SCORE;
+    } else {
+      const float scale = 1.0f / (cacheSize - LAST_FACE_VERTICES);
+      score = std::pow(1.0f - (cachePosition - LAST_FACE_VERTICES) * scale, CACHE_DECAY_POWER);
+    }
+  }
+
+  return score + VALENCE_BOOST_SCALE * std::pow((float)valence, -VALENCE_BOOST_POWER);
+}
+
+} // namespace
+
+size_t CountCacheMisses(
+    const Span<const uint32_t>& indices,
+    const size_t numVertices,
+    const size_t cacheSize) {
+  // a vertex stays cached until cacheSize other vertices were inserted after it
+  constexpr size_t NOT_CACHED = std::numeric_limits<size_t>::max();
+  std::vector<size_t> insertedAt(numVertices, NOT_CACHED);
+
+  size_t misses = 0;
+  for (const uint32_t index : indices) {
+    if (insertedAt[index] == NOT_CACHED || misses - insertedAt[index] >= cacheSize)
+      insertedAt[index] = misses++;
+  }
+
+  return misses;
+}
+
+void OrderForVertexCache(
+    const Span<Eigen::Vector3f>& positions,
+    const Span<uint32_t>& indices,
+    const size_t windowFaces,
+    const size_t cacheSize,
+    const Span<uint8_t>& faceOrder) {
+  const size_t numFaces = indices.size() / 4;
+
+  ASSERT(windowFaces > 0 && windowFaces <= 256);
+  ASSERT(cacheSize > LAST_FACE_VERTICES);
+  ASSERT(faceOrder.size() == numFaces);
+
+  std::vector<uint32_t> ordered(indices.size());
+
+  // per run, indexed by the run's vertices in ascending order
+  std::vector<uint32_t> vertices;
+  std::vector<int> local;
+  std::vector<int> valence;
+  std::vector<int> cachePosition;
+  std::vector<int> cache;
+  std::vector<bool> drawn;
+
+  for (size_t first = 0; first < numFaces; first += windowFaces) {
+    const size_t last = std::min(first + windowFaces, numFaces);
+    const size_t count = last - first;
+
+    vertices.assign(indices.begin() + first * 4, indices.begin() + last * 4);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+    local.resize(count * 4);
+    valence.assign(vertices.size(), 0);
+    for (size_t i = 0; i < count * 4; i++) {
+      local[i] = std::lower_bound(vertices.begin(), vertices.end(), indices[first * 4 + i]) -
+          vertices.begin();
+      valence[local[i]]++;
+    }
+
+    cachePosition.assign(vertices.size(), -1);
+    cache.clear();
+    drawn.assign(count, false);
+
+    for (size_t n = 0; n < count; n++) {
+      // runs are small enough to score every face left, ties go to the earliest
+      size_t best = 0;
+      float bestScore = -1.0f;
+      for (size_t f = 0; f < count; f++) {
+        if (drawn[f])
+          continue;
+
+        float score = 0.0f;
+        for (int k = 0; k < 4; k++) {
+          const int v = local[f * 4 + k];
+          score += VertexScore(cachePosition[v], valence[v], cacheSize);
+        }
+
+        if (score > bestScore) {
+          best = f;
+          bestScore = score;
+        }
+      }
+
+      drawn[best] = true;
+      faceOrder[first + n] = best;
+      std::copy_n(&indices[(first + best) * 4], 4, &ordered[(first + n) * 4]);
+
+      // the quad's vertices move to the front of the cache, in corner order
+      for (int k = 0; k < 4; k++) {
+        const int v = local[best * 4 + k];
+        valence[v]--;
+
+        const auto cached = std::find(cache.begin(), cache.end(), v);
+        if (cached != cache.end())
+          cache.erase(cached);
+        cache.insert(cache.begin(), v);
+      }
+
+      while (cache.size() > cacheSize) {
+        cachePosition[cache.back()] = -1;
+        cache.pop_back();
+      }
+
+      for (size_t i = 0; i < cache.size(); i++)
+        cachePosition[cache[i]] = i;
+    }
+  }
+
+  // renumber the vertices in order of first use, so they are fetched front to back
+  constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(positions.size(), UNUSED);
+  std::vector<Eigen::Vector3f> reordered;
+  reordered.reserve(positions.size());
+
+  for (size_t i = 0; i < ordered.size(); i++) {
+    uint32_t& index = remap[ordered[i]];
+    if (index == UNUSED) {
+      index = reordered.size();
+      reordered.push_back(positions[ordered[i]]);
+    }
+    indices[i] = index;
+  }
+
+  // vertices no face references keep their place after the used ones
+  for (size_t i = 0; i < positions.size(); i++) {
+    if (remap[i] == UNUSED)
+      reordered.push_back(positions[i]);
+  }
+
+  std::copy(reordered.begin(), reordered.end(), positions.begin());
+}
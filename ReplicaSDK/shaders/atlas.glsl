@@ -1,11 +1,13 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
-uniform int tileSize;
-uniform int widthInTiles;
+#include "frame.glsl"
+#include "submesh.glsl"
 
+#ifndef PADDED_TILES
 layout(std430, binding = 1) buffer MeshAdjFaces
 {
     uint meshAdjFaces[];
 };
+#endif
 
 ivec2 FaceToAtlasPos(int faceID, int tileSize)
 {
@@ -32,12 +34,46 @@ ivec2 RotateUVs(ivec2 p, int rot, int size)
     }
 }
 
+// sub-mesh being drawn, set by SelectSubMesh
+int widthInTiles;
+uint firstAdjacency;
+bool compactAdjacency;
+
+void SelectSubMesh(uint subMesh)
+{
+    widthInTiles = subMeshes[subMesh].widthInTiles;
+    firstAdjacency = subMeshes[subMesh].firstAdjacency;
+    compactAdjacency = subMeshes[subMesh].compactAdjacency != 0;
+}
+
+#ifdef PADDED_TILES
+// Tiles are surrounded by TILE_BORDER texels copied from the adjacent faces, so hardware bilinear
+// filtering takes the same taps as the adjacency walk below
+vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
+{
+    vec2 tilePos = vec2(FaceToAtlasPos(faceID, tileSize + 2 * TILE_BORDER) + TILE_BORDER);
+    return textureLod(tex, (tilePos + p) / vec2(textureSize(tex, 0)), 0.0);
+}
+#else
 const int ROTATION_SHIFT = 30;
 const int FACE_MASK = 0x3FFFFFFF;
 
+// compact sub-meshes pack two edges per entry, 16 bits each
+const int COMPACT_ROTATION_SHIFT = 14;
+const int COMPACT_FACE_MASK = 0x3FFF;
+
 int GetAdjFace(int face, int edge, out int rot)
 {
-    uint data = meshAdjFaces[face * 4 + edge];
+    if (compactAdjacency)
+    {
+        uint data = meshAdjFaces[firstAdjacency + face * 2 + (edge >> 1)];
+        data = (data >> ((edge & 1) * 16)) & 0xFFFF;
+        rot = int(data >> COMPACT_ROTATION_SHIFT);
+        int adjFace = int(data & COMPACT_FACE_MASK);
+        return adjFace == COMPACT_FACE_MASK ? FACE_MASK : adjFace;
+    }
+
+    uint data = meshAdjFaces[firstAdjacency + face * 4 + edge];
     rot = int(data >> ROTATION_SHIFT);
     return int(data & FACE_MASK);
 }
@@ -161,33 +197,50 @@ int indexAdjacentFaces(int faceID, inout ivec2 p, int tsize)
 }
 
 // load texel from atlas, handling adjacent faces
-vec4 texelFetchAtlasAdj(sampler2D tex, int faceID, ivec2 p)
+// size is the tile size at level
+vec4 texelFetchAtlasAdj(sampler2D tex, int faceID, ivec2 p, int size, int level)
 {
     // fetch from adjacent face if necessary
-    faceID = indexAdjacentFaces(faceID, p, tileSize);
+    faceID = indexAdjacentFaces(faceID, p, size);
 
     // clamp to tile edge
-    p = clamp(p, ivec2(0, 0), ivec2(tileSize - 1, tileSize - 1));
+    p = clamp(p, ivec2(0, 0), ivec2(size - 1, size - 1));
 
-    ivec2 atlasPos = FaceToAtlasPos(faceID, tileSize);
-    return texelFetch(tex, atlasPos + p, 0);
+    ivec2 atlasPos = FaceToAtlasPos(faceID, size);
+    return texelFetch(tex, atlasPos + p, level);
 }
 
-// fetch with bilinear filtering
-vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
+// fetch with bilinear filtering from one level
+vec4 textureAtlasLevel(sampler2D tex, int faceID, vec2 p, int size, int level)
 {
     p -= 0.5;
     ivec2 i = ivec2(floor(p));
     vec2 f = p - vec2(i);
-    return mix(mix(texelFetchAtlasAdj(tex, faceID, ivec2(i)),
-                   texelFetchAtlasAdj(tex, faceID, ivec2(i.x + 1, i.y)),
+    return mix(mix(texelFetchAtlasAdj(tex, faceID, ivec2(i), size, level),
+                   texelFetchAtlasAdj(tex, faceID, ivec2(i.x + 1, i.y), size, level),
                    f.x),
-               mix(texelFetchAtlasAdj(tex, faceID, ivec2(i.x, i.y + 1)),
-                   texelFetchAtlasAdj(tex, faceID, ivec2(i.x + 1, i.y + 1)),
+               mix(texelFetchAtlasAdj(tex, faceID, ivec2(i.x, i.y + 1), size, level),
+                   texelFetchAtlasAdj(tex, faceID, ivec2(i.x + 1, i.y + 1), size, level),
                    f.x),
                f.y);
 }
 
+vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
+{
+#ifdef ATLAS_MIPMAPS
+    // the level nearest to a pixel's footprint, tiles were downsampled on their own so the
+    // adjacency walk works the same on every level
+    vec2 dx = dFdx(p);
+    vec2 dy = dFdy(p);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+    int level = min(int(lod + 0.5), textureQueryLevels(tex) - 1);
+    return textureAtlasLevel(tex, faceID, p / float(1 << level), tileSize >> level, level);
+#else
+    return textureAtlasLevel(tex, faceID, p, tileSize, 0);
+#endif
+}
+#endif
+
 void applySaturation(inout vec4 c, float saturation)
 {
     float Pr = 0.299f;
@@ -0,0 +1,39 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Views of the faces of a cubemap drawn in one pass, matches PTexMesh::CubeUniforms. Geometry
+// shaders run one invocation per face and quad, emitting the quad to the face's layer only if it
+// can show in it. The vertex shaders pass world space positions through. Declares the input
+// layout of the including geometry shader, so gl_in is sized before ProjectToFace indexes it.
+#ifndef CUBE_GLSL
+#define CUBE_GLSL
+
+#define CUBE_FACES 6
+
+layout(lines_adjacency, invocations = CUBE_FACES) in;
+
+layout(std140, binding = 1) uniform Cube
+{
+    mat4 faceMV[CUBE_FACES];
+    mat4 faceMVP[CUBE_FACES];
+    mat4 faceMVNext[CUBE_FACES];
+    mat4 faceMVPNext[CUBE_FACES];
+    mat4 faceMVPPrev[CUBE_FACES];
+};
+
+// Projects the world space corners of the input quad into the clip space of a face. False when
+// all of them are outside the same clip plane, so no part of the quad shows in the face.
+bool ProjectToFace(int face, out vec4 corners[4])
+{
+    ivec3 below = ivec3(0);
+    ivec3 above = ivec3(0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        corners[i] = faceMVP[face] * gl_in[i].gl_Position;
+        below += ivec3(lessThan(corners[i].xyz, -corners[i].www));
+        above += ivec3(greaterThan(corners[i].xyz, corners[i].www));
+    }
+
+    return !any(equal(below, ivec3(4))) && !any(equal(above, ivec3(4)));
+}
+
+#endif
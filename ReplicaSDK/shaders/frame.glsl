@@ -0,0 +1,22 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Constants shared by all draws of a pass, matches PTexMesh::FrameUniforms
+#ifndef FRAME_GLSL
+#define FRAME_GLSL
+
+layout(std140, binding = 0) uniform Frame
+{
+    mat4 MV;
+    mat4 MVP;
+    mat4 MV_next;
+    mat4 MVP_next;
+    mat4 MVP_prev; // with BACKWARD_MOTION
+    vec4 clipPlane;
+    vec2 windowSize;
+    float exposure;
+    float gamma; // reciprocal of the display gamma
+    float saturation;
+    float depthScale;
+    int tileSize;
+};
+
+#endif
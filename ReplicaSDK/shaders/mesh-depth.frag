@@ -2,11 +2,11 @@
 #version 430 core
 
 layout(location = 0) out vec4 FragColor;
-uniform float scale;
+#include "frame.glsl"
 
 in float depth;
 
 void main()
 {
-    FragColor = vec4(depth.xxx * scale, 1.0f);
+    FragColor = vec4(depth.xxx * depthScale, 1.0f);
 }
@@ -3,15 +3,29 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 MV, MVP;
-uniform vec4 clipPlane;
+#include "frame.glsl"
+#include "position.glsl"
 
+#ifndef CUBE_LAYERS
 out float depth;
+#endif
 
 void main()
 {
-    vec4 cameraPos = MV * position;
+#ifdef VERTEX_PULLING
+    vec4 worldPos = DequantizePosition(PullPosition());
+#else
+    vec4 worldPos = DequantizePosition(position);
+#endif
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(worldPos, clipPlane);
+#endif
+#ifdef CUBE_LAYERS
+    // projected into each face by mesh-depth.geom
+    gl_Position = worldPos;
+#else
+    vec4 cameraPos = MV * worldPos;
     depth = cameraPos.z;
-    gl_ClipDistance[0] = dot(position, clipPlane);
-    gl_Position = MVP * position;
+    gl_Position = MVP * worldPos;
+#endif
 }
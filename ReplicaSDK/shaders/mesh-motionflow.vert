@@ -3,15 +3,49 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 MVP_current;
-uniform mat4 MVP_next;
-uniform vec4 clipPlane;
+#include "frame.glsl"
+#include "position.glsl"
 
+#ifdef VERTEX_PULLING
+// without a geometry shader these go straight to the fragment shader
+out vec4 vpos;
+out vec4 vposNext;
+#ifdef BACKWARD_MOTION
+out vec4 vposPrev;
+#endif
+#elif !defined(CUBE_LAYERS)
 out vec4 pos_next;
+#ifdef BACKWARD_MOTION
+out vec4 pos_prev;
+#endif
+#endif
 
 void main()
 {
-    gl_ClipDistance[0] = dot(position, clipPlane);
-    gl_Position = MVP_current * position;
-    pos_next = MVP_next * position;
+#ifdef VERTEX_PULLING
+    vec4 worldPos = DequantizePosition(PullPosition());
+#else
+    vec4 worldPos = DequantizePosition(position);
+#endif
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(worldPos, clipPlane);
+#endif
+#ifdef CUBE_LAYERS
+    // projected into each face by the geometry shader
+    gl_Position = worldPos;
+#else
+    gl_Position = MVP * worldPos;
+#endif
+#ifdef VERTEX_PULLING
+    vpos = gl_Position;
+    vposNext = MVP_next * worldPos;
+#ifdef BACKWARD_MOTION
+    vposPrev = MVP_prev * worldPos;
+#endif
+#elif !defined(CUBE_LAYERS)
+    pos_next = MVP_next * worldPos;
+#ifdef BACKWARD_MOTION
+    pos_prev = MVP_prev * worldPos;
+#endif
+#endif
 }
\ No newline at end of file
@@ -3,8 +3,8 @@
 
 layout(location = 0) in vec4 position;
 
-
-uniform mat4 MV;
+#include "frame.glsl"
+#include "position.glsl"
 
 out gl_PerVertex {
     vec4 gl_Position;
@@ -12,5 +12,5 @@ out gl_PerVertex {
 
 void main()
 {
-    gl_Position = MV * position;
+    gl_Position = MV * DequantizePosition(position);
 }
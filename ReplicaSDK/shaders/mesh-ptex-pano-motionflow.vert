@@ -4,8 +4,8 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 MV_current;
-uniform mat4 MV_next;
+#include "frame.glsl"
+#include "position.glsl"
 
 out vec4 pos_next;
 
@@ -15,6 +15,7 @@ out gl_PerVertex {
 
 void main()
 {
-    gl_Position = MV_current * position;
-    pos_next = MV_next * position;
+    vec4 worldPos = DequantizePosition(position);
+    gl_Position = MV * worldPos;
+    pos_next = MV_next * worldPos;
 }
@@ -1,23 +1,49 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #version 430 core
+#ifdef BINDLESS_ATLAS
+#extension GL_ARB_bindless_texture : require
+#endif
 
 // #extension GL_GOOGLE_include_directive : require
 #include "atlas.glsl"
 
+#ifdef DEPTH_PREPASS
+// only the nearest fragments, which the prepass left, pass the depth test. Reject the rest before
+// they are shaded.
+layout(early_fragment_tests) in;
+#endif
+
 layout(location = 0) out vec4 FragColor;
-layout(binding = 0) uniform sampler2D atlasTex;
 
-uniform float exposure;
-uniform float gamma;
-uniform float saturation;
+#ifdef BINDLESS_ATLAS
+// every sub-mesh's atlas, so all of them can be drawn at once
+layout(std430, binding = 3) readonly buffer AtlasHandles
+{
+    uvec2 atlasHandles[];
+};
+#else
+layout(binding = 0) uniform sampler2D atlasTex;
+#endif
 
 in vec2 uv;
+flat in uint gsDrawIndex;
 
 void main()
 {
+    // the depth prepass runs the vertex stages alone
+#ifndef DEPTH_ONLY
+    SelectSubMesh(gsDrawIndex);
+
+#ifdef BINDLESS_ATLAS
+    sampler2D atlasTex = sampler2D(atlasHandles[gsDrawIndex]);
+#endif
+
     vec4 c = textureAtlas(atlasTex, gl_PrimitiveID, uv * tileSize);
+#ifdef TONE_MAPPING
     c *= exposure;
     applySaturation(c, saturation);
     c.rgb = pow(c.rgb, vec3(gamma));
+#endif
     FragColor = vec4(c.rgb, 1.0f);
+#endif
 }
\ No newline at end of file
@@ -3,7 +3,10 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 MV;
+#include "frame.glsl"
+#include "position.glsl"
+
+flat out uint vsDrawIndex;
 
 // out gl_PerVertex {
 //     vec4 gl_Position;
@@ -12,5 +15,6 @@ uniform mat4 MV;
 // not use
 void main()
 {
-    gl_Position = MV * position;
+    gl_Position = MV * DequantizePosition(position);
+    vsDrawIndex = drawIndex;
 }
@@ -1,22 +1,81 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #version 430 core
+#ifdef BINDLESS_ATLAS
+#extension GL_ARB_bindless_texture : require
+#endif
 #extension GL_GOOGLE_include_directive : enable
 #include "atlas.glsl"
 
+#ifdef DEPTH_PREPASS
+// only the nearest fragments, which the prepass left, pass the depth test. Reject the rest before
+// they are shaded.
+layout(early_fragment_tests) in;
+#endif
+
 layout(location = 0) out vec4 FragColor;
-layout(binding = 0) uniform sampler2D atlasTex;
 
-uniform float exposure;
-uniform float gamma;
-uniform float saturation;
+#ifdef COMBINED_OUTPUTS
+// the outputs of mesh-depth and mesh-motionflow, at PTexMesh::CombinedOutput
+#include "motion.glsl"
+layout(location = 1) out vec4 FragDepth;
+layout(location = 2) out vec4 FragMotionVector;
+
+in float gsDepth;
+in vec4 gsPos;
+in vec4 gsPosNext;
+
+#ifdef BACKWARD_MOTION
+layout(location = 3) out vec4 FragMotionVectorBackward;
+
+in vec4 gsPosPrev;
+#endif
+#endif
+
+#ifdef BINDLESS_ATLAS
+// every sub-mesh's atlas, so all of them can be drawn at once
+layout(std430, binding = 3) readonly buffer AtlasHandles
+{
+    uvec2 atlasHandles[];
+};
+#else
+layout(binding = 0) uniform sampler2D atlasTex;
+#endif
 
 in vec2 uv;
+flat in uint gsDrawIndex;
+
+#ifdef VERTEX_PULLING
+// quads are two triangles here, so gl_PrimitiveID does not count faces
+flat in int gsFace;
+#define FACE_ID gsFace
+#else
+#define FACE_ID gl_PrimitiveID
+#endif
 
 void main()
 {
-    vec4 c = textureAtlas(atlasTex, gl_PrimitiveID, uv * tileSize);
+    // the depth prepass runs the vertex stages alone
+#ifndef DEPTH_ONLY
+    SelectSubMesh(gsDrawIndex);
+
+#ifdef BINDLESS_ATLAS
+    sampler2D atlasTex = sampler2D(atlasHandles[gsDrawIndex]);
+#endif
+
+    vec4 c = textureAtlas(atlasTex, FACE_ID, uv * tileSize);
+#ifdef TONE_MAPPING
     c *= exposure;
     applySaturation(c, saturation);
     c.rgb = pow(c.rgb, vec3(gamma));
+#endif
     FragColor = vec4(c.rgb, 1.0f);
+
+#ifdef COMBINED_OUTPUTS
+    FragDepth = vec4(gsDepth.xxx * depthScale, 1.0f);
+    FragMotionVector = MotionVector(gsPos, gsPosNext);
+#ifdef BACKWARD_MOTION
+    FragMotionVectorBackward = MotionVector(gsPos, gsPosPrev);
+#endif
+#endif
+#endif
 }
@@ -3,11 +3,77 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 MVP;
-uniform vec4 clipPlane;
+#include "frame.glsl"
+#include "position.glsl"
+
+// the depth prepass runs these same stages, its depth must match exactly
+invariant gl_Position;
+
+#ifdef VERTEX_PULLING
+// without a geometry shader these go straight to the fragment shader
+out vec2 uv;
+flat out uint gsDrawIndex;
+flat out int gsFace;
+#else
+flat out uint vsDrawIndex;
+flat out uint vsFaceOffset;
+#endif
+
+#ifdef COMBINED_OUTPUTS
+// camera depth and the positions the motion vector is measured between, as mesh-depth and
+// mesh-motionflow compute them. The cube geometry shader finds them per face.
+#ifdef VERTEX_PULLING
+out float gsDepth;
+out vec4 gsPos;
+out vec4 gsPosNext;
+#ifdef BACKWARD_MOTION
+out vec4 gsPosPrev;
+#endif
+#elif !defined(CUBE_LAYERS)
+out float vsDepth;
+out vec4 vsPosNext;
+#ifdef BACKWARD_MOTION
+out vec4 vsPosPrev;
+#endif
+#endif
+#endif
 
 void main()
 {
-    gl_ClipDistance[0] = dot(position, clipPlane);
-    gl_Position = MVP * position;
+#ifdef VERTEX_PULLING
+    vec4 worldPos = DequantizePosition(PullPosition());
+    uv = PulledUV();
+    gsDrawIndex = drawIndex;
+    gsFace = AtlasFace(drawIndex, PulledFace());
+#else
+    vec4 worldPos = DequantizePosition(position);
+    vsDrawIndex = drawIndex;
+    vsFaceOffset = faceOffset;
+#endif
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(worldPos, clipPlane);
+#endif
+#ifdef CUBE_LAYERS
+    // projected into each face by the geometry shader
+    gl_Position = worldPos;
+#else
+    gl_Position = MVP * worldPos;
+#endif
+
+#ifdef COMBINED_OUTPUTS
+#ifdef VERTEX_PULLING
+    gsDepth = (MV * worldPos).z;
+    gsPos = gl_Position;
+    gsPosNext = MVP_next * worldPos;
+#ifdef BACKWARD_MOTION
+    gsPosPrev = MVP_prev * worldPos;
+#endif
+#elif !defined(CUBE_LAYERS)
+    vsDepth = (MV * worldPos).z;
+    vsPosNext = MVP_next * worldPos;
+#ifdef BACKWARD_MOTION
+    vsPosPrev = MVP_prev * worldPos;
+#endif
+#endif
+#endif
 }
@@ -0,0 +1,22 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Motion vectors of the perspective passes, shared by the motion vector and combined programs
+#ifndef MOTION_GLSL
+#define MOTION_GLSL
+
+#include "frame.glsl"
+
+// Image space motion from clip space position vpos to vposNext. Also outputs the target point's
+// z, to find points wrapping around.
+vec4 MotionVector(vec4 vpos, vec4 vposNext)
+{
+    float vpos_image_x = (vpos.x / vpos.w + 1.0f ) * 0.5 * windowSize.x;
+    float vposNext_image_x = (vposNext.x / vposNext.w + 1.0f ) * 0.5 * windowSize.x;
+    float diff_x_forward =  vposNext_image_x - vpos_image_x;
+    float vpos_image_y = (vpos.y / vpos.w + 1.0f ) * 0.5 * windowSize.y;
+    float vposNext_image_y = (vposNext.y / vposNext.w + 1.0f ) * 0.5 * windowSize.y;
+    float diff_y_forward = vposNext_image_y - vpos_image_y;
+
+    return vec4(diff_x_forward, diff_y_forward, vposNext.z, 1.0f);
+}
+
+#endif
@@ -0,0 +1,75 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Compact sub-meshes store positions as 16-bit fractions of their bounds' half extent around the
+// bounds' centre, full precision ones have an offset of 0 and a scale of 1
+#include "submesh.glsl"
+
+layout(location = 1) in uint drawIndex;
+
+// first face of the meshlet a draw starts at, gl_PrimitiveID counts from there
+layout(location = 2) in uint faceOffset;
+
+#ifdef VERTEX_PULLING
+// Quads drawn as 6 vertices each, the triangles the quad geometry shaders emit, with positions
+// fetched from the index and vertex buffers
+layout(std430, binding = 4) readonly buffer PulledVertices
+{
+#ifdef PULL_SHORT_POSITIONS
+    uint vertexData[]; // 4 snorm16 per vertex
+#else
+    float vertexData[]; // 3 floats per vertex
+#endif
+};
+
+layout(std430, binding = 5) readonly buffer PulledIndices
+{
+    uint indexData[]; // two 16-bit indices per entry with PULL_SHORT_INDICES
+};
+
+// face of the sub-mesh this vertex belongs to, draws start at a multiple of 6
+int PulledFace()
+{
+    return gl_VertexID / 6;
+}
+
+// corner of the quad, in the order (1, 0, 2) (2, 0, 3)
+int PulledCorner()
+{
+    const int corners[6] = int[6](1, 0, 2, 2, 0, 3);
+    return corners[gl_VertexID % 6];
+}
+
+// the quad UVs the geometry shaders assign each corner
+vec2 PulledUV()
+{
+    const vec2 uvs[4] = vec2[4](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+    return uvs[PulledCorner()];
+}
+
+// position as the vertex attribute would have read it
+vec4 PullPosition()
+{
+    uint index = subMeshes[drawIndex].firstIndex + uint(PulledFace() * 4 + PulledCorner());
+#ifdef PULL_SHORT_INDICES
+    uint vertex = (indexData[index >> 1] >> ((index & 1u) * 16u)) & 0xFFFFu;
+#else
+    uint vertex = indexData[index];
+#endif
+    vertex = uint(int(vertex) + subMeshes[drawIndex].baseVertex);
+
+#ifdef PULL_SHORT_POSITIONS
+    return vec4(unpackSnorm2x16(vertexData[vertex * 2u]),
+                unpackSnorm2x16(vertexData[vertex * 2u + 1u]));
+#else
+    return vec4(vertexData[vertex * 3u],
+                vertexData[vertex * 3u + 1u],
+                vertexData[vertex * 3u + 2u],
+                1.0);
+#endif
+}
+#endif
+
+vec4 DequantizePosition(vec4 position)
+{
+    return vec4(subMeshes[drawIndex].positionOffset.xyz +
+                subMeshes[drawIndex].positionScale.xyz * position.xyz, 1.0);
+}
@@ -0,0 +1,45 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Per sub-mesh parameters, matches PTexMesh::SubMeshData. Draws find theirs through the
+// instanced drawIndex attribute, selected by the draw's base instance.
+#ifndef SUBMESH_GLSL
+#define SUBMESH_GLSL
+
+struct SubMesh
+{
+    vec4 positionOffset;
+    vec4 positionScale;
+    int widthInTiles;
+    uint firstAdjacency;
+    uint compactAdjacency;
+    uint firstIndex;
+    int baseVertex;
+    uint firstFace;
+};
+
+layout(std430, binding = 2) readonly buffer SubMeshes
+{
+    SubMesh subMeshes[];
+};
+
+#ifdef FACE_ORDER_WINDOW
+// Faces are drawn reordered within each run of FACE_ORDER_WINDOW for the vertex cache, each has a
+// byte with its offset within the run in the order of the atlas tiles and adjacency
+layout(std430, binding = 6) readonly buffer FaceOrder
+{
+    uint faceOrder[]; // four bytes per entry
+};
+#endif
+
+// atlas tile of a face of a sub-mesh, numbered in draw order
+int AtlasFace(uint subMesh, int face)
+{
+#ifdef FACE_ORDER_WINDOW
+    uint i = subMeshes[subMesh].firstFace + uint(face);
+    int offset = int((faceOrder[i >> 2] >> ((i & 3u) * 8u)) & 0xFFu);
+    return face - face % FACE_ORDER_WINDOW + offset;
+#else
+    return face;
+#endif
+}
+
+#endif
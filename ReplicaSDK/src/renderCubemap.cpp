@@ -10,6 +10,7 @@
 
 #include <chrono>
 #include <filesystem>
+#include <memory>
 
 namespace fs = std::filesystem;
 
@@ -31,6 +32,156 @@ DEFINE_double(texture_exposure, 1.0, "The texture  exposure.");
 DEFINE_double(texture_gamma, 1.0, "The texture gamma.");
 DEFINE_double(texture_saturation, 1.0, "The texture saturation.");
 
+DEFINE_bool(meshCacheEnable, true, "Cache the pre-processed mesh on disk to speed up later runs.");
+DEFINE_string(meshCacheDir, "", "The mesh cache folder path, defaults to the atlas folder.");
+DEFINE_int32(meshMemoryBudgetMB, 0, "Host memory for building sub-meshes in MB, 0 builds all at once.");
+DEFINE_int32(atlasQueueDepth, 4, "Number of texture atlases read from disk ahead of the GPU upload.");
+DEFINE_int32(atlasBudgetMB, 0, "GPU memory for texture atlases in MB, 0 keeps all atlases resident.");
+DEFINE_int32(atlasPrefetchFrames, 2, "Number of upcoming camera poses whose atlases are prefetched.");
+DEFINE_bool(compactMeshes, false, "Store sub-meshes in 16-bit positions, indices and adjacency on the GPU.");
+DEFINE_bool(multiDrawEnable, true, "Draw all sub-meshes of a pass with one multi-draw call.");
+DEFINE_bool(occlusionCullingEnable, false, "Skip sub-meshes hidden behind others, reusing the visibility of earlier frames.");
+DEFINE_bool(meshletCullingEnable, true, "Skip runs of faces outside the view or facing away from the camera.");
+DEFINE_bool(vertexPullingEnable, false, "Draw quads as pulled triangles instead of through geometry shaders.");
+DEFINE_bool(vertexCacheOrderEnable, false, "Reorder faces and vertices of each sub-mesh for the post-transform vertex cache.");
+DEFINE_bool(depthPrepassEnable, false, "Draw depth first and shade each pixel of the RGB pass once.");
+DEFINE_bool(frontToBackEnable, true, "Draw the sub-meshes nearest to the camera first.");
+DEFINE_bool(overdrawStatsEnable, false, "Count the RGB pass samples passing the depth test per pixel, waiting for each pass.");
+DEFINE_bool(gpuTimeStatsEnable, false, "Time the draws of every pass on the GPU, waiting for each, to compare --vertexPullingEnable.");
+DEFINE_bool(paddedTilesEnable, false, "Filter atlas copies with bordered tiles instead of walking the adjacency.");
+DEFINE_bool(atlasMipmapsEnable, false, "Bake tile-aware mip levels of the atlases and sample the level matching each pixel.");
+DEFINE_bool(atlasLevelsForOutput, false, "With atlas mipmaps, skip the levels finer than the output size needs.");
+DEFINE_double(atlasNearDistance, 0.5, "Distance in metres up to which faces should show full detail with --atlasLevelsForOutput.");
+DEFINE_bool(atlasCompressionEnable, false, "Block compress the atlases once, BC7 for RGB and BC6H for HDR, and upload those.");
+DEFINE_bool(atlasCompressionBc1, false, "With atlas compression, compress RGB atlases to BC1 instead of BC7.");
+DEFINE_bool(bidirectionalFlowEnable, false, "Render the forward and backward motion vectors of each frame from one rasterization of it.");
+DEFINE_bool(combinedPassEnable, false, "Render RGB, depth and forward motion vectors in one pass, into multiple render targets.");
+DEFINE_bool(layeredCubemapEnable, false, "Render all six faces in one pass into layered framebuffers, unless there are mirrors.");
+DEFINE_bool(shaderCacheEnable, true, "Cache the linked shader programs on disk to speed up later runs.");
+DEFINE_string(shaderCacheDir, "", "The shader cache folder path, defaults to a folder in the system temp folder.");
+
+namespace {
+
+// Rotation from the camera to a face of the cubemap, and the face's abbreviation in file names
+Eigen::Matrix4d CubeFaceDirection(const int face_index, const char*& face_abbr) {
+  Eigen::Transform<double, 3, Eigen::Affine> t;
+  if (face_index == 0) {
+    // look +x axis
+    t = (Eigen::AngleAxis<double>(0.5 * M_PI, Eigen::Vector3d::UnitY()));
+    face_abbr = "R";
+  } else if (face_index == 1) {
+    // look -x axis
+    t = (Eigen::AngleAxis<double>(-0.5 * M_PI, Eigen::Vector3d::UnitY()));
+    face_abbr = "L";
+  } else if (face_index == 2) {
+    // look +y axis
+    t = (Eigen::AngleAxis<double>(0.5 * M_PI, Eigen::Vector3d::UnitX()));
+    face_abbr = "D";
+  } else if (face_index == 3) {
+    // look -y axis
+    t = (Eigen::AngleAxis<double>(-0.5 * M_PI, Eigen::Vector3d::UnitX()));
+    face_abbr = "U";
+  } else if (face_index == 4) {
+    // look +z axis
+    t = (Eigen::AngleAxis<double>(0, Eigen::Vector3d::UnitY()));
+    face_abbr = "F";
+  } else {
+    // look -z axis
+    t = (Eigen::AngleAxis<double>(M_PI, Eigen::Vector3d::UnitY()));
+    face_abbr = "B";
+  }
+  return t.matrix().inverse();
+}
+
+// All faces of a cubemap as the layers of 2D array textures, one per colour attachment, with a
+// layered depth buffer, for the RenderCube passes to draw at once
+class CubeLayers {
+ public:
+  CubeLayers(const int width, const int height, const std::vector<GLenum>& colourFormats)
+      : textures(colourFormats.size() + 1) {
+    glGenTextures(textures.size(), textures.data());
+
+    for (size_t i = 0; i < textures.size(); i++) {
+      const GLenum format = i < colourFormats.size() ? colourFormats[i] : GL_DEPTH_COMPONENT32F;
+      glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, format, width, height, PTexMesh::CUBE_FACES);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // attaching whole arrays makes the framebuffer layered
+    glGenFramebuffers(1, &fbid);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbid);
+    std::vector<GLenum> drawBuffers;
+    for (size_t i = 0; i < colourFormats.size(); i++) {
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textures[i], 0);
+      drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+    }
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures.back(), 0);
+    glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  ~CubeLayers() {
+    glDeleteFramebuffers(1, &fbid);
+    glDeleteTextures(textures.size(), textures.data());
+  }
+
+  CubeLayers(const CubeLayers&) = delete;
+  CubeLayers& operator=(const CubeLayers&) = delete;
+
+  void Bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbid);
+  }
+
+  void Unbind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  // every face of a colour attachment, one after the other
+  void Download(const int attachment, void* data, const GLenum format, const GLenum type) const {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textures[attachment]);
+    glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, format, type, data);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  }
+
+  GLuint fbid = 0;
+
+ private:
+  std::vector<GLuint> textures; // colour attachments, then depth
+};
+
+// Draws the combined pass outputs of the enabled modalities only, call after binding
+void SelectCombinedOutputs(
+    const bool rgb,
+    const bool depth,
+    const bool motionVector,
+    const bool backwardMotionVector) {
+  const GLenum drawBuffers[] = {
+      rgb ? GLenum(GL_COLOR_ATTACHMENT0 + PTexMesh::COMBINED_RGB) : GLenum(GL_NONE),
+      depth ? GLenum(GL_COLOR_ATTACHMENT0 + PTexMesh::COMBINED_DEPTH) : GLenum(GL_NONE),
+      motionVector ? GLenum(GL_COLOR_ATTACHMENT0 + PTexMesh::COMBINED_MOTION_VECTOR)
+                   : GLenum(GL_NONE),
+      backwardMotionVector
+          ? GLenum(GL_COLOR_ATTACHMENT0 + PTexMesh::COMBINED_MOTION_VECTOR_BACKWARD)
+          : GLenum(GL_NONE)};
+  glDrawBuffers(4, drawBuffers);
+}
+
+// Each combined pass output starts as its own pass would clear it
+void ClearCombinedOutputs(const GLuint fbid, const GLfloat* depthClearValue) {
+  const GLfloat motionVectorClearValue[] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+  glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+  glClearNamedFramebufferfv(fbid, GL_COLOR, PTexMesh::COMBINED_DEPTH, depthClearValue);
+  glClearNamedFramebufferfv(
+      fbid, GL_COLOR, PTexMesh::COMBINED_MOTION_VECTOR, motionVectorClearValue);
+  glClearNamedFramebufferfv(
+      fbid, GL_COLOR, PTexMesh::COMBINED_MOTION_VECTOR_BACKWARD, motionVectorClearValue);
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
   auto model_start = std::chrono::high_resolution_clock::now();
 
@@ -70,6 +221,8 @@ int main(int argc, char* argv[]) {
   if (renderDepth) LOG(INFO) << "Render depth maps.";
   bool renderMotionFlow = FLAGS_renderMotionVectorEnable;
   if (renderMotionFlow) LOG(INFO) << "Render Motion Vector.";
+  // the backward motion vectors of each frame are seen from it, so one pass can write both
+  const bool bidirectional = renderMotionFlow && FLAGS_bidirectionalFlowEnable;
   bool renderRGB = FLAGS_renderRGBEnable;
   if (renderRGB) LOG(INFO) << "Render RGB images.";
 
@@ -108,6 +261,24 @@ int main(int argc, char* argv[]) {
   pangolin::GlFramebuffer depthFrameBuffer(depthTexture, renderBuffer); // to render depth image
   pangolin::GlTexture opticalflowTexture(width, height, GL_RGBA32F);
   pangolin::GlFramebuffer opticalflowFrameBuffer(opticalflowTexture, renderBuffer); // to render motion 
+  pangolin::GlTexture opticalflowBackwardTexture(width, height, GL_RGBA32F);
+  // the same textures, filled at once by the combined pass, attachments as in PTexMesh::CombinedOutput
+  pangolin::GlFramebuffer combinedFrameBuffer;
+  if (FLAGS_combinedPassEnable) {
+    combinedFrameBuffer.AttachColour(render);
+    combinedFrameBuffer.AttachColour(depthTexture);
+    combinedFrameBuffer.AttachColour(opticalflowTexture);
+    if (bidirectional)
+      combinedFrameBuffer.AttachColour(opticalflowBackwardTexture);
+    combinedFrameBuffer.AttachDepth(renderBuffer);
+  }
+  // forward and backward optical flow of the same frame
+  pangolin::GlFramebuffer bidirectionalFrameBuffer;
+  if (bidirectional) {
+    bidirectionalFrameBuffer.AttachColour(opticalflowTexture);
+    bidirectionalFrameBuffer.AttachColour(opticalflowBackwardTexture);
+    bidirectionalFrameBuffer.AttachDepth(renderBuffer);
+  }
 
   // 2) load camera pose
   std::vector<pangolin::OpenGlMatrix> cameraMV;
@@ -131,6 +302,8 @@ int main(int argc, char* argv[]) {
       pangolin::ModelViewLookAtRDF(1, 0, 0, 0, 0, -1, 0, 1, 0));
   pangolin::OpenGlRenderState s_cam_next;
   s_cam_next.GetProjectionMatrix() = s_cam_current.GetProjectionMatrix();
+  pangolin::OpenGlRenderState s_cam_prev;
+  s_cam_prev.GetProjectionMatrix() = s_cam_current.GetProjectionMatrix();
 
   // load mirrors
   std::vector<MirrorSurface> mirrors;
@@ -146,86 +319,324 @@ int main(int argc, char* argv[]) {
   }
 
   // load mesh and textures
-  PTexMesh ptexMesh(meshFile, atlasFolder);
+  PTexMeshOptions meshOptions;
+  meshOptions.meshCacheEnable = FLAGS_meshCacheEnable;
+  meshOptions.meshCacheDir = FLAGS_meshCacheDir;
+  meshOptions.meshMemoryBudgetBytes = size_t(std::max(FLAGS_meshMemoryBudgetMB, 0)) * 1024 * 1024;
+  meshOptions.atlasQueueDepth = FLAGS_atlasQueueDepth;
+  meshOptions.atlasBudgetBytes = size_t(std::max(FLAGS_atlasBudgetMB, 0)) * 1024 * 1024;
+  meshOptions.compactMeshes = FLAGS_compactMeshes;
+  meshOptions.multiDrawEnable = FLAGS_multiDrawEnable;
+  meshOptions.occlusionCullingEnable = FLAGS_occlusionCullingEnable;
+  meshOptions.meshletCullingEnable = FLAGS_meshletCullingEnable;
+  meshOptions.vertexPullingEnable = FLAGS_vertexPullingEnable;
+  meshOptions.vertexCacheOrderEnable = FLAGS_vertexCacheOrderEnable;
+  meshOptions.depthPrepassEnable = FLAGS_depthPrepassEnable;
+  meshOptions.frontToBackEnable = FLAGS_frontToBackEnable;
+  meshOptions.overdrawStatsEnable = FLAGS_overdrawStatsEnable;
+  meshOptions.gpuTimeStatsEnable = FLAGS_gpuTimeStatsEnable;
+  meshOptions.paddedTilesEnable = FLAGS_paddedTilesEnable;
+  meshOptions.atlasMipmapsEnable = FLAGS_atlasMipmapsEnable;
+  if (FLAGS_atlasLevelsForOutput) {
+    meshOptions.atlasTargetWidth = width;
+    // each cube face spans 90 degrees
+    meshOptions.atlasTargetFov = M_PI / 2.0f;
+    meshOptions.atlasNearDistance = FLAGS_atlasNearDistance;
+  }
+  meshOptions.atlasCompressionEnable = FLAGS_atlasCompressionEnable;
+  meshOptions.atlasCompressionBc1 = FLAGS_atlasCompressionBc1;
+  // mirrors are captured and composited one face at a time
+  const bool layered = FLAGS_layeredCubemapEnable && mirrors.empty();
+  if (FLAGS_layeredCubemapEnable && !layered)
+    LOG(WARNING) << "Mirrors are rendered one face at a time, not using layered cubemaps.";
+  meshOptions.layeredCubemapEnable = layered;
+  const bool combinedPass = FLAGS_combinedPassEnable;
+  meshOptions.combinedPassEnable = combinedPass;
+  meshOptions.bidirectionalFlowEnable = bidirectional;
+  meshOptions.shaderCacheEnable = FLAGS_shaderCacheEnable;
+  if (!FLAGS_shaderCacheDir.empty())
+    meshOptions.shaderCacheDir = FLAGS_shaderCacheDir;
+  PTexMesh ptexMesh(meshFile, atlasFolder, false, meshOptions);
   ptexMesh.SetExposure(FLAGS_texture_exposure);
   ptexMesh.SetGamma(FLAGS_texture_gamma);
   ptexMesh.SetSaturation(FLAGS_texture_saturation);
   const std::string shadir = STR(SHADER_DIR);
-  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir);
+  MirrorRenderer mirrorRenderer(
+      mirrors,
+      width,
+      height,
+      shadir,
+      meshOptions.shaderCacheEnable ? meshOptions.shaderCacheDir : std::string());
 
   // Render some frames
   pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> image(width, height);
   pangolin::ManagedImage<Eigen::Matrix<float, 1, 1>> depthImage(width, height);
   pangolin::ManagedImage<Eigen::Matrix<float, 4, 1>> opticalFlow_forward(width, height);
   pangolin::ManagedImage<Eigen::Matrix<float, 4, 1>> opticalFlow_backward(width, height);
+
+  // faces stacked vertically, as the layers download
+  std::unique_ptr<CubeLayers> renderLayers, depthLayers, opticalflowLayers, combinedLayers;
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> cubeImage;
+  pangolin::ManagedImage<Eigen::Matrix<float, 1, 1>> cubeDepthImage;
+  pangolin::ManagedImage<Eigen::Matrix<float, 4, 1>> cubeOpticalFlow;
+  if (layered) {
+    LOG(INFO) << "Render all cubemap faces in one pass.";
+    const int cubeHeight = height * PTexMesh::CUBE_FACES;
+    if (combinedPass) {
+      std::vector<GLenum> formats = {GL_RGBA8, GL_R32F, GL_RGBA32F};
+      if (bidirectional)
+        formats.push_back(GL_RGBA32F);
+      combinedLayers.reset(new CubeLayers(width, height, formats));
+    }
+    if (renderRGB) {
+      if (!combinedPass)
+        renderLayers.reset(new CubeLayers(width, height, {GL_RGBA8}));
+      cubeImage.Reinitialise(width, cubeHeight);
+    }
+    if (renderDepth) {
+      if (!combinedPass)
+        depthLayers.reset(new CubeLayers(width, height, {GL_R32F}));
+      cubeDepthImage.Reinitialise(width, cubeHeight);
+    }
+    if (renderMotionFlow) {
+      // unless bidirectional, the backward motion vectors are seen from the next frame, in a
+      // pass of their own
+      if (!bidirectional)
+        opticalflowLayers.reset(new CubeLayers(width, height, {GL_RGBA32F}));
+      else if (!combinedPass)
+        opticalflowLayers.reset(new CubeLayers(width, height, {GL_RGBA32F, GL_RGBA32F}));
+      cubeOpticalFlow.Reinitialise(width, cubeHeight);
+    }
+  }
   const size_t numFrames = cameraMV.size();
   for (size_t frame_index = 0; frame_index < numFrames; frame_index++)
   {
     LOG(INFO) << "\rRendering frame " << frame_index + 1 << "/" << numFrames << "... ";
 
+    // stream in the atlases around the current and upcoming poses
+    std::vector<pangolin::OpenGlMatrix> upcomingMV;
+    for (size_t i = frame_index; i < numFrames && i <= frame_index + FLAGS_atlasPrefetchFrames; i++)
+      upcomingMV.push_back(cameraMV[i]);
+    ptexMesh.PrefetchAtlases(upcomingMV);
+
     // 0) load & update the camera pose & MV matrix
     s_cam_current.SetModelViewMatrix(cameraMV[frame_index]);
     s_cam_next.SetModelViewMatrix(cameraMV[(frame_index + 1) % numFrames]);
+    s_cam_prev.SetModelViewMatrix(cameraMV[(frame_index + numFrames - 1) % numFrames]);
     Eigen::Matrix4d s_cam_current_mv = s_cam_current.GetModelViewMatrix();
     Eigen::Matrix4d s_cam_next_mv = s_cam_next.GetModelViewMatrix();
+    Eigen::Matrix4d s_cam_prev_mv = s_cam_prev.GetModelViewMatrix();
 
-    for (int face_index = 0; face_index < 6; ++face_index)
+    if (layered)
     {
-        Eigen::Transform<double, 3, Eigen::Affine> t;
-        const char *  face_abbr;
-        if (face_index == 0)
+        std::vector<pangolin::OpenGlRenderState> faceCams(PTexMesh::CUBE_FACES, s_cam_current);
+        std::vector<pangolin::OpenGlRenderState> faceCamsNext(PTexMesh::CUBE_FACES, s_cam_next);
+        std::vector<pangolin::OpenGlRenderState> faceCamsPrev(PTexMesh::CUBE_FACES, s_cam_prev);
+        const char* faceAbbrs[PTexMesh::CUBE_FACES];
+        for (int face_index = 0; face_index < PTexMesh::CUBE_FACES; ++face_index)
         {
-            // look +x axis
-            t = (Eigen::AngleAxis<double>(0.5 * M_PI, Eigen::Vector3d::UnitY()));
-            face_abbr = "R";
+            Eigen::Matrix4d camera_direction = CubeFaceDirection(face_index, faceAbbrs[face_index]);
+            faceCams[face_index].GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_current_mv);
+            faceCamsNext[face_index].GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_next_mv);
+            faceCamsPrev[face_index].GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_prev_mv);
         }
-        else if (face_index == 1)
-        {
-            // look -x axis
-            t = (Eigen::AngleAxis<double>(-0.5 * M_PI, Eigen::Vector3d::UnitY()));
-            face_abbr = "L";
-        }
-        else if (face_index == 2)
+
+        // the same passes and files as the per-face loop below
+        if (combinedPass)
         {
-            // look +y axis
-            t = (Eigen::AngleAxis<double>(0.5 * M_PI, Eigen::Vector3d::UnitX()));
-            face_abbr = "D";
+            LOG(INFO) << "Render CubeMap combined outputs " << frame_index << " all faces";
+            combinedLayers->Bind();
+            SelectCombinedOutputs(renderRGB, renderDepth, renderMotionFlow, bidirectional);
+            glPushAttrib(GL_VIEWPORT_BIT);
+            glViewport(0, 0, width, height);
+            ClearCombinedOutputs(combinedLayers->fbid, depthClearValue);
+            glEnable(GL_CULL_FACE);
+            ptexMesh.RenderCubeCombined(faceCams, faceCamsNext, width, height, 1.0, bidirectional ? &faceCamsPrev : nullptr);
+            glDisable(GL_CULL_FACE);
+            const PTexMesh::CullStats& faceStats = ptexMesh.GetLastCullStats();
+            // per pass at --v=1, the totals over the run are logged at the end
+            VLOG(1) << "Drew " << faceStats.drawn << " sub-meshes, culled " << faceStats.culled
+                    << ", and " << faceStats.meshletsDrawn << " meshlets, culled "
+                    << faceStats.meshletsCulled;
+            glPopAttrib(); //GL_VIEWPORT_BIT
+            combinedLayers->Unbind();
         }
-        else if (face_index == 3)
+
+        if (renderRGB)
         {
-            // look -y axis
-            t = (Eigen::AngleAxis<double>(-0.5 * M_PI, Eigen::Vector3d::UnitX()));
-            face_abbr = "U";
+            if (!combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap RGB images " << frame_index << " all faces";
+                renderLayers->Bind();
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glEnable(GL_CULL_FACE);
+                ptexMesh.RenderCube(faceCams);
+                glDisable(GL_CULL_FACE);
+                const PTexMesh::CullStats& faceStats = ptexMesh.GetLastCullStats();
+                VLOG(1) << "Drew " << faceStats.drawn << " sub-meshes, culled " << faceStats.culled
+                        << ", and " << faceStats.meshletsDrawn << " meshlets, culled "
+                        << faceStats.meshletsCulled;
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                renderLayers->Unbind();
+                renderLayers->Download(0, cubeImage.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+            }
+            else
+            {
+                combinedLayers->Download(PTexMesh::COMBINED_RGB, cubeImage.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+            }
+
+            for (int face_index = 0; face_index < PTexMesh::CUBE_FACES; ++face_index)
+            {
+                char cubemapFilename[1024];
+                snprintf(cubemapFilename, 1024, "%s/%s_%04zu_%s_rgb.jpg", outputDir.c_str(), prefix_fn.c_str(), frame_index, faceAbbrs[face_index]);
+                pangolin::SaveImage(cubeImage.SubImage(0, face_index * height, width, height).UnsafeReinterpret<uint8_t>(),
+                    pangolin::PixelFormatFromString("RGB24"),
+                    std::string(cubemapFilename));
+            }
         }
-        else if (face_index == 4)
+
+        if (renderDepth)
         {
-            //look +z axis
-            t = (Eigen::AngleAxis<double>(0, Eigen::Vector3d::UnitY()));
-            face_abbr = "F";
+            if (!combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap depth maps " << frame_index << " all faces";
+                depthLayers->Bind();
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glClearNamedFramebufferfv(depthLayers->fbid, GL_COLOR, 0, depthClearValue);
+                glEnable(GL_CULL_FACE);
+                ptexMesh.RenderCubeDepth(faceCams, 1.0);
+                glDisable(GL_CULL_FACE);
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                depthLayers->Unbind();
+                depthLayers->Download(0, cubeDepthImage.ptr, GL_RED, GL_FLOAT);
+            }
+            else
+            {
+                combinedLayers->Download(PTexMesh::COMBINED_DEPTH, cubeDepthImage.ptr, GL_RED, GL_FLOAT);
+            }
+
+            for (int face_index = 0; face_index < PTexMesh::CUBE_FACES; ++face_index)
+            {
+                char depthfilename[1024];
+                snprintf(depthfilename, 1024, "%s/%s_%04zu_%s_depth.dpt", outputDir.c_str(), prefix_fn.c_str(), frame_index, faceAbbrs[face_index]);
+                saveDepthmap2dpt(depthfilename, cubeDepthImage.RowPtr(face_index * height), width, height);
+            }
         }
-        else if (face_index == 5)
+
+        if (renderMotionFlow)
         {
-            //look -z axis
-            t = (Eigen::AngleAxis<double>(M_PI, Eigen::Vector3d::UnitY()));
-            face_abbr = "B";
+            // bidirectional passes write both directions of this frame, seen from this frame
+            if (bidirectional && !combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap depth bidirectional optical flow " << frame_index << " all faces";
+                opticalflowLayers->Bind();
+                glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glEnable(GL_CULL_FACE);
+                ptexMesh.RenderCubeMotionVectors(faceCamsPrev, faceCams, faceCamsNext, width, height);
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                opticalflowLayers->Unbind();
+            }
+
+            // forward (current frame to next frame), then backward (next frame to current frame,
+            // or current frame to previous frame when bidirectional)
+            for (int backward = 0; backward < 2; ++backward)
+            {
+                if (combinedPass && (bidirectional || !backward))
+                {
+                    combinedLayers->Download(backward ? PTexMesh::COMBINED_MOTION_VECTOR_BACKWARD : PTexMesh::COMBINED_MOTION_VECTOR, cubeOpticalFlow.ptr, GL_RGBA, GL_FLOAT);
+                }
+                else if (bidirectional)
+                {
+                    opticalflowLayers->Download(backward, cubeOpticalFlow.ptr, GL_RGBA, GL_FLOAT);
+                }
+                else
+                {
+                    LOG(INFO) << "Render CubeMap depth " << (backward ? "backward" : "forward") << " optical flow " << frame_index << " all faces";
+                    opticalflowLayers->Bind();
+                    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+                    glPushAttrib(GL_VIEWPORT_BIT);
+                    glViewport(0, 0, width, height);
+                    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                    glEnable(GL_CULL_FACE);
+                    if (backward)
+                        ptexMesh.RenderCubeMotionVector(faceCamsNext, faceCams, width, height);
+                    else
+                        ptexMesh.RenderCubeMotionVector(faceCams, faceCamsNext, width, height);
+                    glPopAttrib(); //GL_VIEWPORT_BIT
+                    opticalflowLayers->Unbind();
+                    opticalflowLayers->Download(0, cubeOpticalFlow.ptr, GL_RGBA, GL_FLOAT);
+                }
+
+                for (int face_index = 0; face_index < PTexMesh::CUBE_FACES; ++face_index)
+                {
+                    char filename[1024];
+                    if (backward)
+                        snprintf(filename, 1024, "%s/%s_%04zu_%s_motionvector_backward.flo", outputDir.c_str(), prefix_fn.c_str(), bidirectional ? frame_index : (frame_index + 1) % numFrames, faceAbbrs[face_index]);
+                    else
+                        snprintf(filename, 1024, "%s/%s_%04zu_%s_motionvector_forward.flo", outputDir.c_str(), prefix_fn.c_str(), frame_index, faceAbbrs[face_index]);
+                    saveMotionVector(filename, cubeOpticalFlow.RowPtr(face_index * height), width, height, true); // output optical flow to file
+                }
+            }
         }
-        Eigen::Matrix4d camera_direction = t.matrix().inverse();
+        continue;
+    }
+
+    for (int face_index = 0; face_index < 6; ++face_index)
+    {
+        const char *  face_abbr;
+        Eigen::Matrix4d camera_direction = CubeFaceDirection(face_index, face_abbr);
         s_cam_current.GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_current_mv);
         s_cam_next.GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_next_mv);
+        s_cam_prev.GetModelViewMatrix() = Eigen::Matrix4d(camera_direction * s_cam_prev_mv);
 
         // Render
-        if (renderRGB)
+        if (combinedPass)
         {
-            LOG(INFO) << "Render CubeMap RGB images " << frame_index << " face " << face_abbr;
-            frameBuffer.Bind();
+            LOG(INFO) << "Render CubeMap combined outputs " << frame_index << " face " << face_abbr;
+            combinedFrameBuffer.Bind();
+            SelectCombinedOutputs(renderRGB, renderDepth, renderMotionFlow, bidirectional);
             glPushAttrib(GL_VIEWPORT_BIT);
             glViewport(0, 0, width, height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+            ClearCombinedOutputs(combinedFrameBuffer.fbid, depthClearValue);
             glEnable(GL_CULL_FACE);
-            ptexMesh.Render(s_cam_current);
+            ptexMesh.RenderCombined(s_cam_current, s_cam_next, width, height, 1.0, Eigen::Vector4f::Zero(), bidirectional ? &s_cam_prev : nullptr);
             glDisable(GL_CULL_FACE);
+            const PTexMesh::CullStats& faceStats = ptexMesh.GetLastCullStats();
+            VLOG(1) << "Drew " << faceStats.drawn << " sub-meshes, culled " << faceStats.culled
+                    << ", occluded " << faceStats.occluded << ", and "
+                    << faceStats.meshletsDrawn << " meshlets, culled "
+                    << faceStats.meshletsCulled;
             glPopAttrib(); //GL_VIEWPORT_BIT
-            frameBuffer.Unbind();
+            combinedFrameBuffer.Unbind();
+        }
+
+        if (renderRGB)
+        {
+            if (!combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap RGB images " << frame_index << " face " << face_abbr;
+                frameBuffer.Bind();
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glEnable(GL_CULL_FACE);
+                ptexMesh.Render(s_cam_current);
+                glDisable(GL_CULL_FACE);
+                const PTexMesh::CullStats& faceStats = ptexMesh.GetLastCullStats();
+                VLOG(1) << "Drew " << faceStats.drawn << " sub-meshes, culled " << faceStats.culled
+                        << ", occluded " << faceStats.occluded << ", and "
+                        << faceStats.meshletsDrawn << " meshlets, culled "
+                        << faceStats.meshletsCulled;
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                frameBuffer.Unbind();
+            }
 
             for (size_t face_index = 0; face_index < mirrors.size(); face_index++)
             {
@@ -252,17 +663,20 @@ int main(int argc, char* argv[]) {
 
         if (renderDepth) 
         {
-            LOG(INFO) << "Render CubeMap depth maps " << frame_index << " face " << face_abbr;
-            depthFrameBuffer.Bind();
-            glPushAttrib(GL_VIEWPORT_BIT);
-            glViewport(0, 0, width, height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-            glClearNamedFramebufferfv(depthFrameBuffer.fbid, GL_COLOR, 0, depthClearValue);
-            glEnable(GL_CULL_FACE);
-            ptexMesh.RenderDepth(s_cam_current, 1.0);
-            glDisable(GL_CULL_FACE);
-            glPopAttrib(); //GL_VIEWPORT_BIT
-            depthFrameBuffer.Unbind();
+            if (!combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap depth maps " << frame_index << " face " << face_abbr;
+                depthFrameBuffer.Bind();
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                glClearNamedFramebufferfv(depthFrameBuffer.fbid, GL_COLOR, 0, depthClearValue);
+                glEnable(GL_CULL_FACE);
+                ptexMesh.RenderDepth(s_cam_current, 1.0);
+                glDisable(GL_CULL_FACE);
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                depthFrameBuffer.Unbind();
+            }
             depthTexture.Download(depthImage.ptr, GL_RED, GL_FLOAT);
             char depthfilename[1024];
             snprintf(depthfilename, 1024, "%s/%s_%04zu_%s_depth.dpt", outputDir.c_str(), prefix_fn.c_str(), frame_index, face_abbr);
@@ -271,29 +685,45 @@ int main(int argc, char* argv[]) {
 
         if (renderMotionFlow)
         {
-            LOG(INFO) << "Render CubeMap depth forward optical flow " << frame_index << " face " << face_abbr;
-            // 0) render optical flow (current frame to next frame)
-            opticalflowFrameBuffer.Bind();
-            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-            glPushAttrib(GL_VIEWPORT_BIT);
-            glViewport(0, 0, width, height);
-            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-            // glFrontFace(GL_CCW);      //Don't draw backfaces
-            glEnable(GL_CULL_FACE);
-            // glDisable(GL_CULL_FACE);
-            // glDisable(GL_LINE_SMOOTH);
-            // glDisable(GL_POLYGON_SMOOTH);
-            // glDisable(GL_MULTISAMPLE);
-            ptexMesh.RenderMotionVector(s_cam_current, s_cam_next, width, height);
-            // glEnable(GL_MULTISAMPLE);
-            glPopAttrib(); //GL_VIEWPORT_BIT
-            opticalflowFrameBuffer.Unbind();
+            // 0) render optical flow (current frame to next frame), unless the combined pass did.
+            // Bidirectional passes write the backward optical flow of this frame as well.
+            if (!combinedPass)
+            {
+                LOG(INFO) << "Render CubeMap depth " << (bidirectional ? "bidirectional" : "forward") << " optical flow " << frame_index << " face " << face_abbr;
+                (bidirectional ? bidirectionalFrameBuffer : opticalflowFrameBuffer).Bind();
+                glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+                glPushAttrib(GL_VIEWPORT_BIT);
+                glViewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+                // glFrontFace(GL_CCW);      //Don't draw backfaces
+                glEnable(GL_CULL_FACE);
+                // glDisable(GL_CULL_FACE);
+                // glDisable(GL_LINE_SMOOTH);
+                // glDisable(GL_POLYGON_SMOOTH);
+                // glDisable(GL_MULTISAMPLE);
+                if (bidirectional)
+                    ptexMesh.RenderMotionVectors(s_cam_prev, s_cam_current, s_cam_next, width, height);
+                else
+                    ptexMesh.RenderMotionVector(s_cam_current, s_cam_next, width, height);
+                // glEnable(GL_MULTISAMPLE);
+                glPopAttrib(); //GL_VIEWPORT_BIT
+                (bidirectional ? bidirectionalFrameBuffer : opticalflowFrameBuffer).Unbind();
+            }
             opticalflowTexture.Download(opticalFlow_forward.ptr, GL_RGBA, GL_FLOAT);
             char filename[1024];
             snprintf(filename, 1024, "%s/%s_%04zu_%s_motionvector_forward.flo", outputDir.c_str(), prefix_fn.c_str(), frame_index, face_abbr);
             saveMotionVector(filename, opticalFlow_forward.ptr, width, height, true); // output optical flow to file
             // save the target points depth.
 
+            if (bidirectional)
+            {
+                // 1) this frame to the previous frame, seen from this frame like the forward flow
+                opticalflowBackwardTexture.Download(opticalFlow_backward.ptr, GL_RGBA, GL_FLOAT);
+                snprintf(filename, 1024, "%s/%s_%04zu_%s_motionvector_backward.flo", outputDir.c_str(), prefix_fn.c_str(), frame_index, face_abbr);
+                saveMotionVector(filename, opticalFlow_backward.ptr, width, height, true); // output optical flow to file
+                continue;
+            }
+
             // 1) render optical flow (next frame to current frame)
             LOG(INFO) << "Render CubeMap depth backward optical flow " << frame_index << " face " << face_abbr;
             opticalflowFrameBuffer.Bind();
@@ -317,6 +747,38 @@ int main(int argc, char* argv[]) {
         }
     }
   }
+  if (FLAGS_atlasBudgetMB > 0) {
+    const AtlasResidency::Stats& atlasStats = ptexMesh.GetAtlasStats();
+    LOG(INFO) << "Atlas residency: " << atlasStats.hits << " hits, " << atlasStats.misses
+              << " misses, " << atlasStats.evictions << " evictions, " << atlasStats.uploads
+              << " uploads, peak " << atlasStats.peakResidentBytes / (1024 * 1024) << " MB resident";
+  }
+
+  const PTexMesh::CullStats& cullStats = ptexMesh.GetCullStats();
+  if (cullStats.passes > 0) {
+    LOG(INFO) << "Culling: " << cullStats.passes << " passes drew "
+              << cullStats.drawn / cullStats.passes << " and culled "
+              << cullStats.culled / cullStats.passes << " and occluded "
+              << cullStats.occluded / cullStats.passes << " sub-meshes on average, testing "
+              << cullStats.boxesTested / cullStats.passes << " boxes";
+    LOG(INFO) << "Meshlets: drew " << cullStats.meshletsDrawn / cullStats.passes << " and culled "
+              << cullStats.meshletsCulled / cullStats.passes << " per pass on average";
+  }
+
+  const PTexMesh::OverdrawStats& overdrawStats = ptexMesh.GetOverdrawStats();
+  if (overdrawStats.pixels > 0) {
+    LOG(INFO) << "Overdraw: " << overdrawStats.passes << " RGB passes passed the depth test for "
+              << (double)overdrawStats.samplesPassed / overdrawStats.pixels
+              << " samples per pixel";
+  }
+
+  const PTexMesh::GpuTimeStats& gpuTimeStats = ptexMesh.GetGpuTimeStats();
+  if (gpuTimeStats.batches > 0) {
+    LOG(INFO) << "GPU: " << gpuTimeStats.batches << " batches of draws took "
+              << gpuTimeStats.nanoseconds / 1e6 << " ms, "
+              << gpuTimeStats.nanoseconds / 1e3 / gpuTimeStats.batches << " us on average";
+  }
+
   auto model_stop = std::chrono::high_resolution_clock::now();
   auto model_duration = std::chrono::duration_cast<std::chrono::microseconds>(model_stop - model_start);
 
@@ -31,6 +31,32 @@ DEFINE_double(texture_exposure, 1.0, "The texture  exposure.");
 DEFINE_double(texture_gamma, 1.0, "The texture gamma.");
 DEFINE_double(texture_saturation, 1.0, "The texture saturation.");
 
+DEFINE_bool(meshCacheEnable, true, "Cache the pre-processed mesh on disk to speed up later runs.");
+DEFINE_string(meshCacheDir, "", "The mesh cache folder path, defaults to the atlas folder.");
+DEFINE_int32(meshMemoryBudgetMB, 0, "Host memory for building sub-meshes in MB, 0 builds all at once.");
+DEFINE_int32(atlasQueueDepth, 4, "Number of texture atlases read from disk ahead of the GPU upload.");
+DEFINE_int32(atlasBudgetMB, 0, "GPU memory for texture atlases in MB, 0 keeps all atlases resident.");
+DEFINE_int32(atlasPrefetchFrames, 2, "Number of upcoming camera poses whose atlases are prefetched.");
+DEFINE_bool(compactMeshes, false, "Store sub-meshes in 16-bit positions, indices and adjacency on the GPU.");
+DEFINE_bool(multiDrawEnable, true, "Draw all sub-meshes of a pass with one multi-draw call.");
+DEFINE_bool(occlusionCullingEnable, false, "Skip sub-meshes hidden behind others, reusing the visibility of earlier frames.");
+DEFINE_bool(meshletCullingEnable, true, "Skip runs of faces outside the view or facing away from the camera.");
+DEFINE_bool(vertexPullingEnable, false, "Draw quads as pulled triangles instead of through geometry shaders.");
+DEFINE_bool(vertexCacheOrderEnable, false, "Reorder faces and vertices of each sub-mesh for the post-transform vertex cache.");
+DEFINE_bool(depthPrepassEnable, false, "Draw depth first and shade each pixel of the RGB pass once.");
+DEFINE_bool(frontToBackEnable, true, "Draw the sub-meshes nearest to the camera first.");
+DEFINE_bool(overdrawStatsEnable, false, "Count the RGB pass samples passing the depth test per pixel, waiting for each pass.");
+DEFINE_bool(gpuTimeStatsEnable, false, "Time the draws of every pass on the GPU, waiting for each, to compare --vertexPullingEnable.");
+DEFINE_bool(panoFlowWrapAround, false, "Let motion vectors crossing the panorama seam wrap around it.");
+DEFINE_bool(paddedTilesEnable, false, "Filter atlas copies with bordered tiles instead of walking the adjacency.");
+DEFINE_bool(atlasMipmapsEnable, false, "Bake tile-aware mip levels of the atlases and sample the level matching each pixel.");
+DEFINE_bool(atlasLevelsForOutput, false, "With atlas mipmaps, skip the levels finer than the output size needs.");
+DEFINE_double(atlasNearDistance, 0.5, "Distance in metres up to which faces should show full detail with --atlasLevelsForOutput.");
+DEFINE_bool(atlasCompressionEnable, false, "Block compress the atlases once, BC7 for RGB and BC6H for HDR, and upload those.");
+DEFINE_bool(atlasCompressionBc1, false, "With atlas compression, compress RGB atlases to BC1 instead of BC7.");
+DEFINE_bool(shaderCacheEnable, true, "Cache the linked shader programs on disk to speed up later runs.");
+DEFINE_string(shaderCacheDir, "", "The shader cache folder path, defaults to a folder in the system temp folder.");
+
 int main(int argc, char *argv[])
 {
   auto model_start = std::chrono::high_resolution_clock::now();
@@ -154,7 +180,37 @@ int main(int argc, char *argv[])
   //}
 
   // load mesh and textures
-  PTexMesh ptexMesh(meshFile, atlasFolder);
+  PTexMeshOptions meshOptions;
+  meshOptions.meshCacheEnable = FLAGS_meshCacheEnable;
+  meshOptions.meshCacheDir = FLAGS_meshCacheDir;
+  meshOptions.meshMemoryBudgetBytes = size_t(std::max(FLAGS_meshMemoryBudgetMB, 0)) * 1024 * 1024;
+  meshOptions.atlasQueueDepth = FLAGS_atlasQueueDepth;
+  meshOptions.atlasBudgetBytes = size_t(std::max(FLAGS_atlasBudgetMB, 0)) * 1024 * 1024;
+  meshOptions.compactMeshes = FLAGS_compactMeshes;
+  meshOptions.multiDrawEnable = FLAGS_multiDrawEnable;
+  meshOptions.occlusionCullingEnable = FLAGS_occlusionCullingEnable;
+  meshOptions.meshletCullingEnable = FLAGS_meshletCullingEnable;
+  meshOptions.vertexPullingEnable = FLAGS_vertexPullingEnable;
+  meshOptions.vertexCacheOrderEnable = FLAGS_vertexCacheOrderEnable;
+  meshOptions.depthPrepassEnable = FLAGS_depthPrepassEnable;
+  meshOptions.frontToBackEnable = FLAGS_frontToBackEnable;
+  meshOptions.overdrawStatsEnable = FLAGS_overdrawStatsEnable;
+  meshOptions.gpuTimeStatsEnable = FLAGS_gpuTimeStatsEnable;
+  meshOptions.panoFlowWrapAround = FLAGS_panoFlowWrapAround;
+  meshOptions.paddedTilesEnable = FLAGS_paddedTilesEnable;
+  meshOptions.atlasMipmapsEnable = FLAGS_atlasMipmapsEnable;
+  if (FLAGS_atlasLevelsForOutput) {
+    meshOptions.atlasTargetWidth = width;
+    // the panorama spans 360 degrees
+    meshOptions.atlasTargetFov = 2.0f * M_PI;
+    meshOptions.atlasNearDistance = FLAGS_atlasNearDistance;
+  }
+  meshOptions.atlasCompressionEnable = FLAGS_atlasCompressionEnable;
+  meshOptions.atlasCompressionBc1 = FLAGS_atlasCompressionBc1;
+  meshOptions.shaderCacheEnable = FLAGS_shaderCacheEnable;
+  if (!FLAGS_shaderCacheDir.empty())
+    meshOptions.shaderCacheDir = FLAGS_shaderCacheDir;
+  PTexMesh ptexMesh(meshFile, atlasFolder, false, meshOptions);
   ptexMesh.SetExposure(FLAGS_texture_exposure);
   ptexMesh.SetGamma(FLAGS_texture_gamma);
   ptexMesh.SetSaturation(FLAGS_texture_saturation);
@@ -172,6 +228,12 @@ int main(int argc, char *argv[])
   {
     LOG(INFO) << "\rRendering frame " << frame_index + 1 << "/" << numFrames << "... ";
 
+    // stream in the atlases around the current and upcoming poses
+    std::vector<pangolin::OpenGlMatrix> upcomingMV;
+    for (size_t i = frame_index; i < numFrames && i <= frame_index + FLAGS_atlasPrefetchFrames; i++)
+      upcomingMV.push_back(cameraMV[i]);
+    ptexMesh.PrefetchAtlases(upcomingMV);
+
     // 0) load & update the camera pose & MV matrix
     s_cam_current.SetModelViewMatrix(cameraMV[frame_index]);
     s_cam_next.SetModelViewMatrix(cameraMV[(frame_index + 1) % numFrames]);
@@ -283,6 +345,38 @@ int main(int argc, char *argv[])
        saveMotionVector(filename, opticalFlow_backward.ptr, width, height); // output optical flow to file
      }
   }
+  if (FLAGS_atlasBudgetMB > 0) {
+    const AtlasResidency::Stats& atlasStats = ptexMesh.GetAtlasStats();
+    LOG(INFO) << "Atlas residency: " << atlasStats.hits << " hits, " << atlasStats.misses
+              << " misses, " << atlasStats.evictions << " evictions, " << atlasStats.uploads
+              << " uploads, peak " << atlasStats.peakResidentBytes / (1024 * 1024) << " MB resident";
+  }
+
+  const PTexMesh::CullStats& cullStats = ptexMesh.GetCullStats();
+  if (cullStats.passes > 0) {
+    LOG(INFO) << "Culling: " << cullStats.passes << " passes drew "
+              << cullStats.drawn / cullStats.passes << " and culled "
+              << cullStats.culled / cullStats.passes << " and occluded "
+              << cullStats.occluded / cullStats.passes << " sub-meshes on average, testing "
+              << cullStats.boxesTested / cullStats.passes << " boxes";
+    LOG(INFO) << "Meshlets: drew " << cullStats.meshletsDrawn / cullStats.passes << " and culled "
+              << cullStats.meshletsCulled / cullStats.passes << " per pass on average";
+  }
+
+  const PTexMesh::OverdrawStats& overdrawStats = ptexMesh.GetOverdrawStats();
+  if (overdrawStats.pixels > 0) {
+    LOG(INFO) << "Overdraw: " << overdrawStats.passes << " RGB passes passed the depth test for "
+              << (double)overdrawStats.samplesPassed / overdrawStats.pixels
+              << " samples per pixel";
+  }
+
+  const PTexMesh::GpuTimeStats& gpuTimeStats = ptexMesh.GetGpuTimeStats();
+  if (gpuTimeStats.batches > 0) {
+    LOG(INFO) << "GPU: " << gpuTimeStats.batches << " batches of draws took "
+              << gpuTimeStats.nanoseconds / 1e6 << " ms, "
+              << gpuTimeStats.nanoseconds / 1e3 / gpuTimeStats.batches << " us on average";
+  }
+
   auto model_stop = std::chrono::high_resolution_clock::now();
   auto model_duration = std::chrono::duration_cast<std::chrono::microseconds>(model_stop - model_start);
   std::cout << "Time taken rendering the model: " << model_duration.count() << " microseconds" << std::endl;